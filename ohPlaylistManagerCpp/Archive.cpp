@@ -0,0 +1,77 @@
+#include <string.h>
+#include <time.h>
+
+#include <OpenHome/Buffer.h>
+
+#include "Archive.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+WriterTar::WriterTar(IWriter& aWriter)
+	: iWriter(aWriter)
+	, iTime((TUint)time(NULL))
+{
+}
+
+void WriterTar::WriteFile(const Brx& aName, const Brx& aData)
+{
+	if(aName.Bytes() >= kMaxNameBytes)
+	{
+		THROW(WriterError);
+	}
+
+	TByte header[kBlockBytes];
+	memset(header, 0, kBlockBytes);
+	memcpy(header, aName.Ptr(), aName.Bytes());
+	WriteOctal(header + 100, 8, 0644);				// mode
+	WriteOctal(header + 108, 8, 0);					// uid
+	WriteOctal(header + 116, 8, 0);					// gid
+	WriteOctal(header + 124, 12, aData.Bytes());
+	WriteOctal(header + 136, 12, iTime);
+	header[156] = '0';								// regular file
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+
+	// the checksum is taken with its own field filled with spaces
+	memset(header + 148, ' ', 8);
+	TUint sum = 0;
+	for(TUint i = 0; i < kBlockBytes; ++i)
+	{
+		sum += header[i];
+	}
+	WriteOctal(header + 148, 7, sum);
+
+	iWriter.Write(Brn(header, kBlockBytes));
+	iWriter.Write(aData);
+
+	TUint padding = (kBlockBytes - aData.Bytes() % kBlockBytes) % kBlockBytes;
+	if(padding > 0)
+	{
+		memset(header, 0, padding);
+		iWriter.Write(Brn(header, padding));
+	}
+}
+
+void WriterTar::WriteEnd()
+{
+	TByte empty[kBlockBytes];
+	memset(empty, 0, kBlockBytes);
+
+	iWriter.Write(Brn(empty, kBlockBytes));
+	iWriter.Write(Brn(empty, kBlockBytes));
+	iWriter.WriteFlush();
+}
+
+// zero padded octal digits followed by a nul, filling aFieldBytes
+void WriterTar::WriteOctal(TByte* aField, TUint aFieldBytes, TUint aValue)
+{
+	TUint digits = aFieldBytes - 1;
+	aField[digits] = 0;
+
+	for(TUint i = digits; i > 0; --i)
+	{
+		aField[i - 1] = (TByte)('0' + (aValue & 7));
+		aValue >>= 3;
+	}
+}
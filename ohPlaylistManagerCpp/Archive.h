@@ -0,0 +1,38 @@
+#ifndef HEADER_PLAYLISTMANAGER_ARCHIVE
+#define HEADER_PLAYLISTMANAGER_ARCHIVE
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Stream.h>
+
+namespace OpenHome {
+namespace Media {
+
+// Writes a POSIX ustar archive of whole files, so a snapshot of the store
+// can be unpacked into a root directory with any tar.
+
+class WriterTar
+{
+public:
+	static const TUint kBlockBytes = 512;
+	static const TUint kMaxNameBytes = 100;
+
+public:
+	WriterTar(IWriter& aWriter);
+
+	void WriteFile(const Brx& aName, const Brx& aData);
+
+	// the two empty blocks that end an archive
+	void WriteEnd();
+
+private:
+	static void WriteOctal(TByte* aField, TUint aFieldBytes, TUint aValue);
+
+private:
+	IWriter& iWriter;
+	TUint iTime;
+};
+
+} // Media
+} // OpenHome
+
+#endif
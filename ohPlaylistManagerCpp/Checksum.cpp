@@ -0,0 +1,109 @@
+#include <string.h>
+
+#include <OpenHome/Buffer.h>
+
+#include "Checksum.h"
+
+#if defined(__SSE4_2__)
+# include <nmmintrin.h>
+# define CHECKSUM_SSE42
+#endif
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+#ifndef CHECKSUM_SSE42
+
+static const TUint kPolynomial = 0x82f63b78; // reflected
+
+class Crc32cTable
+{
+public:
+	Crc32cTable();
+
+	TUint iTable[8][256];
+};
+
+Crc32cTable::Crc32cTable()
+{
+	for(TUint i = 0; i < 256; ++i)
+	{
+		TUint crc = i;
+		for(TUint bit = 0; bit < 8; ++bit)
+		{
+			crc = (crc & 1) ? (crc >> 1) ^ kPolynomial : crc >> 1;
+		}
+		iTable[0][i] = crc;
+	}
+
+	for(TUint i = 0; i < 256; ++i)
+	{
+		for(TUint slice = 1; slice < 8; ++slice)
+		{
+			iTable[slice][i] = (iTable[slice - 1][i] >> 8) ^ iTable[0][iTable[slice - 1][i] & 0xff];
+		}
+	}
+}
+
+// built during static initialisation, before any thread can ask for a checksum
+static const Crc32cTable kCrc32c;
+
+#endif
+
+TUint Crc32c::Compute(const Brx& aBuffer)
+{
+	return Update(0, aBuffer);
+}
+
+TUint Crc32c::Update(TUint aCrc, const Brx& aBuffer)
+{
+	const TByte* p = aBuffer.Ptr();
+	const TByte* end = p + aBuffer.Bytes();
+	TUint crc = ~aCrc;
+
+#ifdef CHECKSUM_SSE42
+# if defined(__x86_64__) || defined(_M_X64)
+	TUint64 crc64 = crc;
+	for(; end - p >= 8; p += 8)
+	{
+		TUint64 word;
+		memcpy(&word, p, 8);
+		crc64 = _mm_crc32_u64(crc64, word);
+	}
+	crc = (TUint)crc64;
+# endif
+	for(; p < end; ++p)
+	{
+		crc = _mm_crc32_u8(crc, *p);
+	}
+#else
+	const TUint (*table)[256] = kCrc32c.iTable;
+
+	// eight bytes per step, assembled little-endian whatever the host
+	for(; end - p >= 8; p += 8)
+	{
+		TUint low = (p[0] | (p[1] << 8) | (p[2] << 16) | ((TUint)p[3] << 24)) ^ crc;
+		TUint high = p[4] | (p[5] << 8) | (p[6] << 16) | ((TUint)p[7] << 24);
+
+		crc = table[7][low & 0xff] ^ table[6][(low >> 8) & 0xff] ^ table[5][(low >> 16) & 0xff] ^ table[4][low >> 24]
+			^ table[3][high & 0xff] ^ table[2][(high >> 8) & 0xff] ^ table[1][(high >> 16) & 0xff] ^ table[0][high >> 24];
+	}
+	for(; p < end; ++p)
+	{
+		crc = (crc >> 8) ^ table[0][(crc ^ *p) & 0xff];
+	}
+#endif
+
+	return ~crc;
+}
+
+TUint Crc32c::Update(TUint aCrc, TUint aValue)
+{
+	TByte bytes[4];
+	bytes[0] = (TByte)(aValue >> 24);
+	bytes[1] = (TByte)(aValue >> 16);
+	bytes[2] = (TByte)(aValue >> 8);
+	bytes[3] = (TByte)aValue;
+
+	return Update(aCrc, Brn(bytes, 4));
+}
@@ -0,0 +1,28 @@
+#ifndef HEADER_PLAYLISTMANAGER_CHECKSUM
+#define HEADER_PLAYLISTMANAGER_CHECKSUM
+
+#include <OpenHome/Buffer.h>
+
+EXCEPTION(ChecksumError);
+
+namespace OpenHome {
+namespace Media {
+
+// CRC-32C (Castagnoli), used to detect torn and corrupted records.  The
+// SSE4.2 instruction is used where the compiler targets it, otherwise a
+// slicing-by-8 table.
+
+class Crc32c
+{
+public:
+	static TUint Compute(const Brx& aBuffer);
+
+	// continues aCrc, a value returned by Compute or Update, over aBuffer
+	static TUint Update(TUint aCrc, const Brx& aBuffer);
+	static TUint Update(TUint aCrc, TUint aValue);
+};
+
+} // Media
+} // OpenHome
+
+#endif
@@ -0,0 +1,208 @@
+#include "DvAvOpenhomeOrgPlaylistManagerExtension1.h"
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Private/Standard.h>
+#include <OpenHome/Net/Core/DvInvocationResponse.h>
+#include <OpenHome/Net/Private/DviService.h>
+#include <OpenHome/Net/Private/Service.h>
+#include <OpenHome/Net/Private/FunctorDviInvocation.h>
+
+using namespace OpenHome;
+using namespace OpenHome::Net;
+
+DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DvProviderAvOpenhomeOrgPlaylistManagerExtension1(DvDevice& aDevice)
+	: DvProvider(aDevice.Device(), "av.openhome.org", "PlaylistManagerExtension", 1)
+{
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::EnableActionInsertList()
+{
+	OpenHome::Net::Action* action = new OpenHome::Net::Action("InsertList");
+	action->AddInputParameter(new ParameterUint("Id"));
+	action->AddInputParameter(new ParameterUint("AfterTrackId"));
+	action->AddInputParameter(new ParameterString("MetadataList"));
+	action->AddOutputParameter(new ParameterBinary("NewIdArray"));
+	FunctorDviInvocation functor = MakeFunctorDviInvocation(*this, &DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoInsertList);
+	iService->AddAction(action, functor);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::EnableActionDeleteList()
+{
+	OpenHome::Net::Action* action = new OpenHome::Net::Action("DeleteList");
+	action->AddInputParameter(new ParameterUint("Id"));
+	action->AddInputParameter(new ParameterBinary("IdArray"));
+	action->AddOutputParameter(new ParameterBinary("MissingIdArray"));
+	FunctorDviInvocation functor = MakeFunctorDviInvocation(*this, &DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoDeleteList);
+	iService->AddAction(action, functor);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::EnableActionMove()
+{
+	OpenHome::Net::Action* action = new OpenHome::Net::Action("Move");
+	action->AddInputParameter(new ParameterUint("Id"));
+	action->AddInputParameter(new ParameterUint("TrackId"));
+	action->AddInputParameter(new ParameterUint("AfterTrackId"));
+	FunctorDviInvocation functor = MakeFunctorDviInvocation(*this, &DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoMove);
+	iService->AddAction(action, functor);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::EnableActionMoveList()
+{
+	OpenHome::Net::Action* action = new OpenHome::Net::Action("MoveList");
+	action->AddInputParameter(new ParameterUint("Id"));
+	action->AddInputParameter(new ParameterBinary("IdArray"));
+	action->AddInputParameter(new ParameterUint("AfterTrackId"));
+	FunctorDviInvocation functor = MakeFunctorDviInvocation(*this, &DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoMoveList);
+	iService->AddAction(action, functor);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::EnableActionReadRange()
+{
+	OpenHome::Net::Action* action = new OpenHome::Net::Action("ReadRange");
+	action->AddInputParameter(new ParameterUint("Id"));
+	action->AddInputParameter(new ParameterUint("Start"));
+	action->AddInputParameter(new ParameterUint("Count"));
+	action->AddOutputParameter(new ParameterString("TrackList"));
+	FunctorDviInvocation functor = MakeFunctorDviInvocation(*this, &DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoReadRange);
+	iService->AddAction(action, functor);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::EnableActionReadListArray()
+{
+	OpenHome::Net::Action* action = new OpenHome::Net::Action("ReadListArray");
+	action->AddInputParameter(new ParameterUint("Id"));
+	action->AddInputParameter(new ParameterBinary("IdArray"));
+	action->AddOutputParameter(new ParameterString("TrackList"));
+	FunctorDviInvocation functor = MakeFunctorDviInvocation(*this, &DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoReadListArray);
+	iService->AddAction(action, functor);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::EnableActionChangesSince()
+{
+	OpenHome::Net::Action* action = new OpenHome::Net::Action("ChangesSince");
+	action->AddInputParameter(new ParameterUint("Token"));
+	action->AddOutputParameter(new ParameterBool("Valid"));
+	action->AddOutputParameter(new ParameterUint("NewToken"));
+	action->AddOutputParameter(new ParameterBinary("Changes"));
+	FunctorDviInvocation functor = MakeFunctorDviInvocation(*this, &DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoChangesSince);
+	iService->AddAction(action, functor);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoInsertList(IDviInvocation& aInvocation)
+{
+	DviInvocation invocation(aInvocation);
+	aInvocation.InvocationReadStart();
+	TUint id = aInvocation.InvocationReadUint("Id");
+	TUint afterTrackId = aInvocation.InvocationReadUint("AfterTrackId");
+	Brhz metadataList;
+	aInvocation.InvocationReadString("MetadataList", metadataList);
+	aInvocation.InvocationReadEnd();
+	DviInvocationResponseBinary respNewIdArray(aInvocation, "NewIdArray");
+	InsertList(invocation, id, afterTrackId, metadataList, respNewIdArray);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoDeleteList(IDviInvocation& aInvocation)
+{
+	DviInvocation invocation(aInvocation);
+	aInvocation.InvocationReadStart();
+	TUint id = aInvocation.InvocationReadUint("Id");
+	Brh idArray;
+	aInvocation.InvocationReadBinary("IdArray", idArray);
+	aInvocation.InvocationReadEnd();
+	DviInvocationResponseBinary respMissingIdArray(aInvocation, "MissingIdArray");
+	DeleteList(invocation, id, idArray, respMissingIdArray);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoMove(IDviInvocation& aInvocation)
+{
+	DviInvocation invocation(aInvocation);
+	aInvocation.InvocationReadStart();
+	TUint id = aInvocation.InvocationReadUint("Id");
+	TUint trackId = aInvocation.InvocationReadUint("TrackId");
+	TUint afterTrackId = aInvocation.InvocationReadUint("AfterTrackId");
+	aInvocation.InvocationReadEnd();
+	Move(invocation, id, trackId, afterTrackId);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoMoveList(IDviInvocation& aInvocation)
+{
+	DviInvocation invocation(aInvocation);
+	aInvocation.InvocationReadStart();
+	TUint id = aInvocation.InvocationReadUint("Id");
+	Brh idArray;
+	aInvocation.InvocationReadBinary("IdArray", idArray);
+	TUint afterTrackId = aInvocation.InvocationReadUint("AfterTrackId");
+	aInvocation.InvocationReadEnd();
+	MoveList(invocation, id, idArray, afterTrackId);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoReadRange(IDviInvocation& aInvocation)
+{
+	DviInvocation invocation(aInvocation);
+	aInvocation.InvocationReadStart();
+	TUint id = aInvocation.InvocationReadUint("Id");
+	TUint start = aInvocation.InvocationReadUint("Start");
+	TUint count = aInvocation.InvocationReadUint("Count");
+	aInvocation.InvocationReadEnd();
+	DviInvocationResponseString respTrackList(aInvocation, "TrackList");
+	ReadRange(invocation, id, start, count, respTrackList);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoReadListArray(IDviInvocation& aInvocation)
+{
+	DviInvocation invocation(aInvocation);
+	aInvocation.InvocationReadStart();
+	TUint id = aInvocation.InvocationReadUint("Id");
+	Brh idArray;
+	aInvocation.InvocationReadBinary("IdArray", idArray);
+	aInvocation.InvocationReadEnd();
+	DviInvocationResponseString respTrackList(aInvocation, "TrackList");
+	ReadListArray(invocation, id, idArray, respTrackList);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DoChangesSince(IDviInvocation& aInvocation)
+{
+	DviInvocation invocation(aInvocation);
+	aInvocation.InvocationReadStart();
+	TUint token = aInvocation.InvocationReadUint("Token");
+	aInvocation.InvocationReadEnd();
+	DviInvocationResponseBool respValid(aInvocation, "Valid");
+	DviInvocationResponseUint respNewToken(aInvocation, "NewToken");
+	DviInvocationResponseBinary respChanges(aInvocation, "Changes");
+	ChangesSince(invocation, token, respValid, respNewToken, respChanges);
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::InsertList(IDvInvocation& /*aInvocation*/, TUint /*aId*/, TUint /*aAfterTrackId*/, const Brx& /*aMetadataList*/, IDvInvocationResponseBinary& /*aNewIdArray*/)
+{
+	ASSERTS();
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::DeleteList(IDvInvocation& /*aInvocation*/, TUint /*aId*/, const Brx& /*aIdArray*/, IDvInvocationResponseBinary& /*aMissingIdArray*/)
+{
+	ASSERTS();
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::Move(IDvInvocation& /*aInvocation*/, TUint /*aId*/, TUint /*aTrackId*/, TUint /*aAfterTrackId*/)
+{
+	ASSERTS();
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::MoveList(IDvInvocation& /*aInvocation*/, TUint /*aId*/, const Brx& /*aIdArray*/, TUint /*aAfterTrackId*/)
+{
+	ASSERTS();
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::ReadRange(IDvInvocation& /*aInvocation*/, TUint /*aId*/, TUint /*aStart*/, TUint /*aCount*/, IDvInvocationResponseString& /*aTrackList*/)
+{
+	ASSERTS();
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::ReadListArray(IDvInvocation& /*aInvocation*/, TUint /*aId*/, const Brx& /*aIdArray*/, IDvInvocationResponseString& /*aTrackList*/)
+{
+	ASSERTS();
+}
+
+void DvProviderAvOpenhomeOrgPlaylistManagerExtension1::ChangesSince(IDvInvocation& /*aInvocation*/, TUint /*aToken*/, IDvInvocationResponseBool& /*aValid*/, IDvInvocationResponseUint& /*aNewToken*/, IDvInvocationResponseBinary& /*aChanges*/)
+{
+	ASSERTS();
+}
@@ -0,0 +1,58 @@
+#ifndef HEADER_DVAVOPENHOMEORGPLAYLISTMANAGEREXTENSION1
+#define HEADER_DVAVOPENHOMEORGPLAYLISTMANAGEREXTENSION1
+
+#include <OpenHome/OhNetTypes.h>
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Net/Core/DvDevice.h>
+#include <OpenHome/Net/Core/DvProvider.h>
+
+namespace OpenHome {
+namespace Net {
+
+class IDviInvocation;
+
+// Provider for the av.openhome.org:PlaylistManagerExtension:1 service.
+// There is no service description to generate this from, so it is written
+// by hand in the form ohNet gives its generated providers: an action is
+// only offered once its EnableAction method has been called, and a derived
+// class answers it by overriding the virtual of the same name.
+class DvProviderAvOpenhomeOrgPlaylistManagerExtension1 : public DvProvider
+{
+public:
+	virtual ~DvProviderAvOpenhomeOrgPlaylistManagerExtension1() {}
+
+protected:
+	DvProviderAvOpenhomeOrgPlaylistManagerExtension1(DvDevice& aDevice);
+
+	void EnableActionInsertList();
+	void EnableActionDeleteList();
+	void EnableActionMove();
+	void EnableActionMoveList();
+	void EnableActionReadRange();
+	void EnableActionReadListArray();
+	void EnableActionChangesSince();
+
+private:
+	virtual void InsertList(IDvInvocation& aInvocation, TUint aId, TUint aAfterTrackId, const Brx& aMetadataList, IDvInvocationResponseBinary& aNewIdArray);
+	virtual void DeleteList(IDvInvocation& aInvocation, TUint aId, const Brx& aIdArray, IDvInvocationResponseBinary& aMissingIdArray);
+	virtual void Move(IDvInvocation& aInvocation, TUint aId, TUint aTrackId, TUint aAfterTrackId);
+	virtual void MoveList(IDvInvocation& aInvocation, TUint aId, const Brx& aIdArray, TUint aAfterTrackId);
+	virtual void ReadRange(IDvInvocation& aInvocation, TUint aId, TUint aStart, TUint aCount, IDvInvocationResponseString& aTrackList);
+	virtual void ReadListArray(IDvInvocation& aInvocation, TUint aId, const Brx& aIdArray, IDvInvocationResponseString& aTrackList);
+	virtual void ChangesSince(IDvInvocation& aInvocation, TUint aToken, IDvInvocationResponseBool& aValid, IDvInvocationResponseUint& aNewToken, IDvInvocationResponseBinary& aChanges);
+
+private:
+	DvProviderAvOpenhomeOrgPlaylistManagerExtension1();
+	void DoInsertList(IDviInvocation& aInvocation);
+	void DoDeleteList(IDviInvocation& aInvocation);
+	void DoMove(IDviInvocation& aInvocation);
+	void DoMoveList(IDviInvocation& aInvocation);
+	void DoReadRange(IDviInvocation& aInvocation);
+	void DoReadListArray(IDviInvocation& aInvocation);
+	void DoChangesSince(IDviInvocation& aInvocation);
+};
+
+} // namespace Net
+} // namespace OpenHome
+
+#endif // HEADER_DVAVOPENHOMEORGPLAYLISTMANAGEREXTENSION1
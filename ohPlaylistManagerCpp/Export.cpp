@@ -0,0 +1,513 @@
+#include <string.h>
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Ascii.h>
+#include <OpenHome/Private/Stream.h>
+
+#include "Export.h"
+#include "XmlTokenizer.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+static const Brn kDidlNamespaces("xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\"");
+static const Brn kDidlStart("<DIDL-Lite");
+static const Brn kDidlEnd("</DIDL-Lite>");
+
+static const TUint kMaxElementNameBytes = 32;
+
+// the offset of the first aValue in aXml at or after aFrom, or aXml.Bytes()
+static TUint Find(const Brx& aXml, TUint aFrom, const Brx& aValue)
+{
+	const TByte* start = aXml.Ptr();
+	const TByte* end = start + aXml.Bytes();
+	const TByte* p = start + aFrom;
+
+	while(p + aValue.Bytes() <= end)
+	{
+		p = (const TByte*)memchr(p, aValue[0], end - p);
+		if(p == NULL || p + aValue.Bytes() > end)
+		{
+			break;
+		}
+		if(memcmp(p, aValue.Ptr(), aValue.Bytes()) == 0)
+		{
+			return (TUint)(p - start);
+		}
+		++p;
+	}
+
+	return aXml.Bytes();
+}
+
+static TBool IsSpace(TByte aValue)
+{
+	return (aValue == ' ' || aValue == '\t' || aValue == '\r' || aValue == '\n');
+}
+
+// The start tag, between its angle brackets, and the text of the first aName
+// element in aXml.  The text is still escaped.
+static TBool Element(const Brx& aXml, const TChar* aName, Brn& aTag, Brn& aText)
+{
+	Bws<kMaxElementNameBytes> start("<");
+	start.Append(aName);
+
+	TUint offset = 0;
+	for(;;)
+	{
+		offset = Find(aXml, offset, start);
+		TUint after = offset + start.Bytes();
+		if(after >= aXml.Bytes())
+		{
+			return false;
+		}
+		if(aXml[after] == '>' || aXml[after] == '/' || IsSpace(aXml[after]))
+		{
+			break;
+		}
+		offset = after;
+	}
+
+	TUint tagEnd = Find(aXml, offset, Brn(">"));
+	if(tagEnd == aXml.Bytes())
+	{
+		return false;
+	}
+	aTag.Set(aXml.Ptr() + offset + 1, tagEnd - offset - 1);
+
+	if(aTag.Bytes() > 0 && aTag[aTag.Bytes() - 1] == '/')
+	{
+		aText.Set(aXml.Ptr(), 0);
+		return true;
+	}
+
+	TUint textEnd = Find(aXml, tagEnd + 1, Brn("<"));
+	aText.Set(aXml.Ptr() + tagEnd + 1, textEnd - tagEnd - 1);
+	return true;
+}
+
+static Brn Text(const Brx& aXml, const TChar* aName)
+{
+	Brn tag;
+	Brn text;
+	if(!Element(aXml, aName, tag, text))
+	{
+		return Brn(aXml.Ptr(), 0);
+	}
+	return Ascii::Trim(text);
+}
+
+// the value of the aName attribute in a start tag
+static Brn Attribute(const Brx& aTag, const TChar* aName)
+{
+	Bws<kMaxElementNameBytes> pattern(aName);
+	pattern.Append("=\"");
+
+	TUint offset = 0;
+	for(;;)
+	{
+		offset = Find(aTag, offset, pattern);
+		if(offset == aTag.Bytes())
+		{
+			return Brn(aTag.Ptr(), 0);
+		}
+		if(offset > 0 && IsSpace(aTag[offset - 1]))
+		{
+			break;
+		}
+		offset += pattern.Bytes();
+	}
+
+	TUint start = offset + pattern.Bytes();
+	TUint end = Find(aTag, start, Brn("\""));
+	return Brn(aTag.Ptr() + start, end - start);
+}
+
+// H:MM:SS with optional fractions of a second; -1 if the duration isn't known
+static TInt Seconds(const Brx& aDuration)
+{
+	TUint seconds = 0;
+	TUint field = 0;
+	TBool digits = false;
+
+	for(TUint i = 0; i < aDuration.Bytes(); ++i)
+	{
+		TByte c = aDuration[i];
+		if(Ascii::IsDigit(c))
+		{
+			field = field * 10 + (c - '0');
+			digits = true;
+		}
+		else if(c == ':')
+		{
+			seconds = (seconds + field) * 60;
+			field = 0;
+		}
+		else if(c == '.')
+		{
+			break;
+		}
+		else
+		{
+			return -1;
+		}
+	}
+
+	if(!digits)
+	{
+		return -1;
+	}
+	return (TInt)(seconds + field);
+}
+
+static TByte Unescape(const Brx& aEntity)
+{
+	if(aEntity == Brn("&amp;"))
+	{
+		return '&';
+	}
+	if(aEntity == Brn("&lt;"))
+	{
+		return '<';
+	}
+	if(aEntity == Brn("&gt;"))
+	{
+		return '>';
+	}
+	if(aEntity == Brn("&quot;"))
+	{
+		return '"';
+	}
+	if(aEntity == Brn("&apos;"))
+	{
+		return '\'';
+	}
+	return 0;
+}
+
+// aText kept to one line, and unescaped if it came from XML
+static void WriteLine(IWriter& aWriter, const Brx& aText, TBool aEscaped)
+{
+	TUint run = 0;
+
+	for(TUint i = 0; i < aText.Bytes(); ++i)
+	{
+		TByte c = aText[i];
+		if(c == '\r' || c == '\n')
+		{
+			aWriter.Write(Brn(aText.Ptr() + run, i - run));
+			aWriter.Write(' ');
+			run = i + 1;
+		}
+		else if(c == '&' && aEscaped)
+		{
+			TUint end = Find(aText, i, Brn(";"));
+			if(end == aText.Bytes())
+			{
+				continue;
+			}
+
+			// anything but the five named entities is left as it is
+			TByte value = Unescape(Brn(aText.Ptr() + i, end - i + 1));
+			if(value != 0)
+			{
+				aWriter.Write(Brn(aText.Ptr() + run, i - run));
+				aWriter.Write(value);
+				i = end;
+				run = end + 1;
+			}
+		}
+	}
+
+	aWriter.Write(Brn(aText.Ptr() + run, aText.Bytes() - run));
+}
+
+PlaylistExporter::EFormat PlaylistExporter::Format(const Brx& aName)
+{
+	if(Ascii::CaseInsensitiveEquals(aName, Brn("m3u")))
+	{
+		return eM3u;
+	}
+	if(Ascii::CaseInsensitiveEquals(aName, Brn("xspf")))
+	{
+		return eXspf;
+	}
+	if(Ascii::CaseInsensitiveEquals(aName, Brn("didl")))
+	{
+		return eDidlLite;
+	}
+	return eUnknown;
+}
+
+const Brx& PlaylistExporter::Extension(EFormat aFormat)
+{
+	static const Brn kM3u(".m3u");
+	static const Brn kXspf(".xspf");
+	static const Brn kDidl(".xml");
+
+	switch(aFormat)
+	{
+	case eM3u:
+		return kM3u;
+	case eXspf:
+		return kXspf;
+	default:
+		return kDidl;
+	}
+}
+
+PlaylistExporter::PlaylistExporter(EFormat aFormat, IWriter& aWriter)
+	: iFormat(aFormat)
+	, iWriter(aWriter)
+{
+}
+
+void PlaylistExporter::WriteStart(const Brx& aName, const Brx& aDescription)
+{
+	switch(iFormat)
+	{
+	case eM3u:
+		iWriter.Write(Brn("#EXTM3U\n#PLAYLIST:"));
+		WriteLine(iWriter, aName, false);
+		iWriter.Write('\n');
+		break;
+
+	case eXspf:
+		iWriter.Write(Brn("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<playlist version=\"1\" xmlns=\"http://xspf.org/ns/0/\">\n  <title>"));
+		XmlEscaper::Write(iWriter, aName);
+		iWriter.Write(Brn("</title>\n"));
+		if(aDescription.Bytes() > 0)
+		{
+			iWriter.Write(Brn("  <annotation>"));
+			XmlEscaper::Write(iWriter, aDescription);
+			iWriter.Write(Brn("</annotation>\n"));
+		}
+		iWriter.Write(Brn("  <trackList>\n"));
+		break;
+
+	default:
+		// the playlist itself, which importers looking for items pass over
+		iWriter.Write(Brn("<DIDL-Lite "));
+		iWriter.Write(kDidlNamespaces);
+		iWriter.Write(Brn(">\n<container id=\"\" parentID=\"\" restricted=\"True\"><dc:title>"));
+		XmlEscaper::Write(iWriter, aName);
+		iWriter.Write(Brn("</dc:title>"));
+		if(aDescription.Bytes() > 0)
+		{
+			iWriter.Write(Brn("<dc:description>"));
+			XmlEscaper::Write(iWriter, aDescription);
+			iWriter.Write(Brn("</dc:description>"));
+		}
+		iWriter.Write(Brn("<upnp:class>object.container.playlistContainer</upnp:class></container>\n"));
+		break;
+	}
+}
+
+void PlaylistExporter::WriteTrack(const Brx& aMetadata)
+{
+	switch(iFormat)
+	{
+	case eM3u:
+		WriteM3u(aMetadata);
+		break;
+	case eXspf:
+		WriteXspf(aMetadata);
+		break;
+	default:
+		WriteDidlLite(aMetadata);
+		break;
+	}
+}
+
+void PlaylistExporter::WriteEnd()
+{
+	switch(iFormat)
+	{
+	case eM3u:
+		break;
+	case eXspf:
+		iWriter.Write(Brn("  </trackList>\n</playlist>\n"));
+		break;
+	default:
+		iWriter.Write(kDidlEnd);
+		iWriter.Write('\n');
+		break;
+	}
+
+	iWriter.WriteFlush();
+}
+
+// #EXTINF:seconds,artist - title followed by the uri; tracks without a
+// res have nothing to play and are left out
+void PlaylistExporter::WriteM3u(const Brx& aMetadata)
+{
+	Brn res;
+	Brn uri;
+	if(!Element(aMetadata, "res", res, uri) || Ascii::Trim(uri).Bytes() == 0)
+	{
+		return;
+	}
+
+	Brn artist = Text(aMetadata, "upnp:artist");
+	if(artist.Bytes() == 0)
+	{
+		artist.Set(Text(aMetadata, "dc:creator"));
+	}
+
+	iWriter.Write(Brn("#EXTINF:"));
+	Ascii::StreamWriteInt(iWriter, Seconds(Attribute(res, "duration")));
+	iWriter.Write(',');
+	if(artist.Bytes() > 0)
+	{
+		WriteLine(iWriter, artist, true);
+		iWriter.Write(Brn(" - "));
+	}
+	WriteLine(iWriter, Text(aMetadata, "dc:title"), true);
+	iWriter.Write('\n');
+	WriteLine(iWriter, Ascii::Trim(uri), true);
+	iWriter.Write('\n');
+}
+
+// the fields are copied still escaped, so nothing is unescaped only to be
+// escaped again
+void PlaylistExporter::WriteXspf(const Brx& aMetadata)
+{
+	Brn res;
+	Brn uri;
+	TBool hasRes = Element(aMetadata, "res", res, uri);
+
+	iWriter.Write(Brn("    <track>"));
+
+	if(hasRes && Ascii::Trim(uri).Bytes() > 0)
+	{
+		iWriter.Write(Brn("<location>"));
+		iWriter.Write(Ascii::Trim(uri));
+		iWriter.Write(Brn("</location>"));
+	}
+
+	Brn title = Text(aMetadata, "dc:title");
+	if(title.Bytes() > 0)
+	{
+		iWriter.Write(Brn("<title>"));
+		iWriter.Write(title);
+		iWriter.Write(Brn("</title>"));
+	}
+
+	Brn artist = Text(aMetadata, "upnp:artist");
+	if(artist.Bytes() == 0)
+	{
+		artist.Set(Text(aMetadata, "dc:creator"));
+	}
+	if(artist.Bytes() > 0)
+	{
+		iWriter.Write(Brn("<creator>"));
+		iWriter.Write(artist);
+		iWriter.Write(Brn("</creator>"));
+	}
+
+	Brn album = Text(aMetadata, "upnp:album");
+	if(album.Bytes() > 0)
+	{
+		iWriter.Write(Brn("<album>"));
+		iWriter.Write(album);
+		iWriter.Write(Brn("</album>"));
+	}
+
+	Brn image = Text(aMetadata, "upnp:albumArtURI");
+	if(image.Bytes() > 0)
+	{
+		iWriter.Write(Brn("<image>"));
+		iWriter.Write(image);
+		iWriter.Write(Brn("</image>"));
+	}
+
+	TInt seconds = hasRes ? Seconds(Attribute(res, "duration")) : -1;
+	if(seconds >= 0)
+	{
+		iWriter.Write(Brn("<duration>"));
+		Ascii::StreamWriteUint(iWriter, (TUint)seconds * 1000);
+		iWriter.Write(Brn("</duration>"));
+	}
+
+	iWriter.Write(Brn("</track>\n"));
+}
+
+// The track's own DIDL-Lite element is dropped and its item copied into the
+// one document.  Namespaces the track declared beyond the usual ones move
+// onto the item, unless it declares them itself.
+void PlaylistExporter::WriteDidlLite(const Brx& aMetadata)
+{
+	TUint start = Find(aMetadata, 0, kDidlStart);
+	TUint startEnd = Find(aMetadata, start, Brn(">"));
+	if(startEnd == aMetadata.Bytes())
+	{
+		return;
+	}
+
+	TUint end = startEnd;
+	for(TUint i = Find(aMetadata, startEnd, kDidlEnd); i < aMetadata.Bytes(); i = Find(aMetadata, i + 1, kDidlEnd))
+	{
+		end = i;
+	}
+	if(end == startEnd)
+	{
+		end = aMetadata.Bytes();
+	}
+
+	Brn attributes = Ascii::Trim(Brn(aMetadata.Ptr() + start + kDidlStart.Bytes(), startEnd - start - kDidlStart.Bytes()));
+	Brn body(aMetadata.Ptr() + startEnd + 1, end - startEnd - 1);
+
+	TUint item = Find(body, 0, Brn("<"));
+	if(attributes == kDidlNamespaces || item == body.Bytes())
+	{
+		iWriter.Write(body);
+		iWriter.Write('\n');
+		return;
+	}
+
+	TUint name = item + 1;
+	while(name < body.Bytes() && body[name] != '>' && body[name] != '/' && !IsSpace(body[name]))
+	{
+		++name;
+	}
+	Brn tag(body.Ptr() + item, Find(body, item, Brn(">")) - item);
+
+	iWriter.Write(Brn(body.Ptr(), name));
+
+	// name="value" pairs, in either quote
+	TUint i = 0;
+	while(i < attributes.Bytes())
+	{
+		while(i < attributes.Bytes() && IsSpace(attributes[i]))
+		{
+			++i;
+		}
+		TUint equals = Find(attributes, i, Brn("="));
+		if(equals + 1 >= attributes.Bytes())
+		{
+			break;
+		}
+		TByte quote = attributes[equals + 1];
+		TUint close = Find(attributes, equals + 2, Brn(&quote, 1));
+		Brn attribute(attributes.Ptr() + i, equals - i);
+		if(close == attributes.Bytes() || attribute.Bytes() > kMaxElementNameBytes)
+		{
+			break;
+		}
+
+		Bws<kMaxElementNameBytes + 2> declared(" ");
+		declared.Append(attribute);
+		declared.Append('=');
+
+		if(Find(tag, 0, declared) == tag.Bytes())
+		{
+			iWriter.Write(' ');
+			iWriter.Write(Brn(attributes.Ptr() + i, close + 1 - i));
+		}
+
+		i = close + 1;
+	}
+
+	iWriter.Write(Brn(body.Ptr() + name, body.Bytes() - name));
+	iWriter.Write('\n');
+}
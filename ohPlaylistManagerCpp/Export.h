@@ -0,0 +1,52 @@
+#ifndef HEADER_PLAYLISTMANAGER_EXPORT
+#define HEADER_PLAYLISTMANAGER_EXPORT
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Stream.h>
+
+namespace OpenHome {
+namespace Media {
+
+// Writes a playlist for other players as its tracks are handed over, one
+// track's stored DIDL-Lite at a time, so nothing is held beyond the track
+// being written.  DIDL-Lite items are copied as they are; M3U and XSPF take
+// the title, artist, album, art, duration and first res from each item.
+
+class PlaylistExporter
+{
+public:
+	enum EFormat
+	{
+		eUnknown,
+		eM3u,
+		eXspf,
+		eDidlLite
+	};
+
+public:
+	// m3u, xspf or didl
+	static EFormat Format(const Brx& aName);
+	static const Brx& Extension(EFormat aFormat);
+
+	PlaylistExporter(EFormat aFormat, IWriter& aWriter);
+
+	void WriteStart(const Brx& aName, const Brx& aDescription);
+	void WriteTrack(const Brx& aMetadata);
+
+	// ends the document and flushes the writer
+	void WriteEnd();
+
+private:
+	void WriteM3u(const Brx& aMetadata);
+	void WriteXspf(const Brx& aMetadata);
+	void WriteDidlLite(const Brx& aMetadata);
+
+private:
+	EFormat iFormat;
+	IWriter& iWriter;
+};
+
+} // Media
+} // OpenHome
+
+#endif
@@ -0,0 +1,436 @@
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Ascii.h>
+#include <OpenHome/Private/Stream.h>
+
+#include "Import.h"
+#include "Stream.h"
+#include "XmlTokenizer.h"
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// room for every field escaped at its worst; anything over a track's limit
+// is condensed by the handler, as an oversized Insert would be
+static const TUint kMaxTrackBytes = 32 * 1024;
+
+static const Brn kDidlStart("<DIDL-Lite xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\">");
+static const Brn kDidlEnd("</DIDL-Lite>");
+
+// at most kMaxFieldBytes of aValue
+static Brn Field(const Brx& aValue)
+{
+	TUint bytes = aValue.Bytes();
+	if(bytes > PlaylistImporter::kMaxFieldBytes)
+	{
+		bytes = PlaylistImporter::kMaxFieldBytes;
+	}
+	return Brn(aValue.Ptr(), bytes);
+}
+
+// the name of a tag, without attributes; empty for a self-closing tag
+static Brn TagName(const Brx& aTag)
+{
+	if(aTag.Bytes() > 0 && aTag[aTag.Bytes() - 1] == '/')
+	{
+		return Brn(aTag.Ptr(), 0);
+	}
+
+	for(TUint i = 0; i < aTag.Bytes(); ++i)
+	{
+		if(aTag[i] == ' ' || aTag[i] == '\t' || aTag[i] == '\r' || aTag[i] == '\n')
+		{
+			return Brn(aTag.Ptr(), i);
+		}
+	}
+
+	return Brn(aTag);
+}
+
+static void ReadField(XmlTokenizer& aXml, Bwx& aField)
+{
+	try
+	{
+		aXml.ReadText(aField);
+	}
+	catch(XmlTokenizerError)
+	{
+		// too long to be useful, and consumed anyway
+		aField.SetBytes(0);
+	}
+}
+
+static void AppendTruncated(Bwx& aBuffer, const Brx& aValue, TBool& aOversize)
+{
+	TUint bytes = aValue.Bytes();
+	if(aBuffer.Bytes() + bytes > aBuffer.MaxBytes())
+	{
+		bytes = aBuffer.MaxBytes() - aBuffer.Bytes();
+		aOversize = true;
+	}
+	aBuffer.Append(Brn(aValue.Ptr(), bytes));
+}
+
+PlaylistImporter::EFormat PlaylistImporter::Format(const Brx& aFilename)
+{
+	TUint dot = aFilename.Bytes();
+	while(dot > 0 && aFilename[dot - 1] != '.' && aFilename[dot - 1] != '/')
+	{
+		--dot;
+	}
+	if(dot == 0 || aFilename[dot - 1] != '.')
+	{
+		return eUnknown;
+	}
+
+	Brn extension(aFilename.Split(dot));
+	if(Ascii::CaseInsensitiveEquals(extension, Brn("m3u")) || Ascii::CaseInsensitiveEquals(extension, Brn("m3u8")))
+	{
+		return eM3u;
+	}
+	if(Ascii::CaseInsensitiveEquals(extension, Brn("xspf")))
+	{
+		return eXspf;
+	}
+	if(Ascii::CaseInsensitiveEquals(extension, Brn("xml")) || Ascii::CaseInsensitiveEquals(extension, Brn("didl")))
+	{
+		return eDidlLite;
+	}
+	return eUnknown;
+}
+
+TUint PlaylistImporter::Parse(EFormat aFormat, IReaderSource& aSource, IImportHandler& aHandler)
+{
+	switch(aFormat)
+	{
+	case eM3u:
+		return ParseM3u(aSource, aHandler);
+	case eXspf:
+		return ParseXspf(aSource, aHandler);
+	case eDidlLite:
+		return ParseDidlLite(aSource, aHandler);
+	default:
+		THROW(ReaderError);
+	}
+}
+
+TUint PlaylistImporter::ParseM3u(IReaderSource& aSource, IImportHandler& aHandler)
+{
+	Srs<kMaxLineBytes> reader(aSource);
+	Bwh metadata(kMaxTrackBytes);
+	Bws<kMaxFieldBytes> title;
+	Bws<kMaxFieldBytes> artist;
+	TUint seconds = 0;
+	TUint count = 0;
+
+	for(;;)
+	{
+		Brn line;
+		TBool end = false;
+
+		try
+		{
+			line.Set(reader.ReadUntil('\n'));
+		}
+		catch(ReaderFileError)
+		{
+			// the last line needn't end in a newline
+			line.Set(reader.Snaffle());
+			end = true;
+		}
+
+		// m3u8 files may start with a byte order mark
+		if(count == 0 && line.BeginsWith(Brn("\xef\xbb\xbf")))
+		{
+			line.Set(line.Split(3));
+		}
+
+		line.Set(Ascii::Trim(line));
+
+		if(line.BeginsWith(Brn("#EXTINF:")))
+		{
+			// #EXTINF:seconds,artist - title
+			Brn info(line.Split(8));
+			TUint comma = 0;
+			while(comma < info.Bytes() && info[comma] != ',')
+			{
+				++comma;
+			}
+
+			// whole seconds; -1 means the length isn't known
+			TUint digits = 0;
+			while(digits < comma && info[digits] != '.')
+			{
+				++digits;
+			}
+			try
+			{
+				seconds = Ascii::Uint(Ascii::Trim(Brn(info.Ptr(), digits)));
+			}
+			catch(AsciiError)
+			{
+				seconds = 0;
+			}
+
+			Brn name((comma < info.Bytes()) ? info.Split(comma + 1) : Brn(""));
+			artist.SetBytes(0);
+			title.Replace(Field(name));
+			for(TUint i = 0; i + 3 <= name.Bytes(); ++i)
+			{
+				if(Brn(name.Ptr() + i, 3) == Brn(" - "))
+				{
+					artist.Replace(Field(Brn(name.Ptr(), i)));
+					title.Replace(Field(name.Split(i + 3)));
+					break;
+				}
+			}
+		}
+		else if(line.BeginsWith(Brn("#PLAYLIST:")))
+		{
+			aHandler.ImportTitle(Ascii::Trim(line.Split(10)));
+		}
+		else if(line.Bytes() > 0 && line[0] != '#')
+		{
+			if(title.Bytes() == 0)
+			{
+				// the file name, for lack of anything better
+				TUint slash = line.Bytes();
+				while(slash > 0 && line[slash - 1] != '/' && line[slash - 1] != '\\')
+				{
+					--slash;
+				}
+				title.Replace(Field(line.Split(slash)));
+			}
+
+			metadata.SetBytes(0);
+			WriterBuffer writer(metadata);
+			WriteTrack(writer, Field(line), title, artist, Brx::Empty(), Brx::Empty(), seconds);
+			aHandler.ImportTrack(metadata);
+			++count;
+
+			title.SetBytes(0);
+			artist.SetBytes(0);
+			seconds = 0;
+		}
+
+		if(end)
+		{
+			return count;
+		}
+	}
+}
+
+TUint PlaylistImporter::ParseXspf(IReaderSource& aSource, IImportHandler& aHandler)
+{
+	XmlTokenizer xml(aSource);
+	Bwh metadata(kMaxTrackBytes);
+	Bws<kMaxFieldBytes> location;
+	Bws<kMaxFieldBytes> title;
+	Bws<kMaxFieldBytes> creator;
+	Bws<kMaxFieldBytes> album;
+	Bws<kMaxFieldBytes> image;
+	Bws<Ascii::kMaxUintStringBytes> duration;
+	TBool track = false;
+	TUint count = 0;
+
+	try
+	{
+		for(;;)
+		{
+			Brn tag = TagName(xml.NextTag());
+
+			if(tag == Brn("track"))
+			{
+				track = true;
+				location.SetBytes(0);
+				title.SetBytes(0);
+				creator.SetBytes(0);
+				album.SetBytes(0);
+				image.SetBytes(0);
+				duration.SetBytes(0);
+			}
+			else if(tag == Brn("/track"))
+			{
+				track = false;
+				if(location.Bytes() == 0)
+				{
+					continue;
+				}
+
+				TUint seconds = 0;
+				try
+				{
+					seconds = Ascii::Uint(Ascii::Trim(duration)) / 1000;
+				}
+				catch(AsciiError)
+				{
+				}
+
+				metadata.SetBytes(0);
+				WriterBuffer writer(metadata);
+				WriteTrack(writer, Ascii::Trim(location), Ascii::Trim(title), Ascii::Trim(creator), Ascii::Trim(album), Ascii::Trim(image), seconds);
+				aHandler.ImportTrack(metadata);
+				++count;
+			}
+			else if(tag == Brn("title"))
+			{
+				ReadField(xml, title);
+				if(!track)
+				{
+					aHandler.ImportTitle(Ascii::Trim(title));
+				}
+			}
+			else if(!track)
+			{
+				continue;
+			}
+			else if(tag == Brn("location") && location.Bytes() == 0)
+			{
+				// the first location is the preferred one
+				ReadField(xml, location);
+			}
+			else if(tag == Brn("creator"))
+			{
+				ReadField(xml, creator);
+			}
+			else if(tag == Brn("album"))
+			{
+				ReadField(xml, album);
+			}
+			else if(tag == Brn("image"))
+			{
+				ReadField(xml, image);
+			}
+			else if(tag == Brn("duration"))
+			{
+				ReadField(xml, duration);
+			}
+		}
+	}
+	catch(ReaderFileError)
+	{
+	}
+	catch(XmlTokenizerError)
+	{
+		THROW(ReaderError);
+	}
+
+	return count;
+}
+
+// Items are copied as they are, wrapped in the file's own DIDL-Lite element
+// so the namespaces they use stay declared.
+
+TUint PlaylistImporter::ParseDidlLite(IReaderSource& aSource, IImportHandler& aHandler)
+{
+	Srs<kMaxLineBytes> reader(aSource);
+	Bws<kMaxLineBytes> didlStart(kDidlStart);
+	Bwh item(kMaxTrackBytes);
+	TBool inItem = false;
+	TBool oversize = false;
+	TUint count = 0;
+
+	try
+	{
+		for(;;)
+		{
+			Brn text = reader.ReadUntil('<');
+			if(inItem)
+			{
+				AppendTruncated(item, text, oversize);
+			}
+
+			Brn tag = reader.ReadUntil('>');
+
+			if(!inItem)
+			{
+				Brn name = TagName(tag);
+				if(name == Brn("DIDL-Lite"))
+				{
+					didlStart.Replace(Brn("<"));
+					didlStart.Append(tag);
+					didlStart.Append(Brn(">"));
+				}
+				else if(name == Brn("item"))
+				{
+					inItem = true;
+					oversize = false;
+					item.Replace(didlStart);
+					AppendTruncated(item, Brn("<"), oversize);
+					AppendTruncated(item, tag, oversize);
+					AppendTruncated(item, Brn(">"), oversize);
+				}
+				continue;
+			}
+
+			AppendTruncated(item, Brn("<"), oversize);
+			AppendTruncated(item, tag, oversize);
+			AppendTruncated(item, Brn(">"), oversize);
+
+			if(TagName(tag) == Brn("/item"))
+			{
+				AppendTruncated(item, kDidlEnd, oversize);
+				aHandler.ImportTrack(item);
+				++count;
+				inItem = false;
+			}
+		}
+	}
+	catch(ReaderFileError)
+	{
+	}
+
+	return count;
+}
+
+void PlaylistImporter::WriteTrack(IWriter& aWriter, const Brx& aUri, const Brx& aTitle, const Brx& aArtist, const Brx& aAlbum, const Brx& aImage, TUint aSeconds)
+{
+	aWriter.Write(kDidlStart);
+	aWriter.Write(Brn("<item id=\"\" parentID=\"\" restricted=\"True\"><dc:title>"));
+	XmlEscaper::Write(aWriter, aTitle);
+	aWriter.Write(Brn("</dc:title>"));
+
+	if(aArtist.Bytes() > 0)
+	{
+		aWriter.Write(Brn("<upnp:artist>"));
+		XmlEscaper::Write(aWriter, aArtist);
+		aWriter.Write(Brn("</upnp:artist>"));
+	}
+
+	if(aAlbum.Bytes() > 0)
+	{
+		aWriter.Write(Brn("<upnp:album>"));
+		XmlEscaper::Write(aWriter, aAlbum);
+		aWriter.Write(Brn("</upnp:album>"));
+	}
+
+	if(aImage.Bytes() > 0)
+	{
+		aWriter.Write(Brn("<upnp:albumArtURI>"));
+		XmlEscaper::Write(aWriter, aImage);
+		aWriter.Write(Brn("</upnp:albumArtURI>"));
+	}
+
+	aWriter.Write(Brn("<upnp:class>object.item.audioItem.musicTrack</upnp:class><res protocolInfo=\"*:*:*:*\""));
+
+	if(aSeconds > 0)
+	{
+		// H:MM:SS
+		Bws<Ascii::kMaxUintStringBytes + 8> duration;
+		Ascii::AppendDec(duration, aSeconds / 3600);
+		duration.Append(':');
+		duration.Append((TByte)('0' + (aSeconds / 600) % 6));
+		duration.Append((TByte)('0' + (aSeconds / 60) % 10));
+		duration.Append(':');
+		duration.Append((TByte)('0' + (aSeconds % 60) / 10));
+		duration.Append((TByte)('0' + aSeconds % 10));
+
+		aWriter.Write(Brn(" duration=\""));
+		aWriter.Write(duration);
+		aWriter.Write(Brn("\""));
+	}
+
+	aWriter.Write(Brn(">"));
+	XmlEscaper::Write(aWriter, aUri);
+	aWriter.Write(Brn("</res></item>"));
+	aWriter.Write(kDidlEnd);
+}
@@ -0,0 +1,58 @@
+#ifndef HEADER_PLAYLISTMANAGER_IMPORT
+#define HEADER_PLAYLISTMANAGER_IMPORT
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Stream.h>
+
+namespace OpenHome {
+namespace Media {
+
+class IImportHandler
+{
+public:
+	virtual ~IImportHandler() {}
+
+	virtual void ImportTitle(const Brx& aTitle) = 0;
+
+	// aMetadata is a DIDL-Lite document describing one track, valid only for the call
+	virtual void ImportTrack(const Brx& aMetadata) = 0;
+};
+
+// Reads playlists written by other players.  Each format is parsed as it
+// streams in, with one track's metadata built at a time in a fixed buffer,
+// so a file of any length is imported in constant memory.
+
+class PlaylistImporter
+{
+public:
+	enum EFormat
+	{
+		eUnknown,
+		eM3u,
+		eXspf,
+		eDidlLite
+	};
+
+	static const TUint kMaxLineBytes = 4 * 1024;
+	static const TUint kMaxFieldBytes = 1024;
+
+public:
+	// chosen by the extension: .m3u, .m3u8, .xspf, .xml or .didl
+	static EFormat Format(const Brx& aFilename);
+
+	// Returns the number of tracks handed to aHandler.  Throws ReaderError
+	// if the file doesn't follow its format.
+	static TUint Parse(EFormat aFormat, IReaderSource& aSource, IImportHandler& aHandler);
+
+private:
+	static TUint ParseM3u(IReaderSource& aSource, IImportHandler& aHandler);
+	static TUint ParseXspf(IReaderSource& aSource, IImportHandler& aHandler);
+	static TUint ParseDidlLite(IReaderSource& aSource, IImportHandler& aHandler);
+
+	static void WriteTrack(IWriter& aWriter, const Brx& aUri, const Brx& aTitle, const Brx& aArtist, const Brx& aAlbum, const Brx& aImage, TUint aSeconds);
+};
+
+} // Media
+} // OpenHome
+
+#endif
@@ -0,0 +1,239 @@
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Debug.h>
+
+#include "MemoryStore.h"
+
+using namespace std;
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+MemoryStore::Entry::Entry(const Brx& aName, Bwh* aData)
+	: iName(aName)
+	, iData(aData)
+{
+}
+
+MemoryStore::MemoryStore(const TChar* aSeedDirectory)
+	: iMutex("MStr")
+	, iSeeded(aSeedDirectory != NULL)
+	, iBytes(0)
+	, iCommits(0)
+	, iRemovedBytes(0)
+{
+	if(iSeeded)
+	{
+		iSeedDirectory.Replace(aSeedDirectory);
+	}
+}
+
+MemoryStore::~MemoryStore()
+{
+	for(list<Entry>::iterator i = iEntries.begin(); i != iEntries.end(); ++i)
+	{
+		delete i->iData;
+	}
+}
+
+IReaderSource* MemoryStore::OpenReader(const Brx& aName)
+{
+	iMutex.Wait();
+
+	list<Entry>::iterator i = Find(aName);
+	if(i != iEntries.end() && i->iData == NULL)
+	{
+		iMutex.Signal();
+		THROW(ReaderFileError);
+	}
+	if(i != iEntries.end())
+	{
+		// a copy, so the record can be replaced while the caller reads
+		ReaderMemory* reader = new ReaderMemory(i->iData->Bytes());
+		reader->Data().Replace(*i->iData);
+		iMutex.Signal();
+		return reader;
+	}
+
+	iMutex.Signal();
+
+	if(!iSeeded)
+	{
+		THROW(ReaderFileError);
+	}
+
+	Bws<kMaxFilenameBytes> filename(iSeedDirectory);
+	filename.Append('/');
+	filename.Append(aName);
+
+	return new ReaderFile(filename.PtrZ());
+}
+
+IFileWriter* MemoryStore::OpenWriter(const Brx& aName)
+{
+	return new WriterMemoryStore(*this, aName);
+}
+
+void MemoryStore::Sync()
+{
+}
+
+void MemoryStore::Records(std::vector<Record>& aRecords)
+{
+	iMutex.Wait();
+
+	for(list<Entry>::const_iterator i = iEntries.begin(); i != iEntries.end(); ++i)
+	{
+		if(i->iData != NULL)
+		{
+			aRecords.push_back(Record(i->iName, i->iData->Bytes()));
+		}
+	}
+
+	iMutex.Signal();
+}
+
+void MemoryStore::Remove(const Brx& aName)
+{
+	iMutex.Wait();
+
+	list<Entry>::iterator i = Find(aName);
+	if(i == iEntries.end())
+	{
+		if(iSeeded)
+		{
+			iEntries.push_back(Entry(aName, NULL));
+		}
+	}
+	else if(i->iData != NULL)
+	{
+		iBytes -= i->iData->Bytes();
+		iRemovedBytes += i->iData->Bytes();
+		delete i->iData;
+		i->iData = NULL;
+
+		if(!iSeeded)
+		{
+			iEntries.erase(i);
+		}
+	}
+
+	iMutex.Signal();
+}
+
+// removed records are freed straight away, so there's only the count to report
+TUint MemoryStore::Compact()
+{
+	iMutex.Wait();
+	TUint bytes = iRemovedBytes;
+	iRemovedBytes = 0;
+	iMutex.Signal();
+	
+	return bytes;
+}
+
+void MemoryStore::PrintStats() const
+{
+	iMutex.Wait();
+	Log::Print("Memory store: %u records, %u bytes, %u commits\n", (TUint)iEntries.size(), iBytes, iCommits);
+	iMutex.Signal();
+}
+
+void MemoryStore::Commit(const Brx& aName, Bwh* aData)
+{
+	iMutex.Wait();
+
+	list<Entry>::iterator i = Find(aName);
+	if(i == iEntries.end())
+	{
+		iEntries.push_back(Entry(aName, aData));
+	}
+	else
+	{
+		if(i->iData != NULL)
+		{
+			iBytes -= i->iData->Bytes();
+			delete i->iData;
+		}
+		i->iData = aData;
+	}
+
+	iBytes += aData->Bytes();
+	++iCommits;
+
+	iMutex.Signal();
+}
+
+list<MemoryStore::Entry>::iterator MemoryStore::Find(const Brx& aName)
+{
+	for(list<Entry>::iterator i = iEntries.begin(); i != iEntries.end(); ++i)
+	{
+		if(i->iName == aName)
+		{
+			return i;
+		}
+	}
+
+	return iEntries.end();
+}
+
+
+
+WriterMemoryStore::WriterMemoryStore(MemoryStore& aStore, const Brx& aName)
+	: iStore(&aStore)
+	, iName(aName)
+	, iData(new Bwh(1024))
+{
+}
+
+WriterMemoryStore::~WriterMemoryStore()
+{
+	// an unclosed writer is abandoned rather than committed
+	delete iData;
+}
+
+void WriterMemoryStore::Close()
+{
+	if(iStore == NULL)
+	{
+		THROW(WriterFileError);
+	}
+
+	MemoryStore* store = iStore;
+	Bwh* data = iData;
+	iStore = NULL;
+	iData = NULL;
+	store->Commit(iName, data);
+}
+
+void WriterMemoryStore::Write(TByte aValue)
+{
+	Write(Brn(&aValue, 1));
+}
+
+void WriterMemoryStore::Write(const Brx& aBuffer)
+{
+	if(iStore == NULL)
+	{
+		THROW(WriterFileError);
+	}
+
+	TUint required = iData->Bytes() + aBuffer.Bytes();
+	if(required > iData->MaxBytes())
+	{
+		TUint grow = iData->MaxBytes() * 2;
+		iData->Grow(grow > required ? grow : required);
+	}
+
+	iData->Append(aBuffer);
+}
+
+void WriterMemoryStore::WriteFlush()
+{
+}
+
+void WriterMemoryStore::WriteGather(const vector<Brn>& aFragments)
+{
+	for(vector<Brn>::const_iterator i = aFragments.begin(); i != aFragments.end(); ++i)
+	{
+		Write(*i);
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef HEADER_PLAYLISTMANAGER_MEMORYSTORE
+#define HEADER_PLAYLISTMANAGER_MEMORYSTORE
+
+#include <list>
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Thread.h>
+
+#include "Stream.h"
+
+namespace OpenHome {
+namespace Media {
+
+// Keeps every record in memory and never touches the disk, for appliances
+// with a read-only filesystem and for measuring the manager without any
+// storage cost.  A record that hasn't been written in this session is read
+// from aSeedDirectory, if one is given, so shipped playlists still appear.
+class MemoryStore : public IFileStore
+{
+private:
+	// iData is NULL for a record removed in this session, so the seed's copy stays hidden
+	class Entry
+	{
+	public:
+		Entry(const Brx& aName, Bwh* aData);
+
+		Bws<IFileStore::kMaxNameBytes> iName;
+		Bwh* iData;
+	};
+
+public:
+	MemoryStore(const TChar* aSeedDirectory);
+	virtual ~MemoryStore();
+
+	virtual IReaderSource* OpenReader(const Brx& aName);
+	virtual IFileWriter* OpenWriter(const Brx& aName);
+	virtual void Sync();
+	virtual void Records(std::vector<Record>& aRecords);
+	virtual void Remove(const Brx& aName);
+	virtual TUint Compact();
+	virtual void PrintStats() const;
+
+	// called by the writers returned from OpenWriter; takes ownership of aData
+	void Commit(const Brx& aName, Bwh* aData);
+
+private:
+	std::list<Entry>::iterator Find(const Brx& aName);
+
+private:
+	mutable Mutex iMutex;
+	Bws<FileStoreDirectory::kMaxRootBytes> iSeedDirectory;
+	TBool iSeeded;
+
+	std::list<Entry> iEntries;
+	TUint iBytes;
+	TUint iCommits;
+	TUint iRemovedBytes;
+};
+
+class WriterMemoryStore : public IFileWriter
+{
+public:
+	WriterMemoryStore(MemoryStore& aStore, const Brx& aName);
+	virtual ~WriterMemoryStore();
+
+	virtual void Close();
+
+	virtual void Write(TByte aValue);
+	virtual void Write(const Brx& aBuffer);
+	virtual void WriteFlush();
+	virtual void WriteGather(const std::vector<Brn>& aFragments);
+
+private:
+	MemoryStore* iStore;
+	Bws<IFileStore::kMaxNameBytes> iName;
+	Bwh* iData;
+};
+
+} // Media
+} // OpenHome
+
+#endif
@@ -0,0 +1,857 @@
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Stream.h>
+#include <OpenHome/Private/Debug.h>
+
+#include "PagedStore.h"
+#include "Checksum.h"
+
+#ifdef _WIN32
+# include <io.h>
+#else
+# include <sys/types.h>
+# include <unistd.h>
+#endif
+
+using namespace std;
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+static const Brn kPagedStoreMagic("ohPS");
+static const TUint kSuperblockBytes = 36;
+
+static TBool Seek(FILE* aFile, TUint aPage)
+{
+#ifdef _WIN32
+	return _fseeki64(aFile, (__int64)aPage * PagedStore::kPageBytes, SEEK_SET) == 0;
+#else
+	return fseeko(aFile, (off_t)aPage * PagedStore::kPageBytes, SEEK_SET) == 0;
+#endif
+}
+
+
+
+PagedStore::Extent::Extent()
+	: iPage(0)
+	, iPages(0)
+{
+}
+
+PagedStore::Extent::Extent(TUint aPage, TUint aPages)
+	: iPage(aPage)
+	, iPages(aPages)
+{
+}
+
+PagedStore::Entry::Entry(const Brx& aName, const Extent& aExtent, TUint aBytes)
+	: iName(aName)
+	, iExtent(aExtent)
+	, iBytes(aBytes)
+{
+}
+
+
+
+PagedStore::PagedStore(const TChar* aFilename, const Durability& aDurability)
+	: iMutex("PStr")
+	, iSequence(0)
+	, iPageCount(kSuperblockPages)
+	, iDirectoryBytes(0)
+	, iDirectoryCrc(0)
+	, iDirty(false)
+	, iGroupCommit(*this, aDurability)
+{
+	iFile = fopen(aFilename, "r+b");
+	if(iFile != NULL)
+	{
+		try
+		{
+			Load();
+		}
+		catch(ReaderFileError)
+		{
+			fclose(iFile);
+			THROW(PagedStoreError);
+		}
+		return;
+	}
+
+	iFile = fopen(aFilename, "w+b");
+	if(iFile == NULL)
+	{
+		THROW(PagedStoreError);
+	}
+
+	try
+	{
+		Create();
+	}
+	catch(WriterFileError)
+	{
+		fclose(iFile);
+		THROW(PagedStoreError);
+	}
+}
+
+PagedStore::~PagedStore()
+{
+	iGroupCommit.Close();
+	fclose(iFile);
+}
+
+IReaderSource* PagedStore::OpenReader(const Brx& aName)
+{
+	AutoMutex mutex(iMutex);
+
+	list<Entry>::iterator i = Find(aName);
+	if(i == iEntries.end())
+	{
+		THROW(ReaderFileError);
+	}
+
+	ReaderMemory* reader = new ReaderMemory(i->iBytes);
+	try
+	{
+		ReadAt(i->iExtent.iPage, reader->Data(), i->iBytes);
+	}
+	catch(ReaderFileError& e)
+	{
+		delete reader;
+		throw e;
+	}
+
+	return reader;
+}
+
+IFileWriter* PagedStore::OpenWriter(const Brx& aName)
+{
+	if(aName.Bytes() > IFileStore::kMaxNameBytes)
+	{
+		THROW(WriterFileError);
+	}
+
+	return new WriterPagedStore(*this, aName);
+}
+
+void PagedStore::Sync()
+{
+	iGroupCommit.Sync();
+}
+
+void PagedStore::PrintStats() const
+{
+	iGroupCommit.Print();
+}
+
+void PagedStore::Records(std::vector<Record>& aRecords)
+{
+	AutoMutex mutex(iMutex);
+
+	for(list<Entry>::const_iterator i = iEntries.begin(); i != iEntries.end(); ++i)
+	{
+		aRecords.push_back(Record(i->iName, i->iBytes));
+	}
+}
+
+void PagedStore::Remove(const Brx& aName)
+{
+	{
+		AutoMutex mutex(iMutex);
+
+		list<Entry>::iterator i = Find(aName);
+		if(i == iEntries.end())
+		{
+			return;
+		}
+
+		iReleased.push_back(i->iExtent);
+		iEntries.erase(i);
+		iDirty = true;
+	}
+
+	iGroupCommit.Staged();
+}
+
+// Records near the end of the file move down into free runs, a bounded
+// amount per call so writers aren't held up for long, and once that is
+// published the free run left at the end is cut off.
+TUint PagedStore::Compact()
+{
+	// the moves have to be published before their old pages count as free
+	if(Relocate(kMaxRelocateBytes))
+	{
+		iGroupCommit.Staged();
+		iGroupCommit.Commit();
+	}
+
+	return Truncate();
+}
+
+void PagedStore::Commit(const Brx& aName, const Brx& aData)
+{
+	{
+		AutoMutex mutex(iMutex);
+
+		Stage(aName, aData);
+	}
+
+	iGroupCommit.Staged();
+}
+
+void PagedStore::Stage(const Brx& aName, const Brx& aData)
+{
+	Extent extent = Allocate(PagesFor(aData.Bytes()));
+	try
+	{
+		WriteAt(extent.iPage, aData);
+	}
+	catch(WriterFileError& e)
+	{
+		Free(extent);
+		throw e;
+	}
+
+	list<Entry>::iterator i = Find(aName);
+	if(i == iEntries.end())
+	{
+		iEntries.push_back(Entry(aName, extent, aData.Bytes()));
+	}
+	else
+	{
+		iReleased.push_back(i->iExtent);
+		i->iExtent = extent;
+		i->iBytes = aData.Bytes();
+	}
+
+	iDirty = true;
+}
+
+TBool PagedStore::CommitGroup(TBool aSync, TUint& aFsyncs)
+{
+	AutoMutex mutex(iMutex);
+
+	if(!iDirty)
+	{
+		return true;
+	}
+
+	try
+	{
+		Publish(aSync);
+	}
+	catch(WriterFileError)
+	{
+		// staged state stays in memory and goes out with the next group, but
+		// callers waiting on this one are told it didn't make it
+		Log::Print("PagedStore: commit failed\n");
+		return false;
+	}
+
+	if(aSync)
+	{
+		aFsyncs += 2;
+	}
+	return true;
+}
+
+void PagedStore::Publish(TBool aSync)
+{
+	// data and directory must be on the medium before the superblock that refers to them
+	Extent directory;
+	TUint directoryBytes;
+	TUint directoryCrc;
+	WriteDirectory(directory, directoryBytes, directoryCrc);
+
+	Extent oldDirectory = iDirectory;
+	TUint oldDirectoryBytes = iDirectoryBytes;
+	TUint oldDirectoryCrc = iDirectoryCrc;
+	TBool flipped = false;
+
+	try
+	{
+		SyncFile(aSync);
+
+		iDirectory = directory;
+		iDirectoryBytes = directoryBytes;
+		iDirectoryCrc = directoryCrc;
+		++iSequence;
+		flipped = true;
+		WriteSuperblock();
+		SyncFile(aSync);
+	}
+	catch(WriterFileError& e)
+	{
+		// the new directory may or may not have landed, so its pages are
+		// left allocated until the free list is next rebuilt
+		if(flipped)
+		{
+			--iSequence;
+		}
+		iDirectory = oldDirectory;
+		iDirectoryBytes = oldDirectoryBytes;
+		iDirectoryCrc = oldDirectoryCrc;
+		throw e;
+	}
+
+	// only reuse pages once the superblock naming the new directory is
+	// durable; the older slot still names them, see Load()
+	iReleased.push_back(oldDirectory);
+	for(list<Extent>::const_iterator i = iReleased.begin(); i != iReleased.end(); ++i)
+	{
+		Free(*i);
+	}
+	iReleased.clear();
+	iDirty = false;
+}
+
+void PagedStore::Create()
+{
+	Bws<kPageBytes> empty;
+	empty.SetBytes(kPageBytes);
+	empty.Fill(0);
+
+	for(TUint i = 0; i < kSuperblockPages; ++i)
+	{
+		WriteAt(i, empty);
+	}
+
+	WriteDirectory(iDirectory, iDirectoryBytes, iDirectoryCrc);
+	SyncFile(true);
+
+	WriteSuperblock();
+	SyncFile(true);
+}
+
+// The newest superblock whose directory checks out is used.  Falling back
+// to the older slot is only sound when the newest write was torn: a
+// directory is durable before the superblock naming it, so a crash part way
+// through a commit leaves the new superblock failing its checksum while the
+// pages the older one names are still unreleased.  A durable superblock
+// whose directory is damaged afterwards means the medium is at fault; the
+// pages its predecessor names may have been reused by then, so falling back
+// is a last resort and files read through it may not be what was written.
+// All of this assumes a sync at every commit; with Durability::eNone or
+// eInterval the writes can reach the medium in any order.
+void PagedStore::Load()
+{
+	TUint sequence[kSuperblockPages];
+	Extent directory[kSuperblockPages];
+	TUint directoryBytes[kSuperblockPages];
+	TUint directoryCrc[kSuperblockPages];
+	TUint pageCount[kSuperblockPages];
+	TBool valid[kSuperblockPages];
+
+	for(TUint i = 0; i < kSuperblockPages; ++i)
+	{
+		valid[i] = ReadSuperblock(i, sequence[i], directory[i], directoryBytes[i], directoryCrc[i], pageCount[i]);
+	}
+
+	TUint newest = (valid[1] && (!valid[0] || sequence[1] > sequence[0])) ? 1 : 0;
+	TUint slots[kSuperblockPages] = { newest, 1 - newest };
+
+	for(TUint i = 0; i < kSuperblockPages; ++i)
+	{
+		TUint slot = slots[i];
+		if(!valid[slot])
+		{
+			continue;
+		}
+
+		iEntries.clear();
+		if(!LoadDirectory(directory[slot], directoryBytes[slot], directoryCrc[slot], pageCount[slot]))
+		{
+			Log::Print("PagedStore: directory of superblock sequence %u is damaged\n", sequence[slot]);
+			continue;
+		}
+
+		iSequence = sequence[slot];
+		iDirectory = directory[slot];
+		iDirectoryBytes = directoryBytes[slot];
+		iDirectoryCrc = directoryCrc[slot];
+		iPageCount = pageCount[slot];
+
+		BuildFreeList();
+		return;
+	}
+
+	iEntries.clear();
+	THROW(ReaderFileError);
+}
+
+TBool PagedStore::LoadDirectory(const Extent& aDirectory, TUint aBytes, TUint aCrc, TUint aPageCount)
+{
+	Bwh buffer(aBytes);
+
+	try
+	{
+		ReadAt(aDirectory.iPage, buffer, aBytes);
+	}
+	catch(ReaderFileError)
+	{
+		return false;
+	}
+
+	if(buffer.Bytes() < 4 || Crc32c::Compute(buffer) != aCrc)
+	{
+		return false;
+	}
+
+	TUint count = BigEndianConverter::BigEndianToUint32(buffer, 0);
+	TUint offset = 4;
+
+	for(TUint i = 0; i < count; ++i)
+	{
+		if(offset + 1 > buffer.Bytes())
+		{
+			return false;
+		}
+
+		TUint nameBytes = buffer[offset++];
+		if(nameBytes > IFileStore::kMaxNameBytes || offset + nameBytes + 12 > buffer.Bytes())
+		{
+			return false;
+		}
+
+		Brn name(buffer.Ptr() + offset, nameBytes);
+		offset += nameBytes;
+
+		Extent extent(BigEndianConverter::BigEndianToUint32(buffer, offset), BigEndianConverter::BigEndianToUint32(buffer, offset + 4));
+		TUint bytes = BigEndianConverter::BigEndianToUint32(buffer, offset + 8);
+		offset += 12;
+
+		if(extent.iPages > 0 && (extent.iPage < kSuperblockPages || extent.iPage + extent.iPages > aPageCount))
+		{
+			return false;
+		}
+
+		iEntries.push_back(Entry(name, extent, bytes));
+	}
+
+	return true;
+}
+
+// everything the directory does not account for is free
+void PagedStore::BuildFreeList()
+{
+	list<Extent> used;
+	used.push_back(iDirectory);
+	for(list<Entry>::const_iterator i = iEntries.begin(); i != iEntries.end(); ++i)
+	{
+		used.push_back(i->iExtent);
+	}
+
+	used.sort(ExtentBefore);
+
+	TUint page = kSuperblockPages;
+	for(list<Extent>::const_iterator i = used.begin(); i != used.end(); ++i)
+	{
+		if(i->iPages == 0)
+		{
+			continue;
+		}
+		if(i->iPage > page)
+		{
+			iFreeList.push_back(Extent(page, i->iPage - page));
+		}
+		page = i->iPage + i->iPages;
+	}
+
+	if(iPageCount > page)
+	{
+		iFreeList.push_back(Extent(page, iPageCount - page));
+	}
+}
+
+TBool PagedStore::ReadSuperblock(TUint aSlot, TUint& aSequence, Extent& aDirectory, TUint& aDirectoryBytes, TUint& aDirectoryCrc, TUint& aPageCount)
+{
+	Bws<kSuperblockBytes> superblock;
+
+	try
+	{
+		ReadAt(aSlot, superblock, kSuperblockBytes);
+	}
+	catch(ReaderFileError)
+	{
+		return false;
+	}
+
+	if(superblock.Bytes() < kSuperblockBytes || Brn(superblock.Ptr(), 4) != kPagedStoreMagic || BigEndianConverter::BigEndianToUint32(superblock, 4) != kVersion)
+	{
+		return false;
+	}
+
+	// a torn superblock write leaves the checksum out of step
+	if(Crc32c::Compute(Brn(superblock.Ptr(), kSuperblockBytes - 4)) != BigEndianConverter::BigEndianToUint32(superblock, kSuperblockBytes - 4))
+	{
+		return false;
+	}
+
+	aSequence = BigEndianConverter::BigEndianToUint32(superblock, 8);
+	aPageCount = BigEndianConverter::BigEndianToUint32(superblock, 12);
+	aDirectory = Extent(BigEndianConverter::BigEndianToUint32(superblock, 16), BigEndianConverter::BigEndianToUint32(superblock, 20));
+	aDirectoryBytes = BigEndianConverter::BigEndianToUint32(superblock, 24);
+	aDirectoryCrc = BigEndianConverter::BigEndianToUint32(superblock, 28);
+
+	return (aDirectory.iPage >= kSuperblockPages && aDirectory.iPage + aDirectory.iPages <= aPageCount && aDirectoryBytes <= aDirectory.iPages * kPageBytes);
+}
+
+void PagedStore::WriteSuperblock()
+{
+	Bws<kSuperblockBytes> superblock;
+	WriterBuffer writer(superblock);
+	WriterBinary binary(writer);
+
+	binary.Write(kPagedStoreMagic);
+	binary.WriteUint32Be(kVersion);
+	binary.WriteUint32Be(iSequence);
+	binary.WriteUint32Be(iPageCount);
+	binary.WriteUint32Be(iDirectory.iPage);
+	binary.WriteUint32Be(iDirectory.iPages);
+	binary.WriteUint32Be(iDirectoryBytes);
+	binary.WriteUint32Be(iDirectoryCrc);
+	binary.WriteUint32Be(Crc32c::Compute(superblock));
+
+	WriteAt(iSequence % kSuperblockPages, superblock);
+}
+
+void PagedStore::WriteDirectory(Extent& aExtent, TUint& aBytes, TUint& aCrc)
+{
+	TUint bytes = 4;
+	for(list<Entry>::const_iterator i = iEntries.begin(); i != iEntries.end(); ++i)
+	{
+		bytes += 1 + i->iName.Bytes() + 12;
+	}
+
+	Bwh directory(bytes);
+	WriterBuffer writer(directory);
+	WriterBinary binary(writer);
+
+	binary.WriteUint32Be(iEntries.size());
+	for(list<Entry>::const_iterator i = iEntries.begin(); i != iEntries.end(); ++i)
+	{
+		binary.WriteUint8(i->iName.Bytes());
+		binary.Write(i->iName);
+		binary.WriteUint32Be(i->iExtent.iPage);
+		binary.WriteUint32Be(i->iExtent.iPages);
+		binary.WriteUint32Be(i->iBytes);
+	}
+
+	aExtent = Allocate(PagesFor(bytes));
+	aBytes = bytes;
+	aCrc = Crc32c::Compute(directory);
+
+	try
+	{
+		WriteAt(aExtent.iPage, directory);
+	}
+	catch(WriterFileError& e)
+	{
+		Free(aExtent);
+		throw e;
+	}
+}
+
+PagedStore::Extent PagedStore::Allocate(TUint aPages)
+{
+	if(aPages == 0)
+	{
+		return Extent();
+	}
+
+	// first fit
+	for(list<Extent>::iterator i = iFreeList.begin(); i != iFreeList.end(); ++i)
+	{
+		if(i->iPages >= aPages)
+		{
+			Extent extent(i->iPage, aPages);
+			i->iPage += aPages;
+			i->iPages -= aPages;
+			if(i->iPages == 0)
+			{
+				iFreeList.erase(i);
+			}
+			return extent;
+		}
+	}
+
+	Extent extent(iPageCount, aPages);
+	iPageCount += aPages;
+	return extent;
+}
+
+void PagedStore::Free(const Extent& aExtent)
+{
+	if(aExtent.iPages == 0)
+	{
+		return;
+	}
+
+	list<Extent>::iterator i = iFreeList.begin();
+	while(i != iFreeList.end() && i->iPage < aExtent.iPage)
+	{
+		++i;
+	}
+
+	i = iFreeList.insert(i, aExtent);
+
+	// coalesce with the following and preceding runs
+	list<Extent>::iterator next = i;
+	++next;
+	if(next != iFreeList.end() && i->iPage + i->iPages == next->iPage)
+	{
+		i->iPages += next->iPages;
+		iFreeList.erase(next);
+	}
+
+	if(i != iFreeList.begin())
+	{
+		list<Extent>::iterator prev = i;
+		--prev;
+		if(prev->iPage + prev->iPages == i->iPage)
+		{
+			prev->iPages += i->iPages;
+			iFreeList.erase(i);
+		}
+	}
+}
+
+void PagedStore::ReadAt(TUint aPage, Bwx& aBuffer, TUint aBytes)
+{
+	aBuffer.SetBytes(0);
+
+	if(aBytes == 0)
+	{
+		return;
+	}
+
+	if(aBytes > aBuffer.MaxBytes() || !Seek(iFile, aPage))
+	{
+		THROW(ReaderFileError);
+	}
+
+	size_t count = fread((void*)aBuffer.Ptr(), 1, aBytes, iFile);
+	aBuffer.SetBytes(count);
+
+	if(count < aBytes)
+	{
+		THROW(ReaderFileError);
+	}
+}
+
+void PagedStore::WriteAt(TUint aPage, const Brx& aBuffer)
+{
+	if(aBuffer.Bytes() == 0)
+	{
+		return;
+	}
+
+	if(!Seek(iFile, aPage) || fwrite(aBuffer.Ptr(), 1, aBuffer.Bytes(), iFile) != aBuffer.Bytes())
+	{
+		THROW(WriterFileError);
+	}
+}
+
+// flushes stdio's buffer, and the system's too if aDurable
+void PagedStore::SyncFile(TBool aDurable)
+{
+	if(fflush(iFile) != 0)
+	{
+		THROW(WriterFileError);
+	}
+
+	if(!aDurable)
+	{
+		return;
+	}
+
+#ifdef _WIN32
+	if(_commit(_fileno(iFile)) != 0)
+#else
+	if(fsync(fileno(iFile)) != 0)
+#endif
+	{
+		THROW(WriterFileError);
+	}
+}
+
+list<PagedStore::Entry>::iterator PagedStore::Find(const Brx& aName)
+{
+	list<Entry>::iterator i = iEntries.begin();
+	for(; i != iEntries.end(); ++i)
+	{
+		if(i->iName == aName)
+		{
+			break;
+		}
+	}
+	return i;
+}
+
+TBool PagedStore::Relocate(TUint aMaxBytes)
+{
+	AutoMutex mutex(iMutex);
+
+	TUint moved = 0;
+
+	while(moved < aMaxBytes)
+	{
+		// the record furthest along that fits in a free run before it
+		list<Entry>::iterator last = iEntries.end();
+		for(list<Entry>::iterator i = iEntries.begin(); i != iEntries.end(); ++i)
+		{
+			if(i->iExtent.iPages == 0 || (last != iEntries.end() && i->iExtent.iPage < last->iExtent.iPage))
+			{
+				continue;
+			}
+
+			for(list<Extent>::const_iterator j = iFreeList.begin(); j != iFreeList.end() && j->iPage < i->iExtent.iPage; ++j)
+			{
+				if(j->iPages >= i->iExtent.iPages)
+				{
+					last = i;
+					break;
+				}
+			}
+		}
+
+		if(last == iEntries.end())
+		{
+			break;
+		}
+
+		// first fit puts the copy in the lowest free run that holds it
+		Bws<IFileStore::kMaxNameBytes> name(last->iName);
+		Bwh data(last->iBytes);
+
+		try
+		{
+			ReadAt(last->iExtent.iPage, data, last->iBytes);
+			Stage(name, data);
+		}
+		catch(ReaderFileError)
+		{
+			break;
+		}
+		catch(WriterFileError)
+		{
+			break;
+		}
+
+		moved += data.Bytes();
+	}
+
+	return (moved > 0);
+}
+
+// Pages only reach the free list once no durable superblock refers to them,
+// so the free run at the end can go.  The superblock's page count may then
+// run past the end of the file until the next commit, which Load() allows.
+TUint PagedStore::Truncate()
+{
+	AutoMutex mutex(iMutex);
+
+	if(iFreeList.empty() || iFreeList.back().iPage + iFreeList.back().iPages != iPageCount)
+	{
+		return 0;
+	}
+
+	Extent tail = iFreeList.back();
+	if(fflush(iFile) != 0)
+	{
+		return 0;
+	}
+
+#ifdef _WIN32
+	TBool truncated = (_chsize_s(_fileno(iFile), (__int64)tail.iPage * kPageBytes) == 0);
+#else
+	TBool truncated = (ftruncate(fileno(iFile), (off_t)tail.iPage * kPageBytes) == 0);
+#endif
+	if(!truncated)
+	{
+		return 0;
+	}
+
+	iFreeList.pop_back();
+	iPageCount = tail.iPage;
+
+	return tail.iPages * kPageBytes;
+}
+
+TUint PagedStore::PagesFor(TUint aBytes)
+{
+	return (aBytes + kPageBytes - 1) / kPageBytes;
+}
+
+TBool PagedStore::ExtentBefore(const Extent& aA, const Extent& aB)
+{
+	return aA.iPage < aB.iPage;
+}
+
+
+
+WriterPagedStore::WriterPagedStore(PagedStore& aStore, const Brx& aName)
+	: iStore(&aStore)
+	, iName(aName)
+	, iData(PagedStore::kPageBytes)
+{
+}
+
+WriterPagedStore::~WriterPagedStore()
+{
+	// an unclosed writer is abandoned rather than committed
+}
+
+void WriterPagedStore::Close()
+{
+	if(iStore != NULL)
+	{
+		PagedStore* store = iStore;
+		iStore = NULL;
+		store->Commit(iName, iData);
+	}
+}
+
+void WriterPagedStore::Write(TByte aValue)
+{
+	Reserve(1);
+	iData.Append(aValue);
+}
+
+void WriterPagedStore::Write(const Brx& aBuffer)
+{
+	Reserve(aBuffer.Bytes());
+	iData.Append(aBuffer);
+}
+
+void WriterPagedStore::WriteFlush()
+{
+}
+
+void WriterPagedStore::WriteGather(const vector<Brn>& aFragments)
+{
+	TUint bytes = 0;
+	for(vector<Brn>::const_iterator i = aFragments.begin(); i != aFragments.end(); ++i)
+	{
+		bytes += i->Bytes();
+	}
+
+	Reserve(bytes);
+	for(vector<Brn>::const_iterator i = aFragments.begin(); i != aFragments.end(); ++i)
+	{
+		iData.Append(*i);
+	}
+}
+
+void WriterPagedStore::Reserve(TUint aBytes)
+{
+	if(iStore == NULL)
+	{
+		THROW(WriterFileError);
+	}
+
+	TUint required = iData.Bytes() + aBytes;
+	if(required > iData.MaxBytes())
+	{
+		TUint grow = iData.MaxBytes() * 2;
+		iData.Grow(grow > required ? grow : required);
+	}
+}
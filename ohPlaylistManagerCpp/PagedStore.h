@@ -0,0 +1,148 @@
+#ifndef HEADER_PLAYLISTMANAGER_PAGEDSTORE
+#define HEADER_PLAYLISTMANAGER_PAGEDSTORE
+
+#include <stdio.h>
+#include <list>
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Thread.h>
+
+#include "Stream.h"
+
+EXCEPTION(PagedStoreError);
+
+namespace OpenHome {
+namespace Media {
+
+// Single file store.  Every named record occupies a contiguous run of pages;
+// the directory of records is itself a record, located through one of two
+// alternating superblocks in pages 0 and 1.  Writes never overwrite live
+// pages, so a commit becomes visible atomically when its superblock lands.
+// Superblocks and the directory carry a CRC32C; if the newest superblock or
+// its directory fails the check, the store opens from the older one, which
+// is only sure to be whole when the newest write was torn (see Load()).
+// Pages not referenced by the directory are kept on an in-memory free list
+// which is rebuilt from the directory on open; Compact() moves records down
+// into it and cuts the free pages left at the end off the file.
+//
+// Closed writers are staged in memory; Sync() publishes everything staged
+// with one directory write and one superblock flip.  Without durability the
+// flip is still ordered after the directory in the file, but not on the
+// medium, so a crash can leave the older superblock in charge.
+
+class PagedStore : public IFileStore, private IGroupCommitHandler
+{
+public:
+	static const TUint kPageBytes = 4096;
+
+private:
+	static const TUint kSuperblockPages = 2;
+	static const TUint kVersion = 2;
+	static const TUint kMaxRelocateBytes = 1024 * 1024;
+
+	class Extent
+	{
+	public:
+		Extent();
+		Extent(TUint aPage, TUint aPages);
+
+		TUint iPage;
+		TUint iPages;
+	};
+
+	class Entry
+	{
+	public:
+		Entry(const Brx& aName, const Extent& aExtent, TUint aBytes);
+
+		Bws<IFileStore::kMaxNameBytes> iName;
+		Extent iExtent;
+		TUint iBytes;
+	};
+
+public:
+	PagedStore(const TChar* aFilename, const Durability& aDurability);
+	virtual ~PagedStore();
+
+	virtual IReaderSource* OpenReader(const Brx& aName);
+	virtual IFileWriter* OpenWriter(const Brx& aName);
+	virtual void Sync();
+	virtual void Records(std::vector<Record>& aRecords);
+	virtual void Remove(const Brx& aName);
+	virtual TUint Compact();
+	virtual void PrintStats() const;
+
+	// called by the writers returned from OpenWriter
+	void Commit(const Brx& aName, const Brx& aData);
+
+private:
+	virtual TBool CommitGroup(TBool aSync, TUint& aFsyncs);
+
+	void Create();
+	void Load();
+	TBool ReadSuperblock(TUint aSlot, TUint& aSequence, Extent& aDirectory, TUint& aDirectoryBytes, TUint& aDirectoryCrc, TUint& aPageCount);
+	TBool LoadDirectory(const Extent& aDirectory, TUint aBytes, TUint aCrc, TUint aPageCount);
+	void BuildFreeList();
+	void WriteSuperblock();
+	void Stage(const Brx& aName, const Brx& aData);
+	void WriteDirectory(Extent& aExtent, TUint& aBytes, TUint& aCrc);
+	void Publish(TBool aSync);
+	TBool Relocate(TUint aMaxBytes);
+	TUint Truncate();
+
+	Extent Allocate(TUint aPages);
+	void Free(const Extent& aExtent);
+
+	void ReadAt(TUint aPage, Bwx& aBuffer, TUint aBytes);
+	void WriteAt(TUint aPage, const Brx& aBuffer);
+	void SyncFile(TBool aDurable);
+
+	std::list<Entry>::iterator Find(const Brx& aName);
+
+	static TUint PagesFor(TUint aBytes);
+	static TBool ExtentBefore(const Extent& aA, const Extent& aB);
+
+private:
+	Mutex iMutex;
+	FILE* iFile;
+
+	TUint iSequence;
+	TUint iPageCount;
+	Extent iDirectory;
+	TUint iDirectoryBytes;
+	TUint iDirectoryCrc;
+
+	std::list<Entry> iEntries;
+	std::list<Extent> iFreeList;
+	std::list<Extent> iReleased;
+	TBool iDirty;
+
+	GroupCommit iGroupCommit;
+};
+
+class WriterPagedStore : public IFileWriter
+{
+public:
+	WriterPagedStore(PagedStore& aStore, const Brx& aName);
+	virtual ~WriterPagedStore();
+
+	virtual void Close();
+
+	virtual void Write(TByte aValue);
+	virtual void Write(const Brx& aBuffer);
+	virtual void WriteFlush();
+	virtual void WriteGather(const std::vector<Brn>& aFragments);
+
+private:
+	void Reserve(TUint aBytes);
+
+private:
+	PagedStore* iStore;
+	Bws<IFileStore::kMaxNameBytes> iName;
+	Bwh iData;
+};
+
+} // Media
+} // OpenHome
+
+#endif
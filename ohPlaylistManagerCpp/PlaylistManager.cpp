@@ -5,9 +5,14 @@
 #include <OpenHome/Private/Parser.h>
 #include <OpenHome/Private/Ascii.h>
 #include <OpenHome/Private/Converter.h>
+#include <OpenHome/Private/Debug.h>
+#include <OpenHome/Private/OsWrapper.h>
 
 #include "PlaylistManager.h"
 #include "Stream.h"
+#include "XmlTokenizer.h"
+#include "Checksum.h"
+#include "Archive.h"
 
 #ifdef _WIN32
 # pragma warning(disable:4355) // use of 'this' in ctor lists safe in this case
@@ -24,10 +29,97 @@ static const TInt kPlaylistFull = 801;
 static const Brn kPlaylistFullMsg("Playlist full");
 static const TInt kInvalidRequest = 802;
 static const Brn kInvalidRequestMsg("Space separated id request list invalid");
+static const TInt kInvalidMetadata = 803;
+static const Brn kInvalidMetadataMsg("Metadata is not a valid DIDL-Lite document");
+static const TInt kStoreFailed = 804;
+static const Brn kStoreFailedMsg("Change could not be saved");
+
+static const Brn kTocFilename("Toc.txt");
+static const Brn kIndexFilename("Index.bin");
+static const Brn kIndexMagic("ohPI");
+static const TUint kIndexVersion = 4;
+
+// the index holds a token no more than this far behind the real one, so the
+// next run can start clear of every token handed out by this one
+static const TUint kTokenReserve = 0x10000;
+
+// header edits are saved on their own, so a rename never rewrites the tracks
+static void HeaderFilename(const TUint aId, Bwx& aFilename)
+{
+	aFilename.SetBytes(0);
+	Ascii::AppendDec(aFilename, aId);
+	aFilename.Append(".hdr");
+}
+
+// true for <id>.txt and <id>.hdr
+static TBool PlaylistFile(const Brx& aName, TUint& aId)
+{
+	TUint digits = 0;
+	while(digits < aName.Bytes() && Ascii::IsDigit(aName[digits]))
+	{
+		++digits;
+	}
+	
+	if(digits == 0 || digits > 9)
+	{
+		return false;
+	}
+	
+	Brn extension(aName.Split(digits));
+	if(extension != Brn(".txt") && extension != Brn(".hdr"))
+	{
+		return false;
+	}
+	
+	aId = Ascii::Uint(Brn(aName.Ptr(), digits));
+	return true;
+}
+
+// Each line of the toc is followed by the checksum of its value.  Lines
+// without one were written before checksums and are taken as they are.
+
+static void WriteTocLine(IWriter& aWriter, const Brx& aValue)
+{
+	Bws<8> check;
+	Ascii::AppendHex(check, Crc32c::Compute(aValue));
+	
+	aWriter.Write(aValue);
+	aWriter.Write(' ');
+	aWriter.Write(check);
+	aWriter.Write('\n');
+}
+
+static Brn TocLine(IReader& aReader)
+{
+	Brn line = aReader.ReadUntil('\n');
+	
+	for(TUint i = 0; i < line.Bytes(); ++i)
+	{
+		if(line[i] == ' ')
+		{
+			Brn value(line.Ptr(), i);
+			if(Ascii::UintHex(line.Split(i + 1)) != Crc32c::Compute(value))
+			{
+				THROW(ChecksumError);
+			}
+			return value;
+		}
+	}
+	
+	return line;
+}
 
-ProviderPlaylistManager::ProviderPlaylistManager(DvDevice& aDevice, PlaylistManager& aPlaylistManager, const TUint aMaxPlaylistCount, const TUint aMaxTrackCount)
+ProviderPlaylistManager::ProviderPlaylistManager(DvDevice& aDevice, PlaylistManager& aPlaylistManager, const TUint aMaxPlaylistCount, const TUint aMaxTrackCount, const TUint aLatencyMs)
 	: DvProviderAvOpenhomeOrgPlaylistManager1(aDevice)
 	, iPlaylistManager(aPlaylistManager)
+	, iLatencyMs(aLatencyMs)
+	, iPublishMutex("PMpb")
+	, iPublish("PMpb", 0)
+	, iMetadataDirty(false)
+	, iIdArrayDirty(false)
+	, iTokenArrayDirty(false)
+	, iPublisherQuit(false)
+	, iPublisherThread(0)
 {
     EnablePropertyMetadata();
 	EnablePropertyImagesXml();
@@ -60,8 +152,24 @@ ProviderPlaylistManager::ProviderPlaylistManager(DvDevice& aDevice, PlaylistMana
 	SetPropertyPlaylistsMax(aMaxPlaylistCount);
 	SetPropertyTracksMax(aMaxTrackCount);
 	
-	UpdateMetadata();
-	UpdateArrays();
+	Publish(true, true, true);
+	
+	if(iLatencyMs > 0)
+	{
+		iPublisherThread = new ThreadFunctor("PMev", MakeFunctor(*this, &ProviderPlaylistManager::PublisherRun));
+		iPublisherThread->Start();
+	}
+}
+
+ProviderPlaylistManager::~ProviderPlaylistManager()
+{
+	iPublishMutex.Wait();
+	iPublisherQuit = true;
+	iPublishMutex.Signal();
+	
+	iPublish.Signal();
+	
+	delete iPublisherThread;
 }
 
 void ProviderPlaylistManager::Metadata(IDvInvocation& aResponse, IDvInvocationResponseString& aMetadata)
@@ -84,7 +192,7 @@ void ProviderPlaylistManager::ImagesXml(IDvInvocation& aResponse, IDvInvocationR
 
 void ProviderPlaylistManager::PlaylistReadArray(IDvInvocation& aResponse, TUint aId, IDvInvocationResponseBinary& aArray)
 {
-	Bws<PlaylistData::kMaxTracks> idArray;
+	Bws<PlaylistData::kMaxTracks * 4> idArray;
 	
 	try
 	{
@@ -166,13 +274,15 @@ void ProviderPlaylistManager::PlaylistSetName(IDvInvocation& aResponse, TUint aI
 		
 		aResponse.StartResponse();
 		aResponse.EndResponse();
-		
-		UpdateTokenArray();
 	}
 	catch (PlaylistManagerError)
 	{
 		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
 	}
+	catch (PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
 void ProviderPlaylistManager::PlaylistSetDescription(IDvInvocation& aResponse, TUint aId, const Brx& aDescription)
@@ -183,13 +293,15 @@ void ProviderPlaylistManager::PlaylistSetDescription(IDvInvocation& aResponse, T
 		
 		aResponse.StartResponse();
 		aResponse.EndResponse();
-		
-		UpdateTokenArray();
 	}
 	catch (PlaylistManagerError)
 	{
 		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
 	}
+	catch (PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
 void ProviderPlaylistManager::PlaylistSetImageId(IDvInvocation& aResponse, TUint aId, TUint aImageId)
@@ -200,13 +312,15 @@ void ProviderPlaylistManager::PlaylistSetImageId(IDvInvocation& aResponse, TUint
 		
 		aResponse.StartResponse();
 		aResponse.EndResponse();
-		
-		UpdateTokenArray();
 	}
 	catch (PlaylistManagerError)
 	{
 		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
 	}
+	catch (PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
 void ProviderPlaylistManager::PlaylistInsert(IDvInvocation& aResponse, TUint aAfterId, const Brx& aName, const Brx& aDescription, TUint aImageId, IDvInvocationResponseUint& aNewId)
@@ -218,23 +332,30 @@ void ProviderPlaylistManager::PlaylistInsert(IDvInvocation& aResponse, TUint aAf
 		aResponse.StartResponse();
 		aNewId.Write(newId);
 		aResponse.EndResponse();
-		
-		UpdateArrays();
 	}
 	catch (PlaylistManagerError)
 	{
 		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
 	}
+	catch (PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
 void ProviderPlaylistManager::PlaylistDeleteId(IDvInvocation& aResponse, TUint aValue)
 {
-	iPlaylistManager.PlaylistDelete(aValue);
-	
-	aResponse.StartResponse();
-	aResponse.EndResponse();
-	
-	UpdateArrays();
+	try
+	{
+		iPlaylistManager.PlaylistDelete(aValue);
+		
+		aResponse.StartResponse();
+		aResponse.EndResponse();
+	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
 void ProviderPlaylistManager::PlaylistMove(IDvInvocation& aResponse, TUint aId, TUint aAfterId)
@@ -245,13 +366,15 @@ void ProviderPlaylistManager::PlaylistMove(IDvInvocation& aResponse, TUint aId,
 		
 		aResponse.StartResponse();
 		aResponse.EndResponse();
-		
-		UpdateArrays();
 	}
 	catch(PlaylistManagerError)
 	{
 		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
 	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
 void ProviderPlaylistManager::PlaylistsMax(IDvInvocation& aResponse, IDvInvocationResponseUint& aValue)
@@ -276,14 +399,18 @@ void ProviderPlaylistManager::TracksMax(IDvInvocation& aResponse, IDvInvocationR
 
 void ProviderPlaylistManager::PlaylistArrays(IDvInvocation& aResponse, IDvInvocationResponseUint& aToken, IDvInvocationResponseBinary& aIdArray, IDvInvocationResponseBinary& aTokenArray)
 {
-	Brh idArray;
-	GetPropertyIdArray(idArray);
+	// the properties may trail the manager by the publishing latency, so the
+	// arrays come from the manager itself, read after the token they match
+	TUint token = iPlaylistManager.Token();
+	
+	Bws<PlaylistManager::kMaxPlaylists * 4> idArray;
+	iPlaylistManager.IdArray(idArray);
 	
-	Brh tokenArray;
-	GetPropertyTokenArray(tokenArray);
+	Bws<PlaylistManager::kMaxPlaylists * 4> tokenArray;
+	iPlaylistManager.TokenArray(tokenArray);
 	
 	aResponse.StartResponse();
-	aToken.Write(iPlaylistManager.Token());
+	aToken.Write(token);
 	aIdArray.Write(idArray);
 	aIdArray.WriteFlush();
 	aTokenArray.Write(tokenArray);
@@ -345,17 +472,20 @@ void ProviderPlaylistManager::ReadList(IDvInvocation& aResponse, TUint aId, cons
         aResponse.Error(kInvalidRequest, kInvalidRequestMsg);
     }
 	
-	if(iPlaylistManager.PlaylistExists(aId))
+	try
 	{
 		aResponse.StartResponse();
 		iPlaylistManager.ReadList(aId, v, aTrackList);
 		aResponse.EndResponse();
 	}
-	else
+	catch(PlaylistManagerError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
+	catch(PlaylistError)
 	{
 		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
 	}
-
 }
 
 void ProviderPlaylistManager::Insert(IDvInvocation& aResponse, TUint aId, TUint aAfterTrackId, const Brx& aMetadataId, IDvInvocationResponseUint& aNewTrackId)
@@ -367,8 +497,6 @@ void ProviderPlaylistManager::Insert(IDvInvocation& aResponse, TUint aId, TUint
 		aResponse.StartResponse();
 		aNewTrackId.Write(newId);
 		aResponse.EndResponse();
-		
-		UpdateArrays();
 	}
 	catch (PlaylistManagerError)
 	{
@@ -382,922 +510,3236 @@ void ProviderPlaylistManager::Insert(IDvInvocation& aResponse, TUint aId, TUint
 	{
 		aResponse.Error(kPlaylistFull, kPlaylistFullMsg);
 	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 void ProviderPlaylistManager::DeleteId(IDvInvocation& aResponse, TUint aId, TUint aTrackId)
 {
-	iPlaylistManager.Delete(aId, aTrackId);
-	
-	aResponse.StartResponse();
-	aResponse.EndResponse();
+	try
+	{
+		iPlaylistManager.Delete(aId, aTrackId);
+		
+		aResponse.StartResponse();
+		aResponse.EndResponse();
+	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
 void ProviderPlaylistManager::DeleteAll(IDvInvocation& aResponse, TUint aTrackId)
 {
-	iPlaylistManager.DeleteAll(aTrackId);
-	
-	aResponse.StartResponse();
-	aResponse.EndResponse();
+	try
+	{
+		iPlaylistManager.DeleteAll(aTrackId);
+		
+		aResponse.StartResponse();
+		aResponse.EndResponse();
+	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
 void ProviderPlaylistManager::MetadataChanged()
 {
-	UpdateMetadata();
+	Schedule(true, false, false);
 }
 
 void ProviderPlaylistManager::PlaylistsChanged()
 {
-	UpdateArrays();
+	Schedule(false, true, true);
 }
 
 void ProviderPlaylistManager::PlaylistChanged()
 {
-	UpdateTokenArray();
+	Schedule(false, false, true);
 }
 
-void ProviderPlaylistManager::UpdateMetadata()
+// Changes are folded into flags and published together by the publisher
+// thread at most iLatencyMs after the first of them, so a burst of edits
+// costs one property update rather than one per edit, and none of it is
+// paid for on the thread that made the change.  A latency of zero publishes
+// on the caller's thread as each change is made.
+void ProviderPlaylistManager::Schedule(TBool aMetadata, TBool aIdArray, TBool aTokenArray)
 {
-	Bws<PlaylistManager::kMaxMetadataBytes * 2> metadata;
+	if(iLatencyMs == 0)
+	{
+		Publish(aMetadata, aIdArray, aTokenArray);
+		return;
+	}
 	
-	iPlaylistManager.Metadata(metadata);
+	iPublishMutex.Wait();
+	iMetadataDirty = iMetadataDirty || aMetadata;
+	iIdArrayDirty = iIdArrayDirty || aIdArray;
+	iTokenArrayDirty = iTokenArrayDirty || aTokenArray;
+	iPublishMutex.Signal();
 	
-	SetPropertyMetadata(metadata);
-}
-
-void ProviderPlaylistManager::UpdateIdArray()
-{
-	Bws<PlaylistManager::kMaxPlaylists> idArray;
-	iPlaylistManager.IdArray(idArray);
-	SetPropertyIdArray(idArray);
+	iPublish.Signal();
 }
 
-void ProviderPlaylistManager::UpdateTokenArray()
-{
-	Bws<PlaylistManager::kMaxPlaylists> tokenArray;
-	iPlaylistManager.TokenArray(tokenArray);
-	SetPropertyTokenArray(tokenArray);
-}
-
-void ProviderPlaylistManager::UpdateArrays()
+void ProviderPlaylistManager::Publish(TBool aMetadata, TBool aIdArray, TBool aTokenArray)
 {
 	PropertiesLock();
 	
-	UpdateIdArray();
-	UpdateTokenArray();
+	if(aMetadata)
+	{
+		UpdateMetadata();
+	}
+	if(aIdArray)
+	{
+		UpdateIdArray();
+	}
+	if(aTokenArray)
+	{
+		UpdateTokenArray();
+	}
 	
 	PropertiesUnlock();
 }
 
-
-
-
-/*PlaylistManagerPersistFs::PlaylistManagerPersistFs()
+void ProviderPlaylistManager::PublisherRun()
 {
+	for(;;)
+	{
+		iPublish.Wait();
+		
+		iPublishMutex.Wait();
+		TBool quit = iPublisherQuit;
+		iPublishMutex.Signal();
+		
+		if(quit)
+		{
+			break;
+		}
+		
+		Thread::Sleep(iLatencyMs);
+		
+		// changes made while sleeping are all covered by this update; the
+		// quit flag is read again since Clear() may have taken its signal
+		iPublish.Clear();
+		
+		iPublishMutex.Wait();
+		quit = iPublisherQuit;
+		TBool metadata = iMetadataDirty;
+		TBool idArray = iIdArrayDirty;
+		TBool tokenArray = iTokenArrayDirty;
+		iMetadataDirty = false;
+		iIdArrayDirty = false;
+		iTokenArrayDirty = false;
+		iPublishMutex.Signal();
+		
+		if(quit)
+		{
+			break;
+		}
+		
+		Publish(metadata, idArray, tokenArray);
+	}
 }
 
-TUint PlaylistManagerPersistFs::PlaylistCount() const
+void ProviderPlaylistManager::UpdateMetadata()
 {
-	return 0;
+	Bws<PlaylistManager::kMaxMetadataBytes * 2> metadata;
+	
+	iPlaylistManager.Metadata(metadata);
+	
+	SetPropertyMetadata(metadata);
 }
 
-TUint PlaylistManagerPersistFs::MaxTrackCount() const
+void ProviderPlaylistManager::UpdateIdArray()
 {
-	return -1;
+	Bws<PlaylistManager::kMaxPlaylists * 4> idArray;
+	iPlaylistManager.IdArray(idArray);
+	SetPropertyIdArray(idArray);
 }
 
-TUint PlaylistManagerPersistFs::MaxPlaylistCount() const
+void ProviderPlaylistManager::UpdateTokenArray()
 {
-	return -1;
+	Bws<PlaylistManager::kMaxPlaylists * 4> tokenArray;
+	iPlaylistManager.TokenArray(tokenArray);
+	SetPropertyTokenArray(tokenArray);
 }
 
-void PlaylistManagerPersistFs::Save(const Playlist& aPlaylist)
-{
-}
 
-void PlaylistManagerPersistFs::Delete(const Playlist& aPlaylist)
-{
-}*/
 
-void Metadata::Condense(const Brx& aIn, Bwx& aOut)
+// the ids as a big endian array, the form IdArray takes
+static void WriteIdArray(const vector<TUint>& aIds, IDvInvocationResponseBinary& aIdArray)
 {
-	if(aIn.Bytes() > Track::kMaxMetadataBytes)
-	{
-		aOut.Append(Brn("<DIDL-Lite xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\"><item id=\"\" parentID=\"\" restricted=\"True\"><dc:title>"));
-		aOut.Append(Brn("Metadata too large"));
-		aOut.Append(Brn("</dc:title><upnp:class>object.item</upnp:class></item></DIDL-Lite>"));
-	}
-	else
+	Bwh idArray(aIds.size() * 4);
+	WriterBuffer writer(idArray);
+	WriterBinary binary(writer);
+	for(vector<TUint>::const_iterator i = aIds.begin(); i != aIds.end(); ++i)
 	{
-		aOut.Append(aIn);
+		binary.WriteUint32Be(*i);
 	}
+	
+	aIdArray.Write(idArray);
+	aIdArray.WriteFlush();
 }
 
-
-
-IdGenerator::IdGenerator(const TUint aNextId)
-: iNextId(aNextId)
-{
-}
-
-
-IdGenerator::IdGenerator()
-	: iNextId(0)
-{
-}
-
-TUint IdGenerator::NewId()
-{
-	return ++iNextId;
-}
-
-
-
-Cache::Cache()
-	: iMutex("Cache")
+ProviderPlaylistManagerExtension::ProviderPlaylistManagerExtension(DvDevice& aDevice, PlaylistManager& aPlaylistManager)
+	: DvProviderAvOpenhomeOrgPlaylistManagerExtension1(aDevice)
+	, iPlaylistManager(aPlaylistManager)
 {
+	EnableActionInsertList();
+	EnableActionDeleteList();
+	EnableActionMove();
+	EnableActionMoveList();
+	EnableActionReadRange();
+	EnableActionReadListArray();
+	EnableActionChangesSince();
 }
 
-PlaylistData& Cache::Data(const Playlist& aPlaylist, ICacheListener* aCacheListener)
+// The items of a DIDL-Lite document go in, in order, with one save and one
+// change for listeners, and every new id comes back in the same order.
+void ProviderPlaylistManagerExtension::InsertList(IDvInvocation& aResponse, TUint aId, TUint aAfterTrackId, const Brx& aMetadataList, IDvInvocationResponseBinary& aNewIdArray)
 {
-	iMutex.Wait();
+	ReaderMemory reader(aMetadataList.Bytes());
+	reader.Data().Replace(aMetadataList);
 	
-	const TUint id = aPlaylist.Id();
-	list< pair<PlaylistData*, ICacheListener*> >::iterator i = iList.begin();
-	for(; i != iList.end(); ++i)
+	TrackListImport import(aMetadataList.Bytes());
+	vector<Brn> tracks;
+	try
 	{
-		if((*i).first->IsId(id))
-		{
-			pair<PlaylistData*, ICacheListener*> d = (*i);
-			iList.erase(i);
-			iList.push_back(d);
-			iMutex.Signal();
-			return *d.first;
-		}
+		PlaylistImporter::Parse(PlaylistImporter::eDidlLite, reader, import);
+		import.Tracks(tracks);
 	}
-	
-	if(iList.size() == kMaxCacheSize)
+	catch(ReaderError)
 	{
-		iList.front().second->RemovedFromCache();
-		
-		delete(iList.front().second);
-		
-		iList.pop_front();
 	}
-		
-	PlaylistData* playlistData = new PlaylistData(aPlaylist.Id(), aPlaylist.Filename());
-	
-	iList.push_back(pair<PlaylistData*, ICacheListener*>(playlistData, aCacheListener));
 	
-	iMutex.Signal();
+	if(tracks.empty())
+	{
+		aResponse.Error(kInvalidMetadata, kInvalidMetadataMsg);
+		return;
+	}
 	
-	return *playlistData;
+	try
+	{
+		vector<TUint> newIds;
+		iPlaylistManager.InsertList(aId, aAfterTrackId, tracks, newIds);
+		
+		aResponse.StartResponse();
+		WriteIdArray(newIds, aNewIdArray);
+		aResponse.EndResponse();
+	}
+	catch(PlaylistManagerError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
+	catch(PlaylistError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
+	catch(PlaylistFull)
+	{
+		aResponse.Error(kPlaylistFull, kPlaylistFullMsg);
+	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
-
-PlaylistHeader::PlaylistHeader(const Brx& aFilename, const Brx& aName, const Brx& aDescription, const TUint aImageId)
-	: iFilename(aFilename)
-    ,iName(aName)
-	, iDescription(aDescription)
-	, iImageId(aImageId)
+// Ids not in the playlist don't stop the rest going; they come back in
+// MissingIdArray, so a control point working from a stale IdArray can tell.
+void ProviderPlaylistManagerExtension::DeleteList(IDvInvocation& aResponse, TUint aId, const Brx& aIdArray, IDvInvocationResponseBinary& aMissingIdArray)
 {
+	if(aIdArray.Bytes() % 4 != 0)
+	{
+		aResponse.Error(kInvalidRequest, kInvalidRequestMsg);
+		return;
+	}
+	
+	try
+	{
+		vector<TUint> missing;
+		iPlaylistManager.DeleteList(aId, aIdArray, missing);
+		
+		aResponse.StartResponse();
+		WriteIdArray(missing, aMissingIdArray);
+		aResponse.EndResponse();
+	}
+	catch(PlaylistManagerError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
-PlaylistHeader::PlaylistHeader(const Brx& aFilename, IReader& aReader)
-	: iFilename(aFilename)
+
+// The track keeps its id, where a DeleteId and Insert would give it a new one.
+void ProviderPlaylistManagerExtension::Move(IDvInvocation& aResponse, TUint aId, TUint aTrackId, TUint aAfterTrackId)
 {
-	aReader.ReadUntil('<');
-	Brn nameTag = aReader.ReadUntil('>');
-	if(nameTag == Brn("Name"))
+	try
 	{
-		iName.Replace(aReader.ReadUntil('<'));
+		iPlaylistManager.Move(aId, aTrackId, aAfterTrackId);
 		
-		aReader.ReadUntil('<');
-		Brn descriptionTag = aReader.ReadUntil('>');
-		if(descriptionTag == Brn("Description"))
-		{
-			iDescription.Replace(aReader.ReadUntil('<'));
-			
-			aReader.ReadUntil('<');
-			Brn imageTag = aReader.ReadUntil('>');
-			if(imageTag == Brn("ImageId"))
-			{
-				iImageId = Ascii::Uint(aReader.ReadUntil('<'));
-				aReader.ReadUntil('>');
-			}
-		}
+		aResponse.StartResponse();
+		aResponse.EndResponse();
+	}
+	catch(PlaylistManagerError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
+	catch(PlaylistError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
 	}
 }
 
-const Brx& PlaylistHeader::Filename() const
+// All the tracks move, in the order given, or none do.
+void ProviderPlaylistManagerExtension::MoveList(IDvInvocation& aResponse, TUint aId, const Brx& aIdArray, TUint aAfterTrackId)
 {
-	return iFilename;
+	if(aIdArray.Bytes() % 4 != 0)
+	{
+		aResponse.Error(kInvalidRequest, kInvalidRequestMsg);
+		return;
+	}
+	
+	try
+	{
+		iPlaylistManager.MoveList(aId, aIdArray, aAfterTrackId);
+		
+		aResponse.StartResponse();
+		aResponse.EndResponse();
+	}
+	catch(PlaylistManagerError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
+	catch(PlaylistError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
+	catch(PlaylistStoreError)
+	{
+		aResponse.Error(kStoreFailed, kStoreFailedMsg);
+	}
 }
 
-void PlaylistHeader::Name(Bwx& aName) const
+// A window of the playlist by position, so a control point can page
+// through it without reading the IdArray first.  The playlist is looked
+// for before the response starts, so a missing one gets a plain error.
+void ProviderPlaylistManagerExtension::ReadRange(IDvInvocation& aResponse, TUint aId, TUint aStart, TUint aCount, IDvInvocationResponseString& aTrackList)
 {
-	aName.Replace(iName);
+	if(!iPlaylistManager.PlaylistExists(aId))
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+		return;
+	}
+	
+	try
+	{
+		aResponse.StartResponse();
+		iPlaylistManager.ReadRange(aId, aStart, aCount, aTrackList);
+		aResponse.EndResponse();
+	}
+	catch(PlaylistManagerError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
 }
 
-void PlaylistHeader::Description(Bwx& aDescription) const
+// ReadList with the ids as a big endian array, as IdArray gives them, so a
+// control point can pass back what it read without formatting it.
+void ProviderPlaylistManagerExtension::ReadListArray(IDvInvocation& aResponse, TUint aId, const Brx& aIdArray, IDvInvocationResponseString& aTrackList)
 {
-	aDescription.Replace(iDescription);
+	if(aIdArray.Bytes() % 4 != 0 || aIdArray.Bytes() > PlaylistData::kMaxTracks * 4)
+	{
+		aResponse.Error(kInvalidRequest, kInvalidRequestMsg);
+		return;
+	}
+	
+	if(!iPlaylistManager.PlaylistExists(aId))
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+		return;
+	}
+	
+	try
+	{
+		aResponse.StartResponse();
+		iPlaylistManager.ReadList(aId, aIdArray, aTrackList);
+		aResponse.EndResponse();
+	}
+	catch(PlaylistManagerError)
+	{
+		aResponse.Error(kIdNotFound, kIdNotFoundMsg);
+	}
 }
 
-void PlaylistHeader::ImageId(TUint& aImageId) const
+// The playlist changes since a token from PlaylistArrays or an earlier
+// call, as PlaylistManager::ChangesSince writes them.  When Valid is false
+// the token is too old and the control point reads PlaylistArrays again.
+void ProviderPlaylistManagerExtension::ChangesSince(IDvInvocation& aResponse, TUint aToken, IDvInvocationResponseBool& aValid, IDvInvocationResponseUint& aNewToken, IDvInvocationResponseBinary& aChanges)
 {
-	aImageId = iImageId;
+	Bwh changes(PlaylistManager::kMaxChangeBytes);
+	TUint newToken = 0;
+	TBool valid = iPlaylistManager.ChangesSince(aToken, changes, newToken);
+	
+	aResponse.StartResponse();
+	aValid.Write(valid);
+	aNewToken.Write(newToken);
+	aChanges.Write(changes);
+	aChanges.WriteFlush();
+	aResponse.EndResponse();
 }
 
-void PlaylistHeader::SetName(const Brx& aName)
+
+
+/*PlaylistManagerPersistFs::PlaylistManagerPersistFs()
 {
-	iName.Replace(aName);
 }
 
-void PlaylistHeader::SetDescription(const Brx& aDescription)
+TUint PlaylistManagerPersistFs::PlaylistCount() const
 {
-	iDescription.Replace(aDescription);
+	return 0;
 }
 
-void PlaylistHeader::SetImageId(const TUint& aImageId)
+TUint PlaylistManagerPersistFs::MaxTrackCount() const
 {
-	iImageId = aImageId;
+	return -1;
 }
 
-void PlaylistHeader::ToXml(IWriter& aWriter) const
+TUint PlaylistManagerPersistFs::MaxPlaylistCount() const
 {
-	WriterAscii ascii(aWriter);
-	
-	ascii.Write(Brn("  <Name>")); ascii.Write(iName); ascii.Write(Brn("</Name>\n"));
-	ascii.Write(Brn("  <Description>")); ascii.Write(iDescription); ascii.Write(Brn("</Description>\n"));
-	ascii.Write(Brn("  <ImageId>")); ascii.WriteUint(iImageId); ascii.Write(Brn("</ImageId>\n"));
-	
-	ascii.WriteFlush();
+	return -1;
 }
 
+void PlaylistManagerPersistFs::Save(const Playlist& aPlaylist)
+{
+}
 
+void PlaylistManagerPersistFs::Delete(const Playlist& aPlaylist)
+{
+}*/
 
-Track::Track(const TUint aId, const Brx& aMetadata)
-	: iId(aId)
-	, iMetadata(aMetadata)
+void Metadata::Condense(const Brx& aIn, Bwx& aOut)
 {
+	if(aIn.Bytes() > Track::kMaxMetadataBytes)
+	{
+		aOut.Append(Brn("<DIDL-Lite xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\"><item id=\"\" parentID=\"\" restricted=\"True\"><dc:title>"));
+		aOut.Append(Brn("Metadata too large"));
+		aOut.Append(Brn("</dc:title><upnp:class>object.item</upnp:class></item></DIDL-Lite>"));
+	}
+	else
+	{
+		aOut.Append(aIn);
+	}
 }
 
-TUint Track::Id() const
+
+
+IdGenerator::IdGenerator(const TUint aNextId)
+: iNextId(aNextId)
 {
-	return iId;
 }
 
-bool Track::IsId(const TUint aId) const
+
+IdGenerator::IdGenerator()
+	: iNextId(0)
 {
-	return aId == iId;
 }
 
-const Brx& Track::Metadata() const
+TUint IdGenerator::NewId()
 {
-	return iMetadata;
+	return ++iNextId;
 }
 
 
 
-PlaylistData::PlaylistData(const TUint aId, const Brx& aFilename)
-	: iId(aId)
+Cache::Cache(IFileStore& aStore)
+	: iMutex("Cache")
+	, iStore(aStore)
 {
-	// load playlist from file
-	Bws<Ascii::kMaxUintStringBytes + 1> filename(aFilename);
-	ReaderFile file(filename.PtrZ());
-	Srs<Track::kMaxMetadataBytes> reader(file);
-	
-	try
-	{
-		// skip over header information
-		for(;;)
-		{
-			reader.ReadUntil('<');
-			if(reader.ReadUntil('>') == Brn("/ImageId"))
-			{
-				break;
-			}
-		}
-		
-		Brn trackTag("Track");
-		Brn metadataTag("Metadata");
-		
-		for(;;)
-		{
-			reader.ReadUntil('<');								// beginning of <Track>
-			if(reader.ReadUntil('>') == trackTag)				// end of <Track>
-			{
-				reader.ReadUntil('<');						// beginning of <Metadata>
-				if(reader.ReadUntil('>') == metadataTag)
-				{
-					Brn escaped = reader.ReadUntil('<');	// beginning of </Metadata>
-					Bws<Track::kMaxMetadataBytes * 2> metadata;
-					metadata.Replace(escaped);
-					Converter::FromXmlEscaped(metadata);
-						
-					iTracks.push_back(new Track(iIdGenerator.NewId(), metadata));
-						
-					reader.ReadUntil('>');					// end of </Metadata>
-					reader.ReadUntil('>');					// end of </Track>
-				}
-			}
-			else
-			{
-				break;
-			}
-		}
-	}
-	catch(ReaderFileError)
-	{
-	}
 }
 
-PlaylistData::~PlaylistData()
+Cache::~Cache()
 {
-	for(list<Track*>::iterator i = iTracks.begin(); i != iTracks.end(); ++i)
+	for(list< pair<PlaylistData*, ICacheListener*> >::iterator i = iList.begin(); i != iList.end(); ++i)
 	{
-		delete *i;
+		delete (*i).first;
 	}
 }
 
-bool PlaylistData::IsId(const TUint aId) const
+PlaylistData& Cache::Data(const Playlist& aPlaylist, ICacheListener* aCacheListener)
 {
-	return aId == iId;
+	iMutex.Wait();
+	
+	list< pair<PlaylistData*, ICacheListener*> >::iterator i = Find(aPlaylist.Id());
+	if(i != iList.end())
+	{
+		pair<PlaylistData*, ICacheListener*> d((*i).first, aCacheListener);
+		iList.erase(i);
+		iList.push_back(d);
+		iMutex.Signal();
+		return *d.first;
+	}
+	
+	if(iList.size() == kMaxCacheSize)
+	{
+		Evict();
+	}
+		
+	PlaylistData* playlistData = new PlaylistData(iStore, aPlaylist.Id(), aPlaylist.Filename());
+	
+	iList.push_back(pair<PlaylistData*, ICacheListener*>(playlistData, aCacheListener));
+	
+	iMutex.Signal();
+	
+	return *playlistData;
 }
- 
-void PlaylistData::IdArray(Bwx& aIdArray)
+
+void Cache::Add(PlaylistData* aData)
 {
-	aIdArray.SetBytes(0);
-    WriterBuffer writer(aIdArray);
-    WriterBinary binary(writer);
+	iMutex.Wait();
 	
-    for(list<Track*>::const_iterator i = iTracks.begin(); i != iTracks.end(); ++i)
+	if(iList.size() == kMaxCacheSize)
 	{
-        binary.WriteUint32Be((*i)->Id());
-    }
+		Evict();
+	}
+	
+	iList.push_back(pair<PlaylistData*, ICacheListener*>(aData, NULL));
+	
+	iMutex.Signal();
 }
 
-void PlaylistData::Read(const TUint aTrackId, Bwx& aMetadata)
+void Cache::Remove(const TUint aId)
 {
-	list<Track*>::const_iterator i = find_if(iTracks.begin(), iTracks.end(), bind2nd(mem_fun(&Track::IsId), aTrackId));
-	if(i == iTracks.end())
+	iMutex.Wait();
+	
+	list< pair<PlaylistData*, ICacheListener*> >::iterator i = Find(aId);
+	if(i != iList.end())
 	{
-		THROW(PlaylistError);
+		delete (*i).first;
+		iList.erase(i);
 	}
 	
-	aMetadata.Append((*i)->Metadata());
+	iMutex.Signal();
 }
 
-const TUint PlaylistData::Insert(const TUint aAfterId, const Brx& aMetadata)
+TUint Cache::Prefetch(const TUint aId, const Brx& aFilename)
 {
-    if(iTracks.size() == kMaxTracks)
-	{
-        THROW(PlaylistFull);
-    }
+	iMutex.Wait();
 	
-    list<Track*>::iterator i;
-    if(aAfterId == 0)
-	{
-        i = iTracks.begin();
-    }
-    else
+	list< pair<PlaylistData*, ICacheListener*> >::iterator i = Find(aId);
+	if(i != iList.end())
 	{
-        i = find_if(iTracks.begin(), iTracks.end(), bind2nd(mem_fun(&Track::IsId), aAfterId));
-        if(i == iTracks.end())
+		TUint trackCount = (*i).first->TrackCount();
+		iMutex.Signal();
+		return trackCount;
+	}
+	
+	iMutex.Signal();
+	
+	PlaylistData* playlistData = new PlaylistData(iStore, aId, aFilename);
+	TUint trackCount = playlistData->TrackCount();
+	
+	iMutex.Wait();
+	
+	// someone may have loaded it while we were parsing
+	if(Find(aId) != iList.end())
+	{
+		delete playlistData;
+	}
+	else
+	{
+		if(iList.size() == kMaxCacheSize)
 		{
-            THROW(PlaylistError);
-        }
-        ++i;  //we insert after the id, not before
-    }
+			Evict();
+		}
+		
+		iList.push_back(pair<PlaylistData*, ICacheListener*>(playlistData, NULL));
+	}
 	
-	TUint id = iIdGenerator.NewId();
-	Bws<Track::kMaxMetadataBytes> metadata;
+	iMutex.Signal();
 	
-	Metadata::Condense(aMetadata, metadata);
-    iTracks.insert(i, new Track(id, metadata));
-
-	return id;
+	return trackCount;
 }
 
-void PlaylistData::Delete(const TUint aId)
+void Cache::Recent(std::vector<TUint>& aIds, const TUint aMax) const
 {
-	list<Track*>::iterator i = find_if(iTracks.begin(), iTracks.end(), bind2nd(mem_fun(&Track::IsId), aId));
-	if(i != iTracks.end())
+	iMutex.Wait();
+	
+	list< pair<PlaylistData*, ICacheListener*> >::const_reverse_iterator i = iList.rbegin();
+	for(; i != iList.rend() && aIds.size() < aMax; ++i)
 	{
-		delete (*i);
-		iTracks.erase(i);
+		// prefetched data that nobody has asked for yet doesn't count as used
+		if((*i).second != NULL)
+		{
+			aIds.push_back((*i).first->Id());
+		}
 	}
+	
+	iMutex.Signal();
 }
 
-void PlaylistData::DeleteAll()
+list< pair<PlaylistData*, ICacheListener*> >::iterator Cache::Find(const TUint aId)
 {
-	for(list<Track*>::iterator i = iTracks.begin(); i != iTracks.end(); ) {
-		delete (*i);
-		i = iTracks.erase(i);
+	list< pair<PlaylistData*, ICacheListener*> >::iterator i = iList.begin();
+	for(; i != iList.end(); ++i)
+	{
+		if((*i).first->IsId(aId))
+		{
+			break;
+		}
 	}
+	return i;
 }
 
-void PlaylistData::ToXml(IWriter& aWriter) const
+void Cache::Evict()
 {
-	WriterAscii ascii(aWriter);
-	
-	Brn trackStart("  <Track>\n");
-	Brn metadataStart("    <Metadata>");
-	Brn trackEnd("  </Track>\n");
-	Brn metadataEnd("</Metadata>\n");
-	
-	for(list<Track*>::const_iterator i = iTracks.begin(); i != iTracks.end(); ++i)
+	if(iList.front().second != NULL)
 	{
-		ascii.Write(trackStart);
-		
-		ascii.Write(metadataStart); Converter::ToXmlEscaped(ascii, (*i)->Metadata()); ascii.Write(metadataEnd);
-		
-		ascii.Write(trackEnd);
+		iList.front().second->RemovedFromCache();
 	}
 	
-	ascii.WriteFlush();
+	delete(iList.front().first);
+	
+	iList.pop_front();
 }
 
 
-Playlist::Playlist(Cache* aCache, const TUint aId, const Brx& aFilename, const Brx& aName, const Brx& aDescription, const TUint aImageId)
-	: iMutex("PList")
-	, iId(aId)
-	, iToken(0)
-    , iCache(aCache)
-	, iHeader(aFilename, aName, aDescription, aImageId)
-	, iData(0)
+PlaylistHeader::PlaylistHeader(const Brx& aFilename, const Brx& aName, const Brx& aDescription, const TUint aImageId)
+	: iFilename(aFilename)
+    ,iName(aName)
+	, iDescription(aDescription)
+	, iImageId(aImageId)
 {
 }
 
-Playlist::Playlist(Cache* aCache, const TUint aId, const Brx& aFilename, IReader& aReader)
-	: iMutex("PList")
-	, iId(aId)
-	, iToken(0)
-    , iCache(aCache)
-	, iHeader(aFilename, aReader)
-	, iData(0)
+PlaylistHeader::PlaylistHeader(const Brx& aFilename, IReader& aReader)
+	: iFilename(aFilename)
+	, iImageId(0)
 {
+	aReader.ReadUntil('<');
+	Brn nameTag = aReader.ReadUntil('>');
+	if(nameTag == Brn("Name"))
+	{
+		Bws<kMaxNameBytes * 6> name(aReader.ReadUntil('<'));
+		Converter::FromXmlEscaped(name);
+		iName.Replace(name);
+		
+		aReader.ReadUntil('<');
+		Brn descriptionTag = aReader.ReadUntil('>');
+		if(descriptionTag == Brn("Description"))
+		{
+			Bws<kMaxDescriptionBytes * 6> description(aReader.ReadUntil('<'));
+			Converter::FromXmlEscaped(description);
+			iDescription.Replace(description);
+			
+			aReader.ReadUntil('<');
+			Brn imageTag = aReader.ReadUntil('>');
+			if(imageTag == Brn("ImageId"))
+			{
+				iImageId = Ascii::Uint(aReader.ReadUntil('<'));
+				aReader.ReadUntil('>');
+				
+				aReader.ReadUntil('<');
+				Brn checkTag = aReader.ReadUntil('>');
+				if(checkTag == Brn("Check"))
+				{
+					if(Ascii::UintHex(aReader.ReadUntil('<')) != Checksum())
+					{
+						THROW(ChecksumError);
+					}
+				}
+			}
+		}
+	}
 }
 
-const TUint Playlist::Id() const
+const Brx& PlaylistHeader::Filename() const
 {
-	return iId;
+	return iFilename;
 }
 
-bool Playlist::IsId(const TUint aId) const
+void PlaylistHeader::Name(Bwx& aName) const
 {
-	return aId == iId;
+	aName.Replace(iName);
 }
 
-const TUint Playlist::Token() const
+void PlaylistHeader::Description(Bwx& aDescription) const
 {
-	return iToken;
+	aDescription.Replace(iDescription);
 }
 
-const Brx& Playlist::Filename() const
+void PlaylistHeader::ImageId(TUint& aImageId) const
 {
-	return iHeader.Filename();
+	aImageId = iImageId;
 }
 
-void Playlist::Name(Bwx& aName) const
+void PlaylistHeader::SetName(const Brx& aName)
 {
-	iHeader.Name(aName);
+	iName.Replace(aName);
 }
 
-void Playlist::Description(Bwx& aDescription) const
+void PlaylistHeader::SetDescription(const Brx& aDescription)
 {
-	iMutex.Wait();
-	
-	iHeader.Description(aDescription);
-	
-	iMutex.Signal();
+	iDescription.Replace(aDescription);
 }
 
-void Playlist::ImageId(TUint& aImageId) const
+void PlaylistHeader::SetImageId(const TUint& aImageId)
 {
-	iMutex.Wait();
-	
-	iHeader.ImageId(aImageId);
-	
-	iMutex.Signal();
+	iImageId = aImageId;
 }
 
-void Playlist::SetName(const Brx& aName)
+void PlaylistHeader::ToXml(IWriter& aWriter) const
 {
-	iMutex.Wait();
+	WriterAscii ascii(aWriter);
 	
-	iHeader.SetName(aName);
-	++iToken;
+	ascii.Write(Brn("  <Name>")); XmlEscaper::Write(ascii, iName); ascii.Write(Brn("</Name>\n"));
+	ascii.Write(Brn("  <Description>")); XmlEscaper::Write(ascii, iDescription); ascii.Write(Brn("</Description>\n"));
+	ascii.Write(Brn("  <ImageId>")); ascii.WriteUint(iImageId); ascii.Write(Brn("</ImageId>\n"));
 	
-	iMutex.Signal();
+	Bws<8> check;
+	Ascii::AppendHex(check, Checksum());
+	ascii.Write(Brn("  <Check>")); ascii.Write(check); ascii.Write(Brn("</Check>\n"));
+	
+	ascii.WriteFlush();
 }
 
-void Playlist::SetDescription(const Brx& aDescription)
+TUint PlaylistHeader::Checksum() const
 {
-	iMutex.Wait();
-	
-	iHeader.SetDescription(aDescription);
-	++iToken;
-	
-	iMutex.Signal();
+	TUint crc = Crc32c::Compute(iName);
+	crc = Crc32c::Update(crc, iDescription);
+	return Crc32c::Update(crc, iImageId);
 }
 
-void Playlist::SetImageId(const TUint& aImageId)
+
+
+Track::Track(const TUint aId, const Brx& aMetadata)
+	: iId(aId)
+	, iMetadata(aMetadata)
+	, iChecksum(Crc32c::Compute(aMetadata))
 {
-	iMutex.Wait();
-	
-	iHeader.SetImageId(aImageId);
-	++iToken;
-	
-	iMutex.Signal();
 }
 
-void Playlist::IdArray(Bwx& aIdArray)
+Track::Track(const TUint aId)
+	: iId(aId)
+	, iChecksum(Crc32c::Compute(Brx::Empty()))
 {
-	iMutex.Wait();
-	
-	if(iData == NULL)
-	{
-		iData = &iCache->Data(*this, this);
-	}
-	
-	iData->IdArray(aIdArray);
-	
-	iMutex.Signal();
 }
 
-void Playlist::Read(const TUint aTrackId, Bwx& aMetadata)
+TUint Track::Id() const
 {
-	iMutex.Wait();
-	
-	if(iData == NULL)
-	{
-		iData = &iCache->Data(*this, this);
-	}
-	
-	try
-	{
-		iData->Read(aTrackId, aMetadata);
-	}
-	catch(PlaylistError& e)
-	{
-		iMutex.Signal();
-		throw e;
-	}
-	
-	iMutex.Signal();
+	return iId;
 }
 
-const TUint Playlist::Insert(const TUint aAfterId, const Brx& aMetadata)
+bool Track::IsId(const TUint aId) const
 {
-	iMutex.Wait();
-	
-	if(iData == NULL)
-	{
-		iData = &iCache->Data(*this, this);
-	}
-	
-	try
-	{
-		TUint newId = iData->Insert(aAfterId, aMetadata);
-		++iToken;
-		
-		iMutex.Signal();
-		
-		return newId;
-	}
-	catch(PlaylistFull& e)
-	{
-		iMutex.Signal();
-		throw e;
-	}
-	catch(PlaylistError& e)
-	{
-		iMutex.Signal();
-		throw e;
-	}
+	return aId == iId;
 }
 
-void Playlist::Delete(const TUint aId)
+const Brx& Track::Metadata() const
 {
-	iMutex.Wait();
-	
-	if(iData == NULL)
-	{
-		iData = &iCache->Data(*this, this);
-	}
-	
-	iData->Delete(aId);
-	++iToken;
-	
-	iMutex.Signal();
+	return iMetadata;
 }
 
-void Playlist::DeleteAll()
+Bwx& Track::Metadata()
 {
-	iMutex.Wait();
-	
-	if(iData == NULL)
-	{
-		iData = &iCache->Data(*this, this);
-	}
-	
-	iData->DeleteAll();
-	++iToken;
-	
-	iMutex.Signal();
+	return iMetadata;
 }
 
-void Playlist::ToXml(IWriter& aWriter)
+TUint Track::Checksum() const
 {
-	iMutex.Wait();
-	
-	if(iData == NULL)
-	{
-		iData = &iCache->Data(*this, this);
-	}
-	
-	aWriter.Write(Brn("<Playlist>\n"));
-	
-	iHeader.ToXml(aWriter);
-	iData->ToXml(aWriter);
-	
-	aWriter.Write(Brn("</Playlist>\n"));
-	
-	iMutex.Signal();
+	return iChecksum;
 }
 
-void Playlist::RemovedFromCache()
+void Track::UpdateChecksum()
 {
-	iMutex.Wait();
-
-	iData = NULL;
-	
-	iMutex.Signal();
+	iChecksum = Crc32c::Compute(iMetadata);
 }
 
 
 
-
-
-PlaylistManager::PlaylistManager(DvDevice& aDevice, const TIpAddress& aAdapter, const Brx& aName, const Brx& aImage, const Brx& aMimeType)
-	: iMutex("PMngr")
-    , iDevice(aDevice)
-    , iName(aName)
-    , iAdapter(aAdapter)
-	, iImage(aImage)
-	, iMimeType(aMimeType)
-	, iToken(0)
+PlaylistData::PlaylistData(IFileStore& aStore, const TUint aId, const Brx& aFilename)
+	: iId(aId)
 {
-	try 
+	// load playlist from file
+	IReaderSource* file = aStore.OpenReader(aFilename);
+	XmlTokenizer xml(*file);
+	
+	TBool started = false;
+	TBool complete = false;
+	TUint dropped = 0;
+	
+	try
 	{
-		ReaderFile toc("Toc.txt");
-		Srs<20> tocReader(toc);
+		// skip over header information, which is verified when the header is loaded
+		while(xml.NextTag() != Brn("/ImageId"))
+		{
+		}
 		
-		TUint lastId = 0;
-		TUint count = Ascii::Uint(tocReader.ReadUntil('\n'));
-		for(TUint i = 0; i < count; ++i)
+		started = true;
+		
+		Brn trackTag("Track");
+		Brn metadataTag("Metadata");
+		Brn checkTag("Check");
+		Brn playlistEnd("/Playlist");
+		
+		// a file saved with checksums has one for the header and for every track
+		Brn tag = xml.NextTag();
+		TBool checked = (tag == checkTag);
+		if(checked)
 		{
-			const Brn name = tocReader.ReadUntil('\n');
-			ReaderBuffer nameReader;
-			nameReader.Set(name);
-			TUint id = Ascii::Uint(nameReader.ReadUntil('.'));
+			xml.NextTag();									// </Check>
+			tag = xml.NextTag();
+		}
+		
+		while(tag == trackTag)
+		{
+			if(xml.NextTag() != metadataTag)
+			{
+				break;
+			}
 			
-			if(id > lastId)
+			Track* track = new Track(iIdGenerator.NewId());
+			TBool oversize = false;
+			
+			try
 			{
-				lastId = id;
+				xml.ReadText(track->Metadata());			// unescaped straight into the track
+				track->UpdateChecksum();
+			}
+			catch(XmlTokenizerError)
+			{
+				// too big to be a track we wrote
+				oversize = true;
 			}
 			
-			Bws<Ascii::kMaxUintStringBytes + 1> filename(name);
-			ReaderFile file(filename.PtrZ());
-			Srs<Track::kMaxMetadataBytes> playlistReader(file);
+			xml.NextTag();									// </Metadata>
+			tag = xml.NextTag();
+			
+			TBool good = !checked;
+			if(tag == checkTag)
+			{
+				Bws<Ascii::kMaxUintStringBytes> check;
+				try
+				{
+					xml.ReadText(check);
+					good = (Ascii::UintHex(check) == track->Checksum());
+				}
+				catch(XmlTokenizerError)
+				{
+					good = false;
+				}
+				catch(AsciiError)
+				{
+					good = false;
+				}
+				xml.NextTag();								// </Check>
+				tag = xml.NextTag();
+			}
 			
-			playlistReader.ReadUntil('<');
-			Brn playlistTag = playlistReader.ReadUntil('>');
-			if(playlistTag == Brn("Playlist"))
+			if(!good || oversize || tag != Brn("/Track"))
 			{
-				Playlist* playlist = new Playlist(&iCache, id, filename, playlistReader);
-				iPlaylists.push_back(playlist);
+				delete track;
+				
+				if(oversize && good)
+				{
+					// an unchecked file may hold tracks from elsewhere, leave this one out and carry on
+					tag = xml.NextTag();
+					continue;
+				}
+				
+				// nothing after a damaged track can be trusted, keep what came before it
+				++dropped;
+				for(tag = xml.NextTag(); tag != playlistEnd; tag = xml.NextTag())
+				{
+					if(tag == trackTag)
+					{
+						++dropped;
+					}
+				}
+				break;
 			}
 			
-			file.Close();
+			iTracks.push_back(track);
+			tag = xml.NextTag();
 		}
 		
-		toc.Close();
-		
-		iIdGenerator = IdGenerator(lastId);
+		complete = (tag == playlistEnd);
 	}
 	catch(ReaderFileError)
 	{
 	}
-}
-
-PlaylistManager::~PlaylistManager()
-{
-	for(list<Playlist*>::iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	catch(XmlTokenizerError)
 	{
-		delete *i;
 	}
-}
-
-void PlaylistManager::SetListener(IPlaylistManagerListener& aListener)
-{
-	iListener = &aListener;
 	
-	MetadataChanged();
-	PlaylistsChanged();
-	PlaylistChanged();
+	delete file;
+	
+	if(dropped > 0)
+	{
+		Log::Print("Playlist %u: checksum mismatch, dropped %u tracks after the first %u\n", iId, dropped, (TUint)iTracks.size());
+	}
+	else if(started && !complete)
+	{
+		Log::Print("Playlist %u: file ends early, kept the first %u tracks\n", iId, (TUint)iTracks.size());
+	}
 }
 
-void PlaylistManager::SetName(const Brx& aValue)
+PlaylistData::PlaylistData(const TUint aId)
+	: iId(aId)
 {
-	iName.Replace(aValue);
-	MetadataChanged();
 }
 
-void PlaylistManager::SetAdapter(const TIpAddress& aAdapter)
+PlaylistData::~PlaylistData()
 {
-	iAdapter = aAdapter;
-	MetadataChanged();
+	for(list<Track*>::iterator i = iTracks.begin(); i != iTracks.end(); ++i)
+	{
+		delete *i;
+	}
 }
 
-const Brx& PlaylistManager::Name() const
+TUint PlaylistData::Id() const
 {
-	return iName;
+	return iId;
 }
 
-const TIpAddress& PlaylistManager::Adapter() const
+bool PlaylistData::IsId(const TUint aId) const
 {
-	return iAdapter;
+	return aId == iId;
 }
 
-const TUint PlaylistManager::Token() const
+TUint PlaylistData::TrackCount() const
 {
-	return iToken;
+	return iTracks.size();
 }
-
-const TBool PlaylistManager::TokenChanged(const TUint aToken) const
+ 
+void PlaylistData::IdArray(Bwx& aIdArray)
 {
-	TBool changed = false;
+	aIdArray.SetBytes(0);
+    WriterBuffer writer(aIdArray);
+    WriterBinary binary(writer);
 	
-	iMutex.Wait();
-	if(aToken != iToken)
+    for(list<Track*>::const_iterator i = iTracks.begin(); i != iTracks.end(); ++i)
 	{
-		changed = true;
-	}
-	iMutex.Signal();
-	
-	return changed;
+        binary.WriteUint32Be((*i)->Id());
+    }
 }
 
-void PlaylistManager::ImagesXml(IWriter& aWriter) const
+void PlaylistData::Read(const TUint aTrackId, Bwx& aMetadata)
 {
-	/*Brn entryStart("<Entry>");
-	Brn entryEnd("</Entry>");
-	Brn idStart("<Id>");
-	Brn idEnd("</Id>");
-	Brn uriStart("<Uri>");
-	Brn uriEnd("</Uri>");*/
+	list<Track*>::const_iterator i = find_if(iTracks.begin(), iTracks.end(), bind2nd(mem_fun(&Track::IsId), aTrackId));
+	if(i == iTracks.end())
+	{
+		THROW(PlaylistError);
+	}
 	
-	aWriter.Write(Brn("<ImageList>"));
-	aWriter.Write(Brn("</ImageList>"));
+	aMetadata.Append((*i)->Metadata());
 }
 
-void PlaylistManager::Metadata(Bwx& aMetadata) const
+const TUint PlaylistData::Insert(const TUint aAfterId, const Brx& aMetadata)
 {
-	WriterBuffer buffer(aMetadata);
-	
-	iMutex.Wait();
-	
-	buffer.Write(Brn("<DIDL-Lite xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\"><item id=\""));
-	Converter::ToXmlEscaped(buffer, iName);
-	buffer.Write(Brn("\" parentID=\"\" restricted=\"True\"><dc:title>"));
-	Converter::ToXmlEscaped(buffer, iName);
-	buffer.Write(Brn("</dc:title><upnp:albumArtURI>http://"));
+    if(iTracks.size() == kMaxTracks)
+	{
+        THROW(PlaylistFull);
+    }
 	
-	Endpoint endPoint;
-	endPoint.SetAddress(iAdapter);
-	endPoint.AppendAddress(aMetadata);
+    list<Track*>::iterator i;
+    if(aAfterId == 0)
+	{
+        i = iTracks.begin();
+    }
+    else
+	{
+        i = find_if(iTracks.begin(), iTracks.end(), bind2nd(mem_fun(&Track::IsId), aAfterId));
+        if(i == iTracks.end())
+		{
+            THROW(PlaylistError);
+        }
+        ++i;  //we insert after the id, not before
+    }
 	
-	iMutex.Signal();
+	TUint id = iIdGenerator.NewId();
+	Bws<Track::kMaxMetadataBytes> metadata;
 	
-	buffer.Write(Brn("/images/Icon.png</upnp:albumArtURI><upnp:class>object.container</upnp:class></item></DIDL-Lite>"));
-}
+	Metadata::Condense(aMetadata, metadata);
+    iTracks.insert(i, new Track(id, metadata));
+	iPositions.clear();
 
-void PlaylistManager::MetadataChanged()
-{
-	iListener->MetadataChanged();
+	return id;
 }
 
-void PlaylistManager::PlaylistsChanged()
+void PlaylistData::Delete(const TUint aId)
 {
-	++iToken;
-	iListener->PlaylistsChanged();
+	list<Track*>::iterator i = find_if(iTracks.begin(), iTracks.end(), bind2nd(mem_fun(&Track::IsId), aId));
+	if(i != iTracks.end())
+	{
+		delete (*i);
+		iTracks.erase(i);
+		iPositions.clear();
+	}
 }
 
-void PlaylistManager::PlaylistChanged()
+void PlaylistData::DeleteAll()
 {
-	++iToken;
-	iListener->PlaylistChanged();
+	for(list<Track*>::iterator i = iTracks.begin(); i != iTracks.end(); ) {
+		delete (*i);
+		i = iTracks.erase(i);
+	}
+	iPositions.clear();
 }
 
-void PlaylistManager::IdArray(Bwx& aIdArray) const
+TBool PlaylistData::Append(const Brx& aMetadata)
 {
-	iMutex.Wait();
-	
-	WriterBuffer writer(aIdArray);
-	WriterBinary binary(writer);
-	
-	for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	if(iTracks.size() == kMaxTracks)
 	{
-		binary.WriteUint32Be((*i)->Id());
+		return false;
 	}
 	
-	iMutex.Signal();
+	Track* track = new Track(iIdGenerator.NewId());
+	Metadata::Condense(aMetadata, track->Metadata());
+	track->UpdateChecksum();
+	iTracks.push_back(track);
+	iPositions.clear();
+	
+	return true;
 }
 
-void PlaylistManager::TokenArray(Bwx& aTokenArray) const
+void PlaylistData::InsertList(const TUint aAfterId, const std::vector<Brn>& aMetadata, std::vector<TUint>& aNewIds)
 {
-	iMutex.Wait();
-	
-	WriterBuffer writer(aTokenArray);
-	WriterBinary binary(writer);
+	if(iTracks.size() + aMetadata.size() > kMaxTracks)
+	{
+		THROW(PlaylistFull);
+	}
 	
-	for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	list<Track*>::iterator i = iTracks.begin();
+	if(aAfterId != 0)
 	{
-		binary.WriteUint32Be((*i)->Token());
+		i = find_if(iTracks.begin(), iTracks.end(), bind2nd(mem_fun(&Track::IsId), aAfterId));
+		if(i == iTracks.end())
+		{
+			THROW(PlaylistError);
+		}
+		++i;
 	}
 	
-	iMutex.Signal();
+	// inserting before the same position keeps the tracks in order
+	Bws<Track::kMaxMetadataBytes> metadata;
+	for(vector<Brn>::const_iterator m = aMetadata.begin(); m != aMetadata.end(); ++m)
+	{
+		TUint id = iIdGenerator.NewId();
+		metadata.SetBytes(0);
+		Metadata::Condense(*m, metadata);
+		iTracks.insert(i, new Track(id, metadata));
+		aNewIds.push_back(id);
+	}
+	iPositions.clear();
 }
 
-void PlaylistManager::PlaylistRead(const TUint aId, Bwx& aName, Bwx& aDescription, TUint& aImageId) const
+TUint PlaylistData::DeleteList(const Brx& aIdArray, std::vector<TUint>& aMissing)
 {
-	iMutex.Wait();
+	vector<TUint> ids;
+	for(TUint offset = 0; offset + 4 <= aIdArray.Bytes(); offset += 4)
+	{
+		ids.push_back(BigEndianConverter::BigEndianToUint32(aIdArray, offset));
+	}
+	sort(ids.begin(), ids.end());
+	ids.erase(unique(ids.begin(), ids.end()), ids.end());
 	
-	list<Playlist*>::const_iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
+	vector<bool> found(ids.size(), false);
+	TUint removed = 0;
+	
+	for(list<Track*>::iterator i = iTracks.begin(); i != iTracks.end(); )
 	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
+		vector<TUint>::iterator id = lower_bound(ids.begin(), ids.end(), (*i)->Id());
+		if(id == ids.end() || *id != (*i)->Id())
+		{
+			++i;
+			continue;
+		}
+		
+		found[id - ids.begin()] = true;
+		delete (*i);
+		i = iTracks.erase(i);
+		++removed;
 	}
+	iPositions.clear();
 	
-	(*i)->Name(aName);
-	(*i)->Description(aDescription);
-	(*i)->ImageId(aImageId);
+	for(TUint i = 0; i < ids.size(); ++i)
+	{
+		if(!found[i])
+		{
+			aMissing.push_back(ids[i]);
+		}
+	}
 	
-	iMutex.Signal();
+	return removed;
 }
 
-void PlaylistManager::PlaylistReadList(std::vector<TUint>& aIdList, IWriter& aWriter) const
+void PlaylistData::MoveList(const std::vector<TUint>& aTrackIds, const TUint aAfterId)
 {
-	Brn entryStart("<Entry>");
-	Brn entryEnd("</Entry>");
-	Brn idStart("<Id>");
-	Brn idEnd("</Id>");
-	Brn nameStart("<Name>");
-	Brn nameEnd("</Name>");
-	Brn descriptionStart("<Description>");
-	Brn descriptionEnd("</Description>");
-	Brn imageIdStart("<ImageId>");
-	Brn imageIdEnd("</ImageId>");
+	// every id is looked up once against a sorted copy of the playlist
+	vector< pair<TUint, list<Track*>::iterator> > tracks;
+	tracks.reserve(iTracks.size());
+	for(list<Track*>::iterator i = iTracks.begin(); i != iTracks.end(); ++i)
+	{
+		tracks.push_back(make_pair((*i)->Id(), i));
+	}
+	sort(tracks.begin(), tracks.end(), TrackBefore);
 	
-	aWriter.Write(Brn("<PlaylistList>"));
+	vector<list<Track*>::iterator> moves;
+	vector<TUint> moved(aTrackIds);
+	sort(moved.begin(), moved.end());
 	
-	iMutex.Wait();
+	if(adjacent_find(moved.begin(), moved.end()) != moved.end() || binary_search(moved.begin(), moved.end(), aAfterId))
+	{
+		THROW(PlaylistError);
+	}
 	
-	for(vector<TUint>::const_iterator id = aIdList.begin(); id != aIdList.end(); ++id)
+	list<Track*>::iterator after = iTracks.end();
+	if(aAfterId != 0)
 	{
-		list<Playlist*>::const_iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), (*id)));
-		if(i != iPlaylists.end())
+		after = Find(tracks, aAfterId);
+	}
+	
+	for(vector<TUint>::const_iterator id = aTrackIds.begin(); id != aTrackIds.end(); ++id)
+	{
+		moves.push_back(Find(tracks, *id));
+	}
+	
+	// lifted out first, so the position they go back in can't be one of them
+	list<Track*> lifted;
+	for(vector<list<Track*>::iterator>::const_iterator i = moves.begin(); i != moves.end(); ++i)
+	{
+		lifted.splice(lifted.end(), iTracks, *i);
+	}
+	
+	if(aAfterId == 0)
+	{
+		iTracks.splice(iTracks.begin(), lifted);
+	}
+	else
+	{
+		iTracks.splice(++after, lifted);
+	}
+	iPositions.clear();
+}
+
+list<Track*>::iterator PlaylistData::Find(const vector< pair<TUint, list<Track*>::iterator> >& aTracks, const TUint aId)
+{
+	vector< pair<TUint, list<Track*>::iterator> >::const_iterator i = lower_bound(aTracks.begin(), aTracks.end(), make_pair(aId, iTracks.end()), TrackBefore);
+	if(i == aTracks.end() || i->first != aId)
+	{
+		THROW(PlaylistError);
+	}
+	
+	return i->second;
+}
+
+TBool PlaylistData::TrackBefore(const pair<TUint, list<Track*>::iterator>& aA, const pair<TUint, list<Track*>::iterator>& aB)
+{
+	return aA.first < aB.first;
+}
+
+TUint PlaylistData::ReadRange(const TUint aStart, const TUint aCount, Bwx& aBatch) const
+{
+	// rebuilt after a change, so repeated windows over a playlist left alone cost only their own tracks
+	if(iPositions.empty() && !iTracks.empty())
+	{
+		iPositions.assign(iTracks.begin(), iTracks.end());
+	}
+	
+	WriterBuffer writer(aBatch);
+	WriterBinary binary(writer);
+	
+	TUint count = 0;
+	for(TUint i = aStart; i < iPositions.size() && count < aCount; ++i, ++count)
+	{
+		const Brx& metadata = iPositions[i]->Metadata();
+		if(aBatch.Bytes() + 8 + metadata.Bytes() > aBatch.MaxBytes())
 		{
-			aWriter.Write(entryStart);
-			
-			aWriter.Write(idStart); Ascii::StreamWriteUint(aWriter, (*i)->Id()); aWriter.Write(idEnd);
+			break;
+		}
+		
+		binary.WriteUint32Be(iPositions[i]->Id());
+		binary.WriteUint32Be(metadata.Bytes());
+		writer.Write(metadata);
+	}
+	
+	return count;
+}
+
+TUint PlaylistData::ReadBatch(const Brx& aIdArray, Bwx& aBatch) const
+{
+	WriterBuffer writer(aBatch);
+	WriterBinary binary(writer);
+	
+	list<Track*>::const_iterator next = iTracks.begin();
+	TUint count = 0;
+	
+	for(TUint offset = 0; offset + 4 <= aIdArray.Bytes(); offset += 4)
+	{
+		TUint id = BigEndianConverter::BigEndianToUint32(aIdArray, offset);
+		
+		list<Track*>::const_iterator i = Find(id, next);
+		if(i != iTracks.end())
+		{
+			const Brx& metadata = (*i)->Metadata();
+			if(aBatch.Bytes() + 8 + metadata.Bytes() > aBatch.MaxBytes())
+			{
+				break;
+			}
 			
-			Bws<PlaylistHeader::kMaxNameBytes> name;
-			(*i)->Name(name);
-			aWriter.Write(nameStart); aWriter.Write(name); aWriter.Write(nameEnd);
+			binary.WriteUint32Be(id);
+			binary.WriteUint32Be(metadata.Bytes());
+			writer.Write(metadata);
 			
-			Bws<PlaylistHeader::kMaxDescriptionBytes> description;
-			(*i)->Description(description);
-			aWriter.Write(descriptionStart); aWriter.Write(description); aWriter.Write(descriptionEnd);
+			next = i;
+			++next;
+		}
+		
+		++count;
+	}
+	
+	return count;
+}
+
+TUint PlaylistData::ReadEntries(const Brx& aIdArray, Bwx& aEntries) const
+{
+	Brn entryStart("<Entry><Id>");
+	Brn metadataStart("</Id><Metadata>");
+	Brn entryEnd("</Metadata></Entry>");
+	const TUint fixedBytes = entryStart.Bytes() + Ascii::kMaxUintStringBytes + metadataStart.Bytes() + entryEnd.Bytes();
+	
+	list<Track*>::const_iterator next = iTracks.begin();
+	TUint count = 0;
+	
+	for(TUint offset = 0; offset + 4 <= aIdArray.Bytes(); offset += 4)
+	{
+		TUint id = BigEndianConverter::BigEndianToUint32(aIdArray, offset);
+		
+		list<Track*>::const_iterator i = Find(id, next);
+		if(i != iTracks.end())
+		{
+			const Brx& metadata = (*i)->Metadata();
+			if(aEntries.Bytes() + fixedBytes + metadata.Bytes() > aEntries.MaxBytes())
+			{
+				break;
+			}
 			
-			TUint imageId;
-			(*i)->ImageId(imageId);
-			aWriter.Write(imageIdStart); Ascii::StreamWriteUint(aWriter, imageId); aWriter.Write(imageIdEnd);
+			aEntries.Append(entryStart);
+			Ascii::AppendDec(aEntries, id);
+			aEntries.Append(metadataStart);
+			aEntries.Append(metadata);
+			aEntries.Append(entryEnd);
 			
-			aWriter.Write(entryEnd);
+			next = i;
+			++next;
+		}
+		
+		++count;
+	}
+	
+	return count;
+}
+
+// ids usually arrive in playlist order, so look on from the last track found
+list<Track*>::const_iterator PlaylistData::Find(const TUint aId, list<Track*>::const_iterator aNext) const
+{
+	list<Track*>::const_iterator i = find_if(aNext, iTracks.end(), bind2nd(mem_fun(&Track::IsId), aId));
+	if(i == iTracks.end())
+	{
+		i = find_if(iTracks.begin(), aNext, bind2nd(mem_fun(&Track::IsId), aId));
+		if(i == aNext)
+		{
+			i = iTracks.end();
 		}
 	}
 	
+	return i;
+}
+
+void PlaylistData::ToXml(WriterVector& aWriter) const
+{
+	Brn trackStart("  <Track>\n");
+	Brn metadataStart("    <Metadata>");
+	Brn trackEnd("  </Track>\n");
+	Brn metadataEnd("</Metadata>\n");
+	Brn checkStart("    <Check>");
+	Brn checkEnd("</Check>\n");
+	
+	for(list<Track*>::const_iterator i = iTracks.begin(); i != iTracks.end(); ++i)
+	{
+		aWriter.WriteReference(trackStart);
+		
+		aWriter.WriteReference(metadataStart); XmlEscaper::Write(aWriter, (*i)->Metadata()); aWriter.WriteReference(metadataEnd);
+		
+		Bws<8> check;
+		Ascii::AppendHex(check, (*i)->Checksum());
+		aWriter.WriteReference(checkStart); aWriter.Write(check); aWriter.WriteReference(checkEnd);
+		
+		aWriter.WriteReference(trackEnd);
+	}
+	
+	// the metadata is only referenced, so it has to be written while the caller holds the data
+	aWriter.WriteFlush();
+}
+
+
+Playlist::Playlist(Cache* aCache, const TUint aId, const Brx& aFilename, const Brx& aName, const Brx& aDescription, const TUint aImageId)
+	: iMutex("PList")
+	, iId(aId)
+	, iToken(0)
+	, iTrackCount(0)
+	, iBytes(0)
+    , iCache(aCache)
+	, iHeader(aFilename, aName, aDescription, aImageId)
+	, iData(0)
+{
+}
+
+Playlist::Playlist(Cache* aCache, const TUint aId, const Brx& aFilename, const Brx& aName, const Brx& aDescription, const TUint aImageId, const TUint aToken, const TUint aTrackCount, const TUint aBytes)
+	: iMutex("PList")
+	, iId(aId)
+	, iToken(aToken)
+	, iTrackCount(aTrackCount)
+	, iBytes(aBytes)
+    , iCache(aCache)
+	, iHeader(aFilename, aName, aDescription, aImageId)
+	, iData(0)
+{
+}
+
+Playlist::Playlist(Cache* aCache, const TUint aId, const Brx& aFilename, IReader& aReader)
+	: iMutex("PList")
+	, iId(aId)
+	, iToken(0)
+	, iTrackCount(0)
+	, iBytes(0)
+    , iCache(aCache)
+	, iHeader(aFilename, aReader)
+	, iData(0)
+{
+}
+
+const TUint Playlist::Id() const
+{
+	return iId;
+}
+
+bool Playlist::IsId(const TUint aId) const
+{
+	return aId == iId;
+}
+
+const TUint Playlist::Token() const
+{
+	return iToken;
+}
+
+const TUint Playlist::TrackCount() const
+{
+	return iTrackCount;
+}
+
+const TUint Playlist::Bytes() const
+{
+	return iBytes;
+}
+
+void Playlist::SetBytes(const TUint aBytes)
+{
+	iMutex.Wait();
+	
+	iBytes = aBytes;
+	
+	iMutex.Signal();
+}
+
+const Brx& Playlist::Filename() const
+{
+	return iHeader.Filename();
+}
+
+void Playlist::Name(Bwx& aName) const
+{
+	iHeader.Name(aName);
+}
+
+void Playlist::Description(Bwx& aDescription) const
+{
+	iMutex.Wait();
+	
+	iHeader.Description(aDescription);
+	
+	iMutex.Signal();
+}
+
+void Playlist::ImageId(TUint& aImageId) const
+{
+	iMutex.Wait();
+	
+	iHeader.ImageId(aImageId);
+	
+	iMutex.Signal();
+}
+
+void Playlist::SetName(const Brx& aName)
+{
+	iMutex.Wait();
+	
+	iHeader.SetName(aName);
+	++iToken;
+	
+	iMutex.Signal();
+}
+
+void Playlist::SetDescription(const Brx& aDescription)
+{
+	iMutex.Wait();
+	
+	iHeader.SetDescription(aDescription);
+	++iToken;
+	
+	iMutex.Signal();
+}
+
+void Playlist::SetImageId(const TUint& aImageId)
+{
+	iMutex.Wait();
+	
+	iHeader.SetImageId(aImageId);
+	++iToken;
+	
+	iMutex.Signal();
+}
+
+void Playlist::IdArray(Bwx& aIdArray)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	iData->IdArray(aIdArray);
+	iTrackCount = iData->TrackCount();
+	
 	iMutex.Signal();
+}
+
+void Playlist::Read(const TUint aTrackId, Bwx& aMetadata)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	try
+	{
+		iData->Read(aTrackId, aMetadata);
+	}
+	catch(PlaylistError& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	
+	iMutex.Signal();
+}
+
+const TUint Playlist::Insert(const TUint aAfterId, const Brx& aMetadata)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	try
+	{
+		TUint newId = iData->Insert(aAfterId, aMetadata);
+		++iTrackCount;
+		++iToken;
+		
+		iMutex.Signal();
+		
+		return newId;
+	}
+	catch(PlaylistFull& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	catch(PlaylistError& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+}
+
+void Playlist::Delete(const TUint aId)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	iData->Delete(aId);
+	iTrackCount = iData->TrackCount();
+	++iToken;
+	
+	iMutex.Signal();
+}
+
+void Playlist::DeleteAll()
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	iData->DeleteAll();
+	iTrackCount = 0;
+	++iToken;
+	
+	iMutex.Signal();
+}
+
+void Playlist::InsertList(const TUint aAfterId, const std::vector<Brn>& aMetadata, std::vector<TUint>& aNewIds)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	try
+	{
+		iData->InsertList(aAfterId, aMetadata, aNewIds);
+		iTrackCount = iData->TrackCount();
+		++iToken;
+	}
+	catch(PlaylistFull& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	catch(PlaylistError& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	
+	iMutex.Signal();
+}
+
+TUint Playlist::DeleteList(const Brx& aIdArray, std::vector<TUint>& aMissing)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	TUint removed = iData->DeleteList(aIdArray, aMissing);
+	if(removed > 0)
+	{
+		iTrackCount = iData->TrackCount();
+		++iToken;
+	}
+	
+	iMutex.Signal();
+	
+	return removed;
+}
+
+void Playlist::MoveList(const std::vector<TUint>& aTrackIds, const TUint aAfterId)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	try
+	{
+		iData->MoveList(aTrackIds, aAfterId);
+		++iToken;
+	}
+	catch(PlaylistError& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	
+	iMutex.Signal();
+}
+
+TUint Playlist::ReadRange(const TUint aStart, const TUint aCount, Bwx& aBatch)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	TUint count = iData->ReadRange(aStart, aCount, aBatch);
+	
+	iMutex.Signal();
+	
+	return count;
+}
+
+TUint Playlist::ReadBatch(const Brx& aIdArray, Bwx& aBatch)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	TUint count = iData->ReadBatch(aIdArray, aBatch);
+	
+	iMutex.Signal();
+	
+	return count;
+}
+
+TUint Playlist::ReadEntries(const Brx& aIdArray, Bwx& aEntries)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	TUint count = iData->ReadEntries(aIdArray, aEntries);
+	
+	iMutex.Signal();
+	
+	return count;
+}
+
+void Playlist::ToXml(WriterVector& aWriter)
+{
+	iMutex.Wait();
+	
+	if(iData == NULL)
+	{
+		iData = &iCache->Data(*this, this);
+	}
+	
+	aWriter.Write(Brn("<Playlist>\n"));
+	
+	iHeader.ToXml(aWriter);
+	iData->ToXml(aWriter);
+	
+	aWriter.Write(Brn("</Playlist>\n"));
+	
+	iMutex.Signal();
+}
+
+void Playlist::HeaderToXml(IWriter& aWriter) const
+{
+	iMutex.Wait();
+	
+	aWriter.Write(Brn("<Playlist>\n"));
+	iHeader.ToXml(aWriter);
+	aWriter.Write(Brn("</Playlist>\n"));
+	
+	iMutex.Signal();
+}
+
+void Playlist::ToIndex(IWriter& aWriter) const
+{
+	Bws<PlaylistHeader::kMaxNameBytes> name;
+	Bws<PlaylistHeader::kMaxDescriptionBytes> description;
+	TUint imageId;
+	
+	iMutex.Wait();
+	
+	iHeader.Name(name);
+	iHeader.Description(description);
+	iHeader.ImageId(imageId);
+	
+	Bws<kMaxIndexBytes> entry;
+	WriterBuffer buffer(entry);
+	WriterBinary binary(buffer);
+	binary.WriteUint32Be(iId);
+	binary.WriteUint32Be(iToken);
+	binary.WriteUint32Be(imageId);
+	binary.WriteUint32Be(iTrackCount);
+	binary.WriteUint32Be(iBytes);
+	binary.WriteUint8(name.Bytes());
+	binary.Write(name);
+	binary.WriteUint8(description.Bytes());
+	binary.Write(description);
+	
+	iMutex.Signal();
+	
+	WriterBinary writer(aWriter);
+	writer.Write(entry);
+	writer.WriteUint32Be(Crc32c::Compute(entry));
+}
+
+void Playlist::Load(IReader& aReader)
+{
+	PlaylistHeader header(iHeader.Filename(), aReader);
+	
+	Bws<PlaylistHeader::kMaxNameBytes> name;
+	Bws<PlaylistHeader::kMaxDescriptionBytes> description;
+	TUint imageId;
+	
+	header.Name(name);
+	header.Description(description);
+	header.ImageId(imageId);
+	
+	iMutex.Wait();
+	
+	iHeader.SetName(name);
+	iHeader.SetDescription(description);
+	iHeader.SetImageId(imageId);
+	
+	iMutex.Signal();
+}
+
+void Playlist::Prefetch()
+{
+	TUint trackCount = iCache->Prefetch(iId, iHeader.Filename());
+	
+	iMutex.Wait();
+	
+	iTrackCount = trackCount;
+	
+	iMutex.Signal();
+}
+
+void Playlist::RemovedFromCache()
+{
+	iMutex.Wait();
+
+	iData = NULL;
+	
+	iMutex.Signal();
+}
+
+
+
+PlaylistImport::PlaylistImport(PlaylistData& aData)
+	: iData(aData)
+	, iSkipped(0)
+{
+}
+
+const Brx& PlaylistImport::Title() const
+{
+	return iTitle;
+}
+
+TUint PlaylistImport::Skipped() const
+{
+	return iSkipped;
+}
+
+void PlaylistImport::ImportTitle(const Brx& aTitle)
+{
+	TUint bytes = aTitle.Bytes();
+	if(bytes > iTitle.MaxBytes())
+	{
+		bytes = iTitle.MaxBytes();
+	}
+	iTitle.Replace(Brn(aTitle.Ptr(), bytes));
+}
+
+void PlaylistImport::ImportTrack(const Brx& aMetadata)
+{
+	if(!iData.Append(aMetadata))
+	{
+		++iSkipped;
+	}
+}
+
+
+
+TrackListImport::TrackListImport(TUint aBytes)
+	: iData(aBytes)
+{
+}
+
+void TrackListImport::Tracks(std::vector<Brn>& aTracks) const
+{
+	const Brx& data = iData.Data();
+	
+	for(TUint i = 0; i < iOffsets.size(); ++i)
+	{
+		TUint end = (i + 1 < iOffsets.size()) ? iOffsets[i + 1] : data.Bytes();
+		aTracks.push_back(Brn(data.Ptr() + iOffsets[i], end - iOffsets[i]));
+	}
+}
+
+void TrackListImport::ImportTitle(const Brx& /*aTitle*/)
+{
+}
+
+void TrackListImport::ImportTrack(const Brx& aMetadata)
+{
+	iOffsets.push_back(iData.Data().Bytes());
+	iData.Write(aMetadata);
+}
+
+
+
+PlaylistLoader::Job::Job(Playlist& aPlaylist)
+	: iId(aPlaylist.Id())
+	, iPlaylist(aPlaylist)
+	, iLoaded("PLdJ", 0)
+{
+}
+
+PlaylistLoader::PlaylistLoader(IFileStore& aStore, IPlaylistLoaderObserver& aObserver, const TUint aThreads)
+	: iStore(aStore)
+	, iObserver(aObserver)
+	, iThreads(aThreads < kMaxThreads ? aThreads : kMaxThreads)
+	, iMutex("PLdr")
+	, iFinished("PLdr", 0)
+	, iNext(0)
+	, iRunning(0)
+	, iQuit(false)
+{
+	if(iThreads == 0)
+	{
+		iThreads = 1;
+	}
+}
+
+PlaylistLoader::~PlaylistLoader()
+{
+	iMutex.Wait();
+	iQuit = true;
+	iMutex.Signal();
+	
+	for(vector<ThreadFunctor*>::iterator i = iWorkers.begin(); i != iWorkers.end(); ++i)
+	{
+		delete *i;
+	}
+	
+	for(vector<Job*>::iterator i = iJobs.begin(); i != iJobs.end(); ++i)
+	{
+		delete *i;
+	}
+}
+
+void PlaylistLoader::Add(Playlist& aPlaylist)
+{
+	iJobs.push_back(new Job(aPlaylist));
+}
+
+void PlaylistLoader::Start()
+{
+	if(iJobs.size() == 0)
+	{
+		Finished();
+		return;
+	}
+	
+	iRunning = iJobs.size() < iThreads ? iJobs.size() : iThreads;
+	
+	for(TUint i = 0; i < iRunning; ++i)
+	{
+		ThreadFunctor* worker = new ThreadFunctor("PLdr", MakeFunctor(*this, &PlaylistLoader::Run));
+		iWorkers.push_back(worker);
+	}
+	
+	for(vector<ThreadFunctor*>::iterator i = iWorkers.begin(); i != iWorkers.end(); ++i)
+	{
+		(*i)->Start();
+	}
+}
+
+void PlaylistLoader::Wait(const TUint aId)
+{
+	for(vector<Job*>::iterator i = iJobs.begin(); i != iJobs.end(); ++i)
+	{
+		if((*i)->iId == aId)
+		{
+			(*i)->iLoaded.Wait();
+			(*i)->iLoaded.Signal();
+			return;
+		}
+	}
+}
+
+void PlaylistLoader::Wait()
+{
+	iFinished.Wait();
+	iFinished.Signal();
+}
+
+void PlaylistLoader::Run()
+{
+	for(;;)
+	{
+		iMutex.Wait();
+		
+		if(iQuit || iNext == iJobs.size())
+		{
+			TBool last = (--iRunning == 0 && !iQuit);
+			iMutex.Signal();
+			
+			if(last)
+			{
+				Finished();
+			}
+			break;
+		}
+		
+		Job* job = iJobs[iNext++];
+		
+		iMutex.Signal();
+		
+		Load(*job);
+	}
+}
+
+void PlaylistLoader::Load(Job& aJob)
+{
+	Bws<Ascii::kMaxUintStringBytes + 5> headerFilename;
+	HeaderFilename(aJob.iId, headerFilename);
+	
+	// a separately saved header is newer than the one in the track file
+	TBool loaded = LoadHeader(aJob.iPlaylist, headerFilename) || LoadHeader(aJob.iPlaylist, aJob.iPlaylist.Filename());
+	
+	if(loaded)
+	{
+		// the tracks are needed for the index, so leave them in the cache
+		try
+		{
+			aJob.iPlaylist.Prefetch();
+		}
+		catch(ReaderFileError)
+		{
+			loaded = false;
+		}
+	}
+	
+	if(!loaded)
+	{
+		iObserver.PlaylistLoadFailed(aJob.iPlaylist);
+	}
+	
+	aJob.iLoaded.Signal();
+}
+
+TBool PlaylistLoader::LoadHeader(Playlist& aPlaylist, const Brx& aFilename)
+{
+	IReaderSource* file = NULL;
+	TBool loaded = false;
+	
+	try
+	{
+		file = iStore.OpenReader(aFilename);
+		Srs<Track::kMaxMetadataBytes> playlistReader(*file);
+		
+		playlistReader.ReadUntil('<');
+		Brn playlistTag = playlistReader.ReadUntil('>');
+		if(playlistTag == Brn("Playlist"))
+		{
+			aPlaylist.Load(playlistReader);
+			loaded = true;
+		}
+	}
+	catch(ReaderFileError)
+	{
+	}
+	catch(AsciiError)
+	{
+	}
+	catch(ChecksumError)
+	{
+		Log::Print("%.*s: header checksum mismatch\n", PBUF(aFilename));
+	}
+	
+	delete file;
+	
+	return loaded;
+}
+
+void PlaylistLoader::Finished()
+{
+	iObserver.PlaylistsLoaded();
+	iFinished.Signal();
+}
+
+
+
+
+
+PlaylistManager::Change::Change(const TUint aToken, const EChange aKind, const TUint aId, const TUint aValue)
+	: iToken(aToken)
+	, iKind(aKind)
+	, iId(aId)
+	, iValue(aValue)
+{
+}
+
+PlaylistManager::PlaylistManager(DvDevice& aDevice, IFileStore& aStore, const TIpAddress& aAdapter, const Brx& aName, const Brx& aImage, const Brx& aMimeType, const TUint aLoaderThreads, const TBool aProgressive)
+	: iMutex("PMngr")
+    , iDevice(aDevice)
+	, iStore(aStore)
+	, iListener(0)
+	, iCache(aStore)
+    , iName(aName)
+    , iAdapter(aAdapter)
+	, iImage(aImage)
+	, iMimeType(aMimeType)
+	, iToken(0)
+	, iChangesFrom(0)
+	, iIndexToken(0)
+	, iLoader(0)
+	, iLoading(true)
+	, iIndexStale(false)
+	, iTocStale(false)
+	, iTocComplete(false)
+	, iLoadFailed(false)
+	, iStartTime(Os::TimeInMs())
+	, iPrewarmThread(0)
+	, iPrewarmCount(0)
+	, iPrewarmQuit(false)
+	, iCollectorThread(0)
+	, iCollect("PGbc", 1)
+	, iCollectorQuit(false)
+	, iReclaimedBytes(0)
+	, iSnapshotMutex("PSnp")
+	, iSnapshotting(false)
+{
+	// the header index lets us build the directory without opening any playlist file
+	Bwh index;
+	TUint indexOffset = 0;
+	TUint indexToken = 0;
+	TUint indexCount = ReadIndex(index, indexOffset, indexToken);
+	
+	// tokens from an earlier run must not be taken for changes made in this
+	// one; the first change rewrites the index, moving the next run on again
+	iToken = indexToken + kTokenReserve;
+	iChangesFrom = iToken;
+	iIndexToken = indexToken;
+	
+	// playlists the index can't describe are listed straight away and filled in from their files in parallel
+	iLoader = new PlaylistLoader(iStore, *this, aLoaderThreads);
+	
+	IReaderSource* toc = NULL;
+	TUint lastId = 0;
+	TUint count = 0;
+	
+	try 
+	{
+		toc = iStore.OpenReader(kTocFilename);
+		Srs<32> tocReader(*toc);
+		
+		count = Ascii::Uint(TocLine(tocReader));
+		
+		if(indexCount != count)
+		{
+			indexCount = 0;
+			iIndexStale = true;
+		}
+		
+		for(TUint i = 0; i < count; ++i)
+		{
+			const Brn name = TocLine(tocReader);
+			ReaderBuffer nameReader;
+			nameReader.Set(name);
+			TUint id = Ascii::Uint(nameReader.ReadUntil('.'));
+			
+			if(id > lastId)
+			{
+				lastId = id;
+			}
+			
+			Bws<Ascii::kMaxUintStringBytes + 5> filename(name);
+			
+			Playlist* playlist = NULL;
+			if(indexCount > 0)
+			{
+				playlist = IndexedPlaylist(index, indexOffset, id, filename);
+			}
+			
+			if(playlist == NULL)
+			{
+				// once out of step with the toc the rest of the index can't be trusted
+				indexCount = 0;
+				iIndexStale = true;
+				playlist = new Playlist(&iCache, id, filename, Brx::Empty(), Brx::Empty(), 0);
+				iLoader->Add(*playlist);
+			}
+			
+			iPlaylists.push_back(playlist);
+		}
+	}
+	catch(ReaderFileError)
+	{
+	}
+	catch(ReaderError)
+	{
+	}
+	catch(AsciiError)
+	{
+	}
+	catch(ChecksumError)
+	{
+	}
+	
+	// without the whole toc, files it doesn't list may still be wanted
+	iTocComplete = (toc != NULL && iPlaylists.size() == count);
+	
+	if(toc == NULL)
+	{
+		// a new store, unless it already holds playlist files
+		vector<IFileStore::Record> records;
+		iStore.Records(records);
+		
+		iTocComplete = true;
+		for(vector<IFileStore::Record>::const_iterator i = records.begin(); i != records.end(); ++i)
+		{
+			TUint id;
+			if(PlaylistFile(i->iName, id))
+			{
+				iTocComplete = false;
+				break;
+			}
+		}
+	}
+	
+	delete toc;
+	
+	if(iPlaylists.size() < count)
+	{
+		// keep the playlists listed before the damage and write a toc that matches them
+		Log::Print("Toc damaged, dropped %u of %u playlists\n", count - (TUint)iPlaylists.size(), count);
+		iTocStale = true;
+	}
+	
+	iIdGenerator = IdGenerator(lastId);
+	
+	iLoader->Start();
+	
+	if(!aProgressive)
+	{
+		iLoader->Wait();
+		delete iLoader;
+		iLoader = NULL;
+	}
+	
+	iCollectorThread = new ThreadFunctor("PGbc", MakeFunctor(*this, &PlaylistManager::CollectorRun), Thread::kPriorityLow);
+	iCollectorThread->Start();
+}
+
+PlaylistManager::~PlaylistManager()
+{
+	iMutex.Wait();
+	iPrewarmQuit = true;
+	iCollectorQuit = true;
+	iMutex.Signal();
+	
+	iCollect.Signal();
+	
+	delete iPrewarmThread;
+	delete iCollectorThread;
+	delete iLoader;
+	
+	for(list<Playlist*>::iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	{
+		delete *i;
+	}
+}
+
+void PlaylistManager::SetListener(IPlaylistManagerListener& aListener)
+{
+	iListener = &aListener;
+	
+	MetadataChanged();
+	PlaylistsChanged();
+	PlaylistChanged();
+}
+
+void PlaylistManager::Prewarm(const TUint aCount)
+{
+	if(aCount == 0 || iPrewarmThread != NULL)
+	{
+		return;
+	}
+	
+	iPrewarmCount = aCount < iRecent.size() ? aCount : iRecent.size();
+	iPrewarmThread = new ThreadFunctor("PWrm", MakeFunctor(*this, &PlaylistManager::PrewarmRun), Thread::kPriorityLow);
+	iPrewarmThread->Start();
+}
+
+void PlaylistManager::PrewarmRun()
+{
+	if(iLoader != NULL)
+	{
+		iLoader->Wait();
+	}
+	
+	// least recent first, so the most recent end up newest in the cache
+	for(TUint i = iPrewarmCount; i > 0; --i)
+	{
+		iMutex.Wait();
+		
+		if(iPrewarmQuit)
+		{
+			iMutex.Signal();
+			break;
+		}
+		
+		list<Playlist*>::iterator j = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), iRecent[i - 1]));
+		if(j == iPlaylists.end())
+		{
+			iMutex.Signal();
+			continue;
+		}
+		
+		TUint id = (*j)->Id();
+		Bws<Ascii::kMaxUintStringBytes + 5> filename((*j)->Filename());
+		
+		iMutex.Signal();
+		
+		// the cache only keeps the id, so the playlist may go away while we parse
+		try
+		{
+			iCache.Prefetch(id, filename);
+		}
+		catch(ReaderFileError)
+		{
+		}
+	}
+}
+
+TUint64 PlaylistManager::ReclaimedBytes() const
+{
+	iMutex.Wait();
+	TUint64 bytes = iReclaimedBytes;
+	iMutex.Signal();
+	
+	return bytes;
+}
+
+void PlaylistManager::CollectorRun()
+{
+	for(;;)
+	{
+		iCollect.Wait();
+		
+		// deletes made since the last pass are all covered by this one
+		iCollect.Clear();
+		
+		iMutex.Wait();
+		TBool quit = iCollectorQuit;
+		iMutex.Signal();
+		
+		if(quit)
+		{
+			break;
+		}
+		
+		Collect();
+	}
+}
+
+// Playlist files whose ids the toc doesn't list are removed with the manager
+// locked, so a playlist can't be created under the same id meanwhile.  Names
+// that aren't ours are left alone, since the root may be shared, and nothing
+// is removed in a run that started without a complete toc.
+void PlaylistManager::Collect()
+{
+	if(iLoader != NULL)
+	{
+		iLoader->Wait();
+	}
+	
+	TUint startTime = Os::TimeInMs();
+	
+	vector<IFileStore::Record> records;
+	iStore.Records(records);
+	
+	TUint files = 0;
+	
+	iMutex.Wait();
+	
+	vector<TUint> ids(iUnreadable);
+	for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	{
+		ids.push_back((*i)->Id());
+	}
+	sort(ids.begin(), ids.end());
+	
+	for(vector<IFileStore::Record>::const_iterator i = records.begin(); i != records.end() && iTocComplete; ++i)
+	{
+		TUint id;
+		if(!PlaylistFile(i->iName, id) || binary_search(ids.begin(), ids.end(), id))
+		{
+			continue;
+		}
+		
+		iStore.Remove(i->iName);
+		++files;
+	}
+	
+	iMutex.Signal();
+	
+	// the store counts what the removals gave back along with what it
+	// compacts; nothing is compacted until the removals are durable
+	if(!Sync())
+	{
+		return;
+	}
+	TUint bytes = iStore.Compact();
+	
+	if(bytes > 0)
+	{
+		Log::Print("Reclaimed %u bytes, %u orphaned files, in %u ms\n", bytes, files, Os::TimeInMs() - startTime);
+	}
+	
+	iMutex.Wait();
+	iReclaimedBytes += bytes;
+	iMutex.Signal();
+}
+
+void PlaylistManager::SetName(const Brx& aValue)
+{
+	iName.Replace(aValue);
+	MetadataChanged();
+}
+
+void PlaylistManager::SetAdapter(const TIpAddress& aAdapter)
+{
+	iAdapter = aAdapter;
+	MetadataChanged();
+}
+
+const Brx& PlaylistManager::Name() const
+{
+	return iName;
+}
+
+const TIpAddress& PlaylistManager::Adapter() const
+{
+	return iAdapter;
+}
+
+const TUint PlaylistManager::Token() const
+{
+	return iToken;
+}
+
+TBool PlaylistManager::ChangesSince(const TUint aToken, Bwx& aChanges, TUint& aNewToken) const
+{
+	iMutex.Wait();
+	
+	if(aToken < iChangesFrom || aToken > iToken)
+	{
+		iMutex.Signal();
+		return false;
+	}
+	
+	WriterBuffer writer(aChanges);
+	WriterBinary binary(writer);
+	
+	vector<TUint> tokened;
+	
+	// tokens run on from iChangesFrom a change at a time
+	for(deque<Change>::const_iterator c = iChanges.begin() + (aToken - iChangesFrom); c != iChanges.end(); ++c)
+	{
+		if((*c).iKind == eChangeToken || (*c).iKind == eChangeInserted)
+		{
+			tokened.push_back((*c).iId);
+		}
+		if((*c).iKind != eChangeToken)
+		{
+			binary.WriteUint32Be((*c).iKind);
+			binary.WriteUint32Be((*c).iId);
+			binary.WriteUint32Be((*c).iValue);
+		}
+	}
+	
+	sort(tokened.begin(), tokened.end());
+	tokened.erase(unique(tokened.begin(), tokened.end()), tokened.end());
+	
+	for(vector<TUint>::const_iterator i = tokened.begin(); i != tokened.end(); ++i)
+	{
+		list<Playlist*>::const_iterator j = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), *i));
+		if(j != iPlaylists.end())
+		{
+			binary.WriteUint32Be(eChangeToken);
+			binary.WriteUint32Be(*i);
+			binary.WriteUint32Be((*j)->Token());
+		}
+	}
+	
+	aNewToken = iToken;
+	
+	iMutex.Signal();
+	
+	return true;
+}
+
+const TBool PlaylistManager::TokenChanged(const TUint aToken) const
+{
+	TBool changed = false;
+	
+	iMutex.Wait();
+	if(aToken != iToken)
+	{
+		changed = true;
+	}
+	iMutex.Signal();
+	
+	return changed;
+}
+
+void PlaylistManager::ImagesXml(IWriter& aWriter) const
+{
+	/*Brn entryStart("<Entry>");
+	Brn entryEnd("</Entry>");
+	Brn idStart("<Id>");
+	Brn idEnd("</Id>");
+	Brn uriStart("<Uri>");
+	Brn uriEnd("</Uri>");*/
+	
+	aWriter.Write(Brn("<ImageList>"));
+	aWriter.Write(Brn("</ImageList>"));
+}
+
+void PlaylistManager::Metadata(Bwx& aMetadata) const
+{
+	WriterBuffer buffer(aMetadata);
+	
+	iMutex.Wait();
+	
+	buffer.Write(Brn("<DIDL-Lite xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\" xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\"><item id=\""));
+	Converter::ToXmlEscaped(buffer, iName);
+	buffer.Write(Brn("\" parentID=\"\" restricted=\"True\"><dc:title>"));
+	Converter::ToXmlEscaped(buffer, iName);
+	buffer.Write(Brn("</dc:title><upnp:albumArtURI>http://"));
+	
+	Endpoint endPoint;
+	endPoint.SetAddress(iAdapter);
+	endPoint.AppendAddress(aMetadata);
+	
+	iMutex.Signal();
+	
+	buffer.Write(Brn("/images/Icon.png</upnp:albumArtURI><upnp:class>object.container</upnp:class></item></DIDL-Lite>"));
+}
+
+void PlaylistManager::MetadataChanged()
+{
+	if(iListener != NULL)
+	{
+		iListener->MetadataChanged();
+	}
+}
+
+// The token itself moves on in RecordChange, with the manager locked, so
+// these only pass the news on.
+void PlaylistManager::PlaylistsChanged()
+{
+	if(iListener != NULL)
+	{
+		iListener->PlaylistsChanged();
+	}
+}
+
+void PlaylistManager::PlaylistChanged()
+{
+	if(iListener != NULL)
+	{
+		iListener->PlaylistChanged();
+	}
+}
+
+void PlaylistManager::IdArray(Bwx& aIdArray) const
+{
+	iMutex.Wait();
+	
+	WriterBuffer writer(aIdArray);
+	WriterBinary binary(writer);
+	
+	for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	{
+		binary.WriteUint32Be((*i)->Id());
+	}
+	
+	iMutex.Signal();
+}
+
+void PlaylistManager::TokenArray(Bwx& aTokenArray) const
+{
+	iMutex.Wait();
+	
+	WriterBuffer writer(aTokenArray);
+	WriterBinary binary(writer);
+	
+	for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	{
+		binary.WriteUint32Be((*i)->Token());
+	}
+	
+	iMutex.Signal();
+}
+
+void PlaylistManager::PlaylistRead(const TUint aId, Bwx& aName, Bwx& aDescription, TUint& aImageId) const
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	list<Playlist*>::const_iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	(*i)->Name(aName);
+	(*i)->Description(aDescription);
+	(*i)->ImageId(aImageId);
+	
+	iMutex.Signal();
+}
+
+void PlaylistManager::PlaylistReadList(std::vector<TUint>& aIdList, IWriter& aWriter) const
+{
+	Brn entryStart("<Entry>");
+	Brn entryEnd("</Entry>");
+	Brn idStart("<Id>");
+	Brn idEnd("</Id>");
+	Brn nameStart("<Name>");
+	Brn nameEnd("</Name>");
+	Brn descriptionStart("<Description>");
+	Brn descriptionEnd("</Description>");
+	Brn imageIdStart("<ImageId>");
+	Brn imageIdEnd("</ImageId>");
+	
+	for(vector<TUint>::const_iterator id = aIdList.begin(); id != aIdList.end(); ++id)
+	{
+		WaitLoaded(*id);
+	}
+	
+	aWriter.Write(Brn("<PlaylistList>"));
+	
+	iMutex.Wait();
+	
+	for(vector<TUint>::const_iterator id = aIdList.begin(); id != aIdList.end(); ++id)
+	{
+		list<Playlist*>::const_iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), (*id)));
+		if(i != iPlaylists.end())
+		{
+			aWriter.Write(entryStart);
+			
+			aWriter.Write(idStart); Ascii::StreamWriteUint(aWriter, (*i)->Id()); aWriter.Write(idEnd);
+			
+			Bws<PlaylistHeader::kMaxNameBytes> name;
+			(*i)->Name(name);
+			aWriter.Write(nameStart); XmlEscaper::Write(aWriter, name); aWriter.Write(nameEnd);
+			
+			Bws<PlaylistHeader::kMaxDescriptionBytes> description;
+			(*i)->Description(description);
+			aWriter.Write(descriptionStart); XmlEscaper::Write(aWriter, description); aWriter.Write(descriptionEnd);
+			
+			TUint imageId;
+			(*i)->ImageId(imageId);
+			aWriter.Write(imageIdStart); Ascii::StreamWriteUint(aWriter, imageId); aWriter.Write(imageIdEnd);
+			
+			aWriter.Write(entryEnd);
+		}
+	}
+	
+	iMutex.Signal();
+	
+	aWriter.Write(Brn("</PlaylistList>"));
+	aWriter.WriteFlush();
+}
+
+void PlaylistManager::PlaylistSetName(const TUint aId, const Brx& aName)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	Preserve(**i);
+	(*i)->SetName(aName);
+	
+	TBool written = true;
+	try
+	{
+		WriteHeader(**i);
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeToken, aId, 0);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
+}
+
+void PlaylistManager::PlaylistSetDescription(const TUint aId, const Brx& aDescription)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	Preserve(**i);
+	(*i)->SetDescription(aDescription);
+	
+	TBool written = true;
+	try
+	{
+		WriteHeader(**i);
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeToken, aId, 0);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
+}
+
+void PlaylistManager::PlaylistSetImageId(const TUint aId, TUint& aImageId)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	Preserve(**i);
+	(*i)->SetImageId(aImageId);
+	
+	TBool written = true;
+	try
+	{
+		WriteHeader(**i);
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeToken, aId, 0);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
+}
+
+const TUint PlaylistManager::PlaylistInsert(const TUint aAfterId, const Brx& aName, const Brx& aDescription, const TUint aImageId)
+{
+	iMutex.Wait();
+	
+	list<Playlist*>::iterator i;
+    if(aAfterId == 0)
+	{
+        i = iPlaylists.begin();
+    }
+    else
+	{
+        i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aAfterId));
+        if(i == iPlaylists.end())
+		{
+            iMutex.Signal();
+            THROW(PlaylistManagerError);
+        }
+        ++i;  // we insert after the id, not before
+    }
+	
+	TUint id = iIdGenerator.NewId();
+	Bws<Ascii::kMaxUintStringBytes + 5> filename;
+	Ascii::AppendDec(filename, id);
+	filename.Append(Brn(".txt"));
+	
+	// nothing has changed yet if the empty playlist can't be written
+	try
+	{
+		IFileWriter* f = iStore.OpenWriter(filename);
+		f->Close();
+		delete f;
+	}
+	catch(WriterFileError)
+	{
+		iMutex.Signal();
+		THROW(PlaylistStoreError);
+	}
+	
+	Playlist* playlist = new Playlist(&iCache, id, filename, aName, aDescription, aImageId);
+	iPlaylists.insert(i, playlist);
+	
+	TBool written = true;
+	try
+	{
+		WriteToc();
+		WritePlaylist(*playlist);
+		WriteHeader(*playlist);
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeInserted, id, aAfterId);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistsChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
+	
+	return id;
+}
+
+void PlaylistManager::PlaylistDelete(const TUint aId)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	if(aId == 0)
+	{
+		iMutex.Signal();
+        return;
+    }
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		return;
+	}
+	Preserve(**i);
+	Playlist* playlist = *i;
+	iPlaylists.erase(i);
+	iCache.Remove(aId);
+	delete playlist;
+	
+	TBool written = true;
+	try
+	{
+		WriteToc();
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeDeleted, aId, 0);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	// the playlist's files go once the toc without it is durable
+	if(saved)
+	{
+		iCollect.Signal();
+	}
+	
+	PlaylistsChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
+}
+
+void PlaylistManager::PlaylistMove(const TUint aId, const TUint aAfterId)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	if(aId == 0)
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	list<Playlist*>::iterator j;
+    if(aAfterId == 0)
+	{
+        j = iPlaylists.begin();
+    }
+    else
+	{
+        j = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aAfterId));
+        if(j == iPlaylists.end())
+		{
+            iMutex.Signal();
+            THROW(PlaylistManagerError);
+        }
+        ++j;  // we insert after the id, not before
+    }
+	
+	iPlaylists.insert(j, (*i));
+	iPlaylists.erase(i);
+	
+	TBool written = true;
+	try
+	{
+		WriteToc();
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeMoved, aId, aAfterId);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistsChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
+}
+
+void PlaylistManager::IdArray(const TUint aId, Bwx& aIdArray)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	if(aId == 0)
+	{
+		iMutex.Signal();
+        THROW(PlaylistManagerError);
+    }
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	(*i)->IdArray(aIdArray);
+	
+	iMutex.Signal();
+}
+
+bool PlaylistManager::PlaylistExists(const TUint aId) const
+{
+	iMutex.Wait();
+	
+	list<Playlist*>::const_iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		return false;
+	}
+	
+	iMutex.Signal();
+	
+	return true;
+}
+
+void PlaylistManager::Read(const TUint aId, const TUint aTrackId, Bwx& aMetadata)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+
+	try
+	{
+		(*i)->Read(aTrackId, aMetadata);
+	
+		iMutex.Signal();
+	}
+	catch(PlaylistError& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+}
+
+// a TrackList entry for each track in a batch from ReadRange
+static void WriteTrackEntries(const Brx& aBatch, IWriter& aWriter)
+{
+	Brn entryStart("<Entry>");
+	Brn entryEnd("</Entry>");
+	Brn idStart("<Id>");
+	Brn idEnd("</Id>");
+	Brn metadataStart("<Metadata>");
+	Brn metadataEnd("</Metadata>");
+	
+	for(TUint j = 0; j < aBatch.Bytes(); )
+	{
+		TUint id = BigEndianConverter::BigEndianToUint32(aBatch, j);
+		TUint bytes = BigEndianConverter::BigEndianToUint32(aBatch, j + 4);
+		
+		aWriter.Write(entryStart);
+		aWriter.Write(idStart); Ascii::StreamWriteUint(aWriter, id); aWriter.Write(idEnd);
+		aWriter.Write(metadataStart); aWriter.Write(Brn(aBatch.Ptr() + j + 8, bytes)); aWriter.Write(metadataEnd);
+		aWriter.Write(entryEnd);
+		
+		j += 8 + bytes;
+	}
+}
+
+void PlaylistManager::ReadList(const TUint aId, std::vector<TUint>& aIdList, IWriter& aWriter)
+{
+	Bwh idArray(aIdList.size() * 4);
+	WriterBuffer writer(idArray);
+	WriterBinary binary(writer);
+	
+	for(vector<TUint>::const_iterator id = aIdList.begin(); id != aIdList.end(); ++id)
+	{
+		binary.WriteUint32Be(*id);
+	}
+	
+	ReadList(aId, idArray, aWriter);
+}
+
+void PlaylistManager::ReadList(const TUint aId, const Brx& aIdArray, IWriter& aWriter)
+{
+	if(aIdArray.Bytes() % 4 != 0 || aIdArray.Bytes() > PlaylistData::kMaxTracks * 4)
+	{
+		THROW(PlaylistError);
+	}
+	
+	WaitLoaded(aId);
+	
+	if(!PlaylistExists(aId))
+	{
+		THROW(PlaylistManagerError);
+	}
+	
+	aWriter.Write(Brn("<TrackList>"));
+	
+	Bwh batch(kReadBatchBytes);
+	TUint offset = 0;
+	
+	while(offset < aIdArray.Bytes())
+	{
+		batch.SetBytes(0);
+		
+		iMutex.Wait();
+		
+		// a playlist deleted meanwhile still gets a whole list
+		list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+		TUint count = (i == iPlaylists.end()) ? 0 : (*i)->ReadEntries(aIdArray.Split(offset), batch);
+		
+		iMutex.Signal();
+		
+		if(count == 0)
+		{
+			break;
+		}
+		
+		aWriter.Write(batch);
+		offset += 4 * count;
+	}
+	
+	aWriter.Write(Brn("</TrackList>"));
+	aWriter.WriteFlush();
+}
+
+void PlaylistManager::ReadRange(const TUint aId, const TUint aStart, const TUint aCount, IWriter& aWriter)
+{
+	WaitLoaded(aId);
+	
+	if(!PlaylistExists(aId))
+	{
+		THROW(PlaylistManagerError);
+	}
+	
+	aWriter.Write(Brn("<TrackList>"));
+	
+	Bwh batch(kReadBatchBytes);
+	TUint start = aStart;
+	TUint remaining = aCount;
+	
+	while(remaining > 0)
+	{
+		batch.SetBytes(0);
+		
+		iMutex.Wait();
+		
+		// a playlist deleted meanwhile still gets a whole list
+		list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+		TUint count = (i == iPlaylists.end()) ? 0 : (*i)->ReadRange(start, remaining, batch);
+		
+		iMutex.Signal();
+		
+		if(count == 0)
+		{
+			break;
+		}
+		
+		WriteTrackEntries(batch, aWriter);
+		
+		start += count;
+		remaining -= count;
+	}
+	
+	aWriter.Write(Brn("</TrackList>"));
+	aWriter.WriteFlush();
+}
+
+const TUint PlaylistManager::Insert(const TUint aId, const TUint aAfterId, const Brx& aMetadata)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	Preserve(**i);
+	
+	TUint newId;
+	try
+	{
+		newId = (*i)->Insert(aAfterId, aMetadata);
+	}
+	catch(PlaylistFull& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	catch(PlaylistError& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	
+	TBool written = true;
+	try
+	{
+		WritePlaylist(*(*i));
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeToken, aId, 0);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
+	
+	return newId;
+}
+
+void PlaylistManager::InsertList(const TUint aId, const TUint aAfterId, const std::vector<Brn>& aMetadata, std::vector<TUint>& aNewIds)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		THROW(PlaylistManagerError);
+	}
+	
+	Preserve(**i);
+	
+	try
+	{
+		(*i)->InsertList(aAfterId, aMetadata, aNewIds);
+	}
+	catch(PlaylistFull& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	catch(PlaylistError& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	
+	TBool written = true;
+	try
+	{
+		WritePlaylist(*(*i));
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeToken, aId, 0);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
+}
+
+void PlaylistManager::Delete(const TUint aId, const TUint aTrackId)
+{
+	WaitLoaded(aId);
+	
+	iMutex.Wait();
+	
+	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+	if(i == iPlaylists.end())
+	{
+		iMutex.Signal();
+		return;
+	}
+	
+	Preserve(**i);
+	(*i)->Delete(aTrackId);
+	
+	TBool written = true;
+	try
+	{
+		WritePlaylist(*(*i));
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeToken, aId, 0);
+	
+	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistChanged();
 	
-	aWriter.Write(Brn("</PlaylistList>"));
-	aWriter.WriteFlush();
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
 }
 
-void PlaylistManager::PlaylistSetName(const TUint aId, const Brx& aName)
+void PlaylistManager::DeleteList(const TUint aId, const Brx& aIdArray, std::vector<TUint>& aMissing)
 {
+	WaitLoaded(aId);
+	
 	iMutex.Wait();
 	
 	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
@@ -1307,33 +3749,106 @@ void PlaylistManager::PlaylistSetName(const TUint aId, const Brx& aName)
 		THROW(PlaylistManagerError);
 	}
 	
-	(*i)->SetName(aName);
+	Preserve(**i);
+	
+	// a list of ids that are all gone already changes nothing
+	if((*i)->DeleteList(aIdArray, aMissing) == 0)
+	{
+		iMutex.Signal();
+		return;
+	}
+	
+	TBool written = true;
+	try
+	{
+		WritePlaylist(*(*i));
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
 	
-	WritePlaylist(**i);
+	RecordChange(eChangeToken, aId, 0);
 	
 	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
 }
 
-void PlaylistManager::PlaylistSetDescription(const TUint aId, const Brx& aDescription)
+void PlaylistManager::DeleteAll(const TUint aId)
 {
+	WaitLoaded(aId);
+	
 	iMutex.Wait();
 	
 	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
 	if(i == iPlaylists.end())
 	{
 		iMutex.Signal();
-		THROW(PlaylistManagerError);
+		return;
 	}
 	
-	(*i)->SetDescription(aDescription);
+	Preserve(**i);
+	(*i)->DeleteAll();
 	
-	WritePlaylist(**i);
+	TBool written = true;
+	try
+	{
+		WritePlaylist(*(*i));
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
+	
+	RecordChange(eChangeToken, aId, 0);
 	
 	iMutex.Signal();
+	
+	TBool saved = Sync() && written;
+	
+	PlaylistChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
 }
 
-void PlaylistManager::PlaylistSetImageId(const TUint aId, TUint& aImageId)
+void PlaylistManager::Move(const TUint aId, const TUint aTrackId, const TUint aAfterTrackId)
+{
+	Bws<4> idArray;
+	WriterBuffer writer(idArray);
+	WriterBinary binary(writer);
+	binary.WriteUint32Be(aTrackId);
+	
+	MoveList(aId, idArray, aAfterTrackId);
+}
+
+void PlaylistManager::MoveList(const TUint aId, const Brx& aIdArray, const TUint aAfterTrackId)
 {
+	vector<TUint> trackIds;
+	for(TUint offset = 0; offset + 4 <= aIdArray.Bytes(); offset += 4)
+	{
+		trackIds.push_back(BigEndianConverter::BigEndianToUint32(aIdArray, offset));
+	}
+	
+	if(trackIds.empty())
+	{
+		return;
+	}
+	
+	WaitLoaded(aId);
+	
 	iMutex.Wait();
 	
 	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
@@ -1343,341 +3858,681 @@ void PlaylistManager::PlaylistSetImageId(const TUint aId, TUint& aImageId)
 		THROW(PlaylistManagerError);
 	}
 	
-	(*i)->SetImageId(aImageId);
+	Preserve(**i);
+	
+	try
+	{
+		(*i)->MoveList(trackIds, aAfterTrackId);
+	}
+	catch(PlaylistError& e)
+	{
+		iMutex.Signal();
+		throw e;
+	}
+	
+	TBool written = true;
+	try
+	{
+		WritePlaylist(*(*i));
+		WriteIndex();
+	}
+	catch(WriterFileError)
+	{
+		written = false;
+	}
 	
-	WritePlaylist(**i);
+	RecordChange(eChangeToken, aId, 0);
 	
 	iMutex.Signal();
 	
+	TBool saved = Sync() && written;
+	
 	PlaylistChanged();
+	
+	if(!saved)
+	{
+		THROW(PlaylistStoreError);
+	}
 }
 
-const TUint PlaylistManager::PlaylistInsert(const TUint aAfterId, const Brx& aName, const Brx& aDescription, const TUint aImageId)
+TUint PlaylistManager::Import(const std::vector<const TChar*>& aFilenames)
 {
-	iMutex.Wait();
+	TUint tracks = 0;
+	TUint playlists = 0;
+	TBool saved = true;
 	
-	list<Playlist*>::iterator i;
-    if(aAfterId == 0)
-	{
-        i = iPlaylists.begin();
-    }
-    else
+	for(vector<const TChar*>::const_iterator f = aFilenames.begin(); f != aFilenames.end(); ++f)
 	{
-        i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aAfterId));
-        if(i == iPlaylists.end())
+		Brn path(*f);
+		PlaylistImporter::EFormat format = PlaylistImporter::Format(path);
+		if(format == PlaylistImporter::eUnknown)
 		{
-            iMutex.Signal();
-            THROW(PlaylistManagerError);
-        }
-        ++i;  // we insert after the id, not before
-    }
-	
-	TUint id = iIdGenerator.NewId();
-	Bws<Ascii::kMaxUintStringBytes + 5> filename;
-	Ascii::AppendDec(filename, id);
-	filename.Append(Brn(".txt"));
-	
-	WriterFile f(filename.PtrZ());
-	f.Close();
-	
-	Playlist* playlist = new Playlist(&iCache, id, filename, aName, aDescription, aImageId);
-	iPlaylists.insert(i, playlist);
-	
-	WriteToc();
-	WritePlaylist(*playlist);
-	
-	iMutex.Signal();
+			Log::Print("%s: not a format that can be imported\n", *f);
+			continue;
+		}
+		
+		iMutex.Wait();
+		TBool full = (iPlaylists.size() >= kMaxPlaylists);
+		TUint id = full ? 0 : iIdGenerator.NewId();
+		iMutex.Signal();
+		
+		if(full)
+		{
+			Log::Print("%s: no room for another playlist\n", *f);
+			break;
+		}
+		
+		// parsed with nothing locked
+		PlaylistData* data = new PlaylistData(id);
+		PlaylistImport import(*data);
+		
+		try
+		{
+			ReaderFile file(*f);
+			PlaylistImporter::Parse(format, file, import);
+		}
+		catch(ReaderFileError)
+		{
+			Log::Print("%s: can't be read\n", *f);
+			delete data;
+			continue;
+		}
+		catch(ReaderError)
+		{
+			Log::Print("%s: not a valid playlist\n", *f);
+			delete data;
+			continue;
+		}
+		
+		if(import.Skipped() > 0)
+		{
+			Log::Print("%s: left out %u tracks over the limit of %u\n", *f, import.Skipped(), PlaylistData::kMaxTracks);
+		}
+		
+		// named by the file itself, or after it
+		Brn name(import.Title());
+		if(name.Bytes() == 0)
+		{
+			TUint start = path.Bytes();
+			while(start > 0 && path[start - 1] != '/' && path[start - 1] != '\\')
+			{
+				--start;
+			}
+			TUint end = path.Bytes();
+			while(end > start && path[end - 1] != '.')
+			{
+				--end;
+			}
+			TUint bytes = end - 1 - start;
+			name.Set(path.Ptr() + start, (bytes > PlaylistHeader::kMaxNameBytes) ? PlaylistHeader::kMaxNameBytes : bytes);
+		}
+		
+		Bws<Ascii::kMaxUintStringBytes + 5> filename;
+		Ascii::AppendDec(filename, id);
+		filename.Append(Brn(".txt"));
+		
+		TUint trackCount = data->TrackCount();
+		
+		iMutex.Wait();
+		
+		Playlist* playlist = new Playlist(&iCache, id, filename, name, Brx::Empty(), 0, 0, trackCount, 0);
+		iCache.Add(data);
+		
+		TUint afterId = iPlaylists.empty() ? 0 : iPlaylists.back()->Id();
+		iPlaylists.push_back(playlist);
+		
+		try
+		{
+			WritePlaylist(*playlist);
+			WriteHeader(*playlist);
+		}
+		catch(WriterFileError)
+		{
+			Log::Print("%s: couldn't be saved\n", *f);
+			saved = false;
+		}
+		
+		RecordChange(eChangeInserted, id, afterId);
+		
+		iMutex.Signal();
+		
+		tracks += trackCount;
+		++playlists;
+	}
 	
-	PlaylistsChanged();
+	if(playlists > 0)
+	{
+		iMutex.Wait();
+		
+		try
+		{
+			WriteToc();
+			WriteIndex();
+		}
+		catch(WriterFileError)
+		{
+			saved = false;
+		}
+		
+		iMutex.Signal();
+		
+		if(!Sync() || !saved)
+		{
+			Log::Print("Imported playlists couldn't all be saved\n");
+		}
+		
+		PlaylistsChanged();
+	}
 	
-	return id;
+	return tracks;
 }
 
-void PlaylistManager::PlaylistDelete(const TUint aId)
+void PlaylistManager::Export(const TUint aId, PlaylistExporter::EFormat aFormat, IWriter& aWriter)
 {
+	WaitLoaded(aId);
+	
+	Bws<PlaylistData::kMaxTracks * 4> ids;
+	Bws<PlaylistHeader::kMaxNameBytes> name;
+	Bws<PlaylistHeader::kMaxDescriptionBytes> description;
+	
 	iMutex.Wait();
 	
-	if(aId == 0)
-	{
-		iMutex.Signal();
-        return;
-    }
 	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
 	if(i == iPlaylists.end())
 	{
 		iMutex.Signal();
-		return;
+		THROW(PlaylistManagerError);
 	}
-	iPlaylists.erase(i);
-	delete (*i);
 	
-	try
+	(*i)->IdArray(ids);
+	(*i)->Name(name);
+	(*i)->Description(description);
+	
+	iMutex.Signal();
+	
+	PlaylistExporter exporter(aFormat, aWriter);
+	exporter.WriteStart(name, description);
+	
+	Bwh batch(kExportBatchBytes);
+	TUint offset = 0;
+	
+	while(offset < ids.Bytes())
 	{
-		WriteToc();
-		// delete old playlist file.
+		batch.SetBytes(0);
+		
+		iMutex.Wait();
+		
+		i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
+		if(i == iPlaylists.end())
+		{
+			// deleted meanwhile; what has been written is still ended properly
+			iMutex.Signal();
+			break;
+		}
+		
+		offset += 4 * (*i)->ReadBatch(ids.Split(offset), batch);
+		
+		iMutex.Signal();
+		
+		// the slow part, with nothing locked
+		for(TUint j = 0; j < batch.Bytes(); )
+		{
+			TUint bytes = BigEndianConverter::BigEndianToUint32(batch, j + 4);
+			exporter.WriteTrack(Brn(batch.Ptr() + j + 8, bytes));
+			j += 8 + bytes;
+		}
 	}
-	catch(ReaderFileError)
+	
+	exporter.WriteEnd();
+}
+
+TUint PlaylistManager::Export(IFileStore& aStore, PlaylistExporter::EFormat aFormat)
+{
+	Bws<kMaxPlaylists * 4> ids;
+	IdArray(ids);
+	
+	TUint count = 0;
+	
+	for(TUint offset = 0; offset < ids.Bytes(); offset += 4)
 	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
+		TUint id = BigEndianConverter::BigEndianToUint32(ids, offset);
+		
+		Bws<IFileStore::kMaxNameBytes> filename;
+		Ascii::AppendDec(filename, id);
+		filename.Append(PlaylistExporter::Extension(aFormat));
+		
+		IFileWriter* file = aStore.OpenWriter(filename);
+		
+		try
+		{
+			Export(id, aFormat, *file);
+			file->Close();
+			++count;
+		}
+		catch(PlaylistManagerError)
+		{
+			// deleted since the list was taken; an unclosed file is discarded
+		}
+		catch(WriterError& e)
+		{
+			delete file;
+			throw e;
+		}
+		catch(WriterFileError& e)
+		{
+			delete file;
+			throw e;
+		}
+		
+		delete file;
 	}
 	
-	iMutex.Signal();
+	aStore.Sync();
 	
-	PlaylistsChanged();
+	return count;
 }
 
-void PlaylistManager::PlaylistMove(const TUint aId, const TUint aAfterId)
+void PlaylistManager::Snapshot(IWriter& aWriter)
 {
-	iMutex.Wait();
+	// one snapshot at a time, of a directory with every header in place
+	iSnapshotMutex.Wait();
 	
-	if(aId == 0)
+	if(iLoader != NULL)
 	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
+		iLoader->Wait();
 	}
 	
-	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
+	iMutex.Wait();
+	
+	WriterMemory toc(1024);
+	WriteToc(toc);
+	
+	for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
 	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
+		iSnapshotPending.push_back((*i)->Id());
 	}
+	vector<TUint> ids(iSnapshotPending);
+	iSnapshotting = true;
 	
-	list<Playlist*>::iterator j;
-    if(aAfterId == 0)
-	{
-        j = iPlaylists.begin();
-    }
-    else
-	{
-        j = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aAfterId));
-        if(j == iPlaylists.end())
-		{
-            iMutex.Signal();
-            THROW(PlaylistManagerError);
-        }
-        ++j;  // we insert after the id, not before
-    }
+	iMutex.Signal();
 	
-	iPlaylists.insert(j, (*i));
-	iPlaylists.erase(i);
+	WriterMemory* data = NULL;
 	
 	try
 	{
-		WriteToc();
+		WriterTar tar(aWriter);
+		tar.WriteFile(kTocFilename, toc.Data());
+		
+		for(vector<TUint>::const_iterator id = ids.begin(); id != ids.end(); ++id)
+		{
+			iMutex.Wait();
+			
+			// a copy taken by a writer, otherwise the playlist is still as it was
+			for(list< pair<TUint, WriterMemory*> >::iterator i = iSnapshotCopies.begin(); i != iSnapshotCopies.end(); ++i)
+			{
+				if((*i).first == *id)
+				{
+					data = (*i).second;
+					iSnapshotCopies.erase(i);
+					break;
+				}
+			}
+			
+			if(data == NULL)
+			{
+				list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), *id));
+				data = Capture(**i);
+				iSnapshotPending.erase(find(iSnapshotPending.begin(), iSnapshotPending.end(), *id));
+			}
+			
+			iMutex.Signal();
+			
+			// the slow part, with nothing locked
+			Bws<Ascii::kMaxUintStringBytes + 5> filename;
+			Ascii::AppendDec(filename, *id);
+			filename.Append(".txt");
+			
+			tar.WriteFile(filename, data->Data());
+			
+			delete data;
+			data = NULL;
+		}
+		
+		tar.WriteEnd();
+	}
+	catch(WriterError& e)
+	{
+		delete data;
+		EndSnapshot();
+		throw e;
 	}
-	catch(ReaderFileError)
+	catch(WriterFileError& e)
 	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
+		delete data;
+		EndSnapshot();
+		throw e;
 	}
 	
-	iMutex.Signal();
-	
-	PlaylistsChanged();
+	EndSnapshot();
 }
 
-void PlaylistManager::IdArray(const TUint aId, Bwx& aIdArray)
+WriterMemory* PlaylistManager::Capture(Playlist& aPlaylist) const
 {
-	iMutex.Wait();
+	WriterMemory* data = new WriterMemory(aPlaylist.Bytes() + 1024);
+	WriterVector writer(*data);
 	
-	if(aId == 0)
-	{
-		iMutex.Signal();
-        THROW(PlaylistManagerError);
-    }
+	aPlaylist.ToXml(writer);
 	
-	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
+	writer.WriteFlush();
+	
+	return data;
+}
+
+// Called with the manager locked before a playlist is changed
+void PlaylistManager::Preserve(Playlist& aPlaylist)
+{
+	if(!iSnapshotting)
 	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
+		return;
 	}
 	
-	(*i)->IdArray(aIdArray);
+	vector<TUint>::iterator i = find(iSnapshotPending.begin(), iSnapshotPending.end(), aPlaylist.Id());
+	if(i == iSnapshotPending.end())
+	{
+		return;
+	}
 	
-	iMutex.Signal();
+	// copy on write, once per playlist and snapshot
+	iSnapshotCopies.push_back(pair<TUint, WriterMemory*>(aPlaylist.Id(), Capture(aPlaylist)));
+	iSnapshotPending.erase(i);
 }
 
-bool PlaylistManager::PlaylistExists(const TUint aId) const
+void PlaylistManager::EndSnapshot()
 {
 	iMutex.Wait();
 	
-	list<Playlist*>::const_iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
+	iSnapshotting = false;
+	iSnapshotPending.clear();
+	for(list< pair<TUint, WriterMemory*> >::iterator i = iSnapshotCopies.begin(); i != iSnapshotCopies.end(); ++i)
 	{
-		iMutex.Signal();
-		return false;
+		delete (*i).second;
 	}
+	iSnapshotCopies.clear();
 	
 	iMutex.Signal();
 	
-	return true;
+	iSnapshotMutex.Signal();
 }
 
-void PlaylistManager::Read(const TUint aId, const TUint aTrackId, Bwx& aMetadata)
+void PlaylistManager::WaitLoaded(const TUint aId) const
 {
-	iMutex.Wait();
-	
-	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
+	if(iLoader != NULL)
 	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
+		iLoader->Wait(aId);
 	}
+}
 
+TBool PlaylistManager::Sync()
+{
 	try
 	{
-		(*i)->Read(aTrackId, aMetadata);
-	
-		iMutex.Signal();
+		iStore.Sync();
 	}
-	catch(PlaylistError& e)
+	catch(WriterFileError)
 	{
-		iMutex.Signal();
-		throw e;
+		Log::Print("Failed to save changes\n");
+		return false;
 	}
+	
+	return true;
 }
 
-void PlaylistManager::ReadList(const TUint aId, std::vector<TUint>& aIdList, IWriter& aWriter)
+void PlaylistManager::RecordChange(const EChange aKind, const TUint aId, const TUint aValue)
 {
-	Brn entryStart("<Entry>");
-	Brn entryEnd("</Entry>");
-	Brn idStart("<Id>");
-	Brn idEnd("</Id>");
-	Brn metadataStart("<Metadata>");
-	Brn metadataEnd("</Metadata>");
-	
-	aWriter.Write(Brn("<TrackList>"));
-	
-	iMutex.Wait();
+	++iToken;
 	
-	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
+	iChanges.push_back(Change(iToken, aKind, aId, aValue));
+	if(iChanges.size() > kMaxChanges)
 	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
-	}	
+		iChangesFrom = iChanges.front().iToken;
+		iChanges.pop_front();
+	}
 	
-	for(vector<TUint>::const_iterator id = aIdList.begin(); id != aIdList.end(); ++id)
+	// retried with the next change if it can't be written
+	if(iToken - iIndexToken >= kTokenReserve)
 	{
-		Bws<Track::kMaxMetadataBytes> metadata;
-		
 		try
 		{
-			(*i)->Read((*id), metadata);
-			
-			aWriter.Write(entryStart);
-			
-			aWriter.Write(idStart); Ascii::StreamWriteUint(aWriter, (*id)); aWriter.Write(idEnd);
-			aWriter.Write(metadataStart); aWriter.Write(metadata); aWriter.Write(metadataEnd);
-			
-			aWriter.Write(entryEnd);
+			WriteIndex();
 		}
-		catch(PlaylistError)
+		catch(WriterFileError)
 		{
+			Log::Print("Failed to write %.*s\n", PBUF(kIndexFilename));
 		}
 	}
+}
+
+void PlaylistManager::PlaylistLoadFailed(Playlist& aPlaylist)
+{
+	iMutex.Wait();
+	
+	iPlaylists.remove(&aPlaylist);
+	iLoadFailed = true;
+	
+	// its files may only be damaged in part, so they aren't collected and
+	// the toc goes on listing them for the next run to try again
+	iUnreadable.push_back(aPlaylist.Id());
+	Log::Print("%.*s: can't be read, kept for the next run\n", PBUF(aPlaylist.Filename()));
+	
+	RecordChange(eChangeDeleted, aPlaylist.Id(), 0);
 	
 	iMutex.Signal();
 	
-	aWriter.Write(Brn("</TrackList>"));
-	aWriter.WriteFlush();
+	delete &aPlaylist;
 }
 
-const TUint PlaylistManager::Insert(const TUint aId, const TUint aAfterId, const Brx& aMetadata)
+void PlaylistManager::PlaylistsLoaded()
 {
 	iMutex.Wait();
 	
-	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
-	{
-		iMutex.Signal();
-		THROW(PlaylistManagerError);
-	}
+	iLoading = false;
 	
+	// left stale on failure, the files are written again with the next change
 	try
 	{
-		const TUint newId = (*i)->Insert(aAfterId, aMetadata);
-		
-		WritePlaylist(*(*i));
-		
-		iMutex.Signal();
-		
-		PlaylistChanged();
+		if(iTocStale)
+		{
+			WriteToc();
+			iTocStale = false;
+		}
 		
-		return newId;
+		if(iIndexStale)
+		{
+			WriteIndex();
+		}
 	}
-	catch(PlaylistFull& e)
+	catch(WriterFileError)
 	{
-		iMutex.Signal();
-		throw e;
+		Log::Print("Failed to write the toc and index after loading\n");
 	}
-	catch(PlaylistError& e)
+	
+	TUint count = iPlaylists.size();
+	TBool changed = iLoadFailed;
+	
+	iMutex.Signal();
+	
+	Sync();
+	
+	Log::Print("Loaded %u playlists in %u ms\n", count, Os::TimeInMs() - iStartTime);
+	
+	if(changed)
 	{
-		iMutex.Signal();
-		throw e;
+		PlaylistsChanged();
 	}
 }
 
-void PlaylistManager::Delete(const TUint aId, const TUint aTrackId)
+void PlaylistManager::WriteToc() const
 {
-	iMutex.Wait();
+	IFileWriter* file = iStore.OpenWriter(kTocFilename);
 	
-	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
+	try
 	{
-		iMutex.Signal();
-		return;
+		WriteToc(*file);
+		file->Close();
+	}
+	catch(WriterFileError& e)
+	{
+		delete file;
+		throw e;
 	}
 	
-	(*i)->Delete(aTrackId);
+	delete file;
+}
+
+void PlaylistManager::WriteToc(IFileWriter& aFile) const
+{
+	WriterVector writer(aFile);
 	
-	WritePlaylist(*(*i));
+	Bws<Ascii::kMaxUintStringBytes> count;
+	Ascii::AppendDec(count, (TUint)(iPlaylists.size() + iUnreadable.size()));
+	WriteTocLine(writer, count);
 	
-	iMutex.Signal();
+	for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	{
+		WriteTocLine(writer, (*i)->Filename());
+	}
 	
-	PlaylistChanged();
+	// playlists that failed to load stay at the end
+	for(vector<TUint>::const_iterator i = iUnreadable.begin(); i != iUnreadable.end(); ++i)
+	{
+		Bws<Ascii::kMaxUintStringBytes + 5> filename;
+		Ascii::AppendDec(filename, *i);
+		filename.Append(".txt");
+		WriteTocLine(writer, filename);
+	}
+	
+	writer.WriteFlush();
 }
 
-void PlaylistManager::DeleteAll(const TUint aId)
+TUint PlaylistManager::ReadIndex(Bwh& aIndex, TUint& aOffset, TUint& aToken)
 {
-	iMutex.Wait();
+	IReaderSource* file = NULL;
 	
-	list<Playlist*>::iterator i = find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), aId));
-	if(i == iPlaylists.end())
+	try
+	{
+		file = iStore.OpenReader(kIndexFilename);
+		
+		aIndex.Grow(1024);
+		for(;;)
+		{
+			if(aIndex.Bytes() == aIndex.MaxBytes())
+			{
+				aIndex.Grow(aIndex.MaxBytes() * 2);
+			}
+			Bwn free(aIndex.Ptr() + aIndex.Bytes(), 0, aIndex.MaxBytes() - aIndex.Bytes());
+			file->Read(free);
+			aIndex.SetBytes(aIndex.Bytes() + free.Bytes());
+		}
+	}
+	catch(ReaderFileError)
 	{
-		iMutex.Signal();
-		return;
 	}
 	
-	(*i)->DeleteAll();
+	delete file;
 	
-	WritePlaylist(*(*i));
+	if(aIndex.Bytes() < 12 || Brn(aIndex.Ptr(), 4) != kIndexMagic || BigEndianConverter::BigEndianToUint32(aIndex, 4) != kIndexVersion)
+	{
+		return 0;
+	}
 	
-	iMutex.Signal();
+	TUint count = BigEndianConverter::BigEndianToUint32(aIndex, 8);
 	
-	PlaylistChanged();
+	if(aIndex.Bytes() < 20)
+	{
+		return 0;
+	}
+	
+	TUint recent = BigEndianConverter::BigEndianToUint32(aIndex, 16);
+	if(recent > kMaxRecent || aIndex.Bytes() < 24 + recent * 4)
+	{
+		return 0;
+	}
+	
+	TUint headerBytes = 20 + recent * 4;
+	if(BigEndianConverter::BigEndianToUint32(aIndex, headerBytes) != Crc32c::Compute(Brn(aIndex.Ptr(), headerBytes)))
+	{
+		Log::Print("Index header damaged, loading playlists from their files\n");
+		return 0;
+	}
+	
+	for(TUint i = 0; i < recent; ++i)
+	{
+		iRecent.push_back(BigEndianConverter::BigEndianToUint32(aIndex, 20 + i * 4));
+	}
+	
+	aToken = BigEndianConverter::BigEndianToUint32(aIndex, 12);
+	aOffset = headerBytes + 4;
+	return count;
 }
 
-void PlaylistManager::WriteToc() const
+void PlaylistManager::Recent(std::vector<TUint>& aIds) const
 {
-	WriterFile file("Toc.txt");
-	Sws<1024> writer(file);
-	WriterAscii ascii(writer);
+	iCache.Recent(aIds, kMaxRecent);
 	
-	ascii.WriteUint(iPlaylists.size());
-	ascii.Write(Brn("\n"));
-	for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+	// playlists used in earlier sessions that haven't been touched in this one
+	for(vector<TUint>::const_iterator i = iRecent.begin(); i != iRecent.end() && aIds.size() < kMaxRecent; ++i)
+	{
+		if(find(aIds.begin(), aIds.end(), *i) != aIds.end())
+		{
+			continue;
+		}
+		
+		if(find_if(iPlaylists.begin(), iPlaylists.end(), bind2nd(mem_fun(&Playlist::IsId), *i)) != iPlaylists.end())
+		{
+			aIds.push_back(*i);
+		}
+	}
+}
+
+Playlist* PlaylistManager::IndexedPlaylist(const Brx& aIndex, TUint& aOffset, const TUint aId, const Brx& aFilename)
+{
+	if(aOffset + 21 > aIndex.Bytes())
 	{
-		writer.Write((*i)->Filename());
-		writer.Write(Brn("\n"));
+		return NULL;
 	}
 	
-	writer.WriteFlush();
+	TUint id = BigEndianConverter::BigEndianToUint32(aIndex, aOffset);
+	TUint token = BigEndianConverter::BigEndianToUint32(aIndex, aOffset + 4);
+	TUint imageId = BigEndianConverter::BigEndianToUint32(aIndex, aOffset + 8);
+	TUint trackCount = BigEndianConverter::BigEndianToUint32(aIndex, aOffset + 12);
+	TUint bytes = BigEndianConverter::BigEndianToUint32(aIndex, aOffset + 16);
+	TUint offset = aOffset + 20;
+	
+	TUint nameBytes = aIndex[offset++];
+	if(id != aId || nameBytes > PlaylistHeader::kMaxNameBytes || offset + nameBytes + 1 > aIndex.Bytes())
+	{
+		return NULL;
+	}
+	Brn name(aIndex.Ptr() + offset, nameBytes);
+	offset += nameBytes;
+	
+	TUint descriptionBytes = aIndex[offset++];
+	if(descriptionBytes > PlaylistHeader::kMaxDescriptionBytes || offset + descriptionBytes + 4 > aIndex.Bytes())
+	{
+		return NULL;
+	}
+	Brn description(aIndex.Ptr() + offset, descriptionBytes);
+	offset += descriptionBytes;
+	
+	if(BigEndianConverter::BigEndianToUint32(aIndex, offset) != Crc32c::Compute(Brn(aIndex.Ptr() + aOffset, offset - aOffset)))
+	{
+		Log::Print("Index entry for playlist %u damaged, loading the rest from their files\n", aId);
+		return NULL;
+	}
+	
+	aOffset = offset + 4;
 	
-	file.Close();
+	return new Playlist(&iCache, aId, aFilename, name, description, imageId, token, trackCount, bytes);
 }
 
 void PlaylistManager::WritePlaylist(Playlist& aPlaylist) const
@@ -1686,14 +4541,103 @@ void PlaylistManager::WritePlaylist(Playlist& aPlaylist) const
 	Ascii::AppendDec(filename, aPlaylist.Id());
 	filename.Append(".txt");
 	
-	WriterFile file(filename.PtrZ());
-	Sws<1024> writer(file);
-	WriterAscii ascii(writer);
+	IFileWriter* file = iStore.OpenWriter(filename);
+	WriterVector writer(*file);
+	
+	try
+	{
+		aPlaylist.ToXml(writer);
+		writer.WriteFlush();
+		file->Close();
+	}
+	catch(WriterFileError& e)
+	{
+		delete file;
+		throw e;
+	}
+	
+	delete file;
+	
+	aPlaylist.SetBytes(writer.Bytes());
+}
+
+void PlaylistManager::WriteHeader(const Playlist& aPlaylist) const
+{
+	Bws<Ascii::kMaxUintStringBytes + 5> filename;
+	HeaderFilename(aPlaylist.Id(), filename);
 	
-	aPlaylist.ToXml(ascii);
+	IFileWriter* file = iStore.OpenWriter(filename);
+	WriterVector writer(*file);
 	
-	ascii.WriteFlush();
+	try
+	{
+		aPlaylist.HeaderToXml(writer);
+		writer.WriteFlush();
+		file->Close();
+	}
+	catch(WriterFileError& e)
+	{
+		delete file;
+		throw e;
+	}
+	
+	delete file;
+}
+
+void PlaylistManager::WriteIndex()
+{
+	// placeholder headers must never reach the index
+	if(iLoading)
+	{
+		iIndexStale = true;
+		return;
+	}
+	
+	iIndexStale = false;
+	
+	IFileWriter* file = iStore.OpenWriter(kIndexFilename);
+	WriterVector writer(*file);
+	
+	// the header and every entry are followed by their checksum
+	Bws<20 + kMaxRecent * 4> header;
+	WriterBuffer buffer(header);
+	WriterBinary binary(buffer);
+	
+	binary.Write(kIndexMagic);
+	binary.WriteUint32Be(kIndexVersion);
+	binary.WriteUint32Be(iPlaylists.size());
+	binary.WriteUint32Be(iToken);
+	
+	vector<TUint> recent;
+	Recent(recent);
+	binary.WriteUint32Be(recent.size());
+	for(vector<TUint>::const_iterator i = recent.begin(); i != recent.end(); ++i)
+	{
+		binary.WriteUint32Be(*i);
+	}
+	
+	try
+	{
+		WriterBinary index(writer);
+		index.Write(header);
+		index.WriteUint32Be(Crc32c::Compute(header));
+		
+		for(list<Playlist*>::const_iterator i = iPlaylists.begin(); i != iPlaylists.end(); ++i)
+		{
+			(*i)->ToIndex(writer);
+		}
+		
+		writer.WriteFlush();
+		file->Close();
+	}
+	catch(WriterFileError& e)
+	{
+		delete file;
+		throw e;
+	}
+	
+	delete file;
 	
-	file.Close();
+	iIndexToken = iToken;
 }
 
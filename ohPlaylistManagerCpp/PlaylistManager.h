@@ -1,17 +1,25 @@
 #ifndef HEADER_PLAYLISTMANAGER
 #define HEADER_PLAYLISTMANAGER
 
+#include <deque>
 #include <list>
 #include <utility>
+#include <vector>
 
 #include <OpenHome/Buffer.h>
 #include <OpenHome/Private/Thread.h>
 #include <OpenHome/Net/Core/DvDevice.h>
 #include <OpenHome/Net/Core/DvAvOpenhomeOrgPlaylistManager1.h>
 
+#include "DvAvOpenhomeOrgPlaylistManagerExtension1.h"
+#include "Stream.h"
+#include "Import.h"
+#include "Export.h"
+
 EXCEPTION(PlaylistManagerError);
 EXCEPTION(PlaylistError);
 EXCEPTION(PlaylistFull);
+EXCEPTION(PlaylistStoreError);
 
 namespace OpenHome {
 namespace Media {
@@ -64,6 +72,8 @@ public:
 class IPlaylistData
 {
 public:
+	virtual ~IPlaylistData() {}
+	
 	virtual void IdArray(Bwx& aIdArray) = 0;
 	
 	virtual void Read(const TUint aTrackId, Bwx& aMetadata) = 0;
@@ -95,6 +105,9 @@ public:
 	
 	void ToXml(IWriter& aWriter) const;
 	
+private:
+	TUint Checksum() const;
+	
 private:
 	Bws<Ascii::kMaxUintStringBytes> iFilename;
 	Bws<kMaxNameBytes> iName;
@@ -119,15 +132,22 @@ public:
 	
 public:
 	Track(const TUint aId, const Brx& aMetadata);
+	Track(const TUint aId);
 	
 	TUint Id() const;
 	bool IsId(const TUint aId) const;
 	
 	const Brx& Metadata() const;
+	Bwx& Metadata();
+	
+	// the checksum saved with the track, recalculated after Metadata() is filled in
+	TUint Checksum() const;
+	void UpdateChecksum();
 	
 private:
 	const TUint iId;
-	const Bws<kMaxMetadataBytes> iMetadata;
+	Bws<kMaxMetadataBytes> iMetadata;
+	TUint iChecksum;
 };
 
 class PlaylistData : public IPlaylistData
@@ -136,11 +156,15 @@ public:
 	static const TUint kMaxTracks = 1000;
 	
 public:
-	PlaylistData(const TUint aId, const Brx& aFilename);
+	PlaylistData(IFileStore& aStore, const TUint aId, const Brx& aFilename);
+	PlaylistData(const TUint aId);
 	~PlaylistData();
 	
+	TUint Id() const;
 	bool IsId(const TUint aId) const;
 	
+	TUint TrackCount() const;
+	
 	void IdArray(Bwx& aIdArray);
 	
 	virtual void Read(const TUint aTrackId, Bwx& aMetadata);
@@ -148,7 +172,45 @@ public:
 	void Delete(const TUint aId);
 	void DeleteAll();
 	
-	void ToXml(IWriter& aWriter) const;
+	// adds a track at the end; false if the playlist is full
+	TBool Append(const Brx& aMetadata);
+	
+	// Adds the tracks in order after aAfterId, appending their ids to
+	// aNewIds.  All of them go in or, if they won't all fit, none do.
+	void InsertList(const TUint aAfterId, const std::vector<Brn>& aMetadata, std::vector<TUint>& aNewIds);
+	
+	// Removes the tracks named in the big endian aIdArray in one pass,
+	// appending ids that aren't in the playlist to aMissing.  Returns the
+	// number removed.
+	TUint DeleteList(const Brx& aIdArray, std::vector<TUint>& aMissing);
+	
+	// Moves the tracks, in the order given, to follow aAfterId, keeping
+	// their ids and metadata.  Throws PlaylistError, moving nothing, if any
+	// isn't in the playlist, one is named twice, or aAfterId is among them.
+	void MoveList(const std::vector<TUint>& aTrackIds, const TUint aAfterId);
+	
+	// Appends up to aCount tracks from position aStart to aBatch, each as its
+	// 32 bit id, a 32 bit byte count and its metadata, until the next won't
+	// fit.  Returns the number appended.
+	TUint ReadRange(const TUint aStart, const TUint aCount, Bwx& aBatch) const;
+	
+	// Appends the tracks named in aIdArray to aBatch, laid out as ReadRange
+	// does, until the next won't fit.  Tracks since deleted are passed over.
+	// Returns the number of ids dealt with.
+	TUint ReadBatch(const Brx& aIdArray, Bwx& aBatch) const;
+	
+	// Appends a TrackList entry, its metadata copied as it is from where the
+	// track keeps it, for each track named in aIdArray until the next won't
+	// fit.  Tracks since deleted are passed over.  Returns the number of ids
+	// dealt with.
+	TUint ReadEntries(const Brx& aIdArray, Bwx& aEntries) const;
+	
+	void ToXml(WriterVector& aWriter) const;
+	
+private:
+	std::list<Track*>::const_iterator Find(const TUint aId, std::list<Track*>::const_iterator aNext) const;
+	std::list<Track*>::iterator Find(const std::vector< std::pair<TUint, std::list<Track*>::iterator> >& aTracks, const TUint aId);
+	static TBool TrackBefore(const std::pair<TUint, std::list<Track*>::iterator>& aA, const std::pair<TUint, std::list<Track*>::iterator>& aB);
 	
 private:
 	const TUint iId;
@@ -156,6 +218,7 @@ private:
 	IdGenerator iIdGenerator;
 	
 	std::list<Track*> iTracks;
+	mutable std::vector<Track*> iPositions;
 	Bws<kMaxTracks> iIdArray;
 };
 
@@ -175,13 +238,31 @@ public:
 	static const TUint kMaxCacheSize = 1000;
 	
 public:
-	Cache();
+	Cache(IFileStore& aStore);
+	~Cache();
 	
 	PlaylistData& Data(const Playlist& aPlaylist, ICacheListener* aCacheListener);
 	
+	// takes ownership of data built in memory, unowned until a playlist asks for it
+	void Add(PlaylistData* aData);
+	
+	// drops the data of a deleted playlist
+	void Remove(const TUint aId);
+	
+	// load a playlist without holding the cache lock; the data is unowned until
+	// a playlist next asks for it.  Returns the number of tracks.
+	TUint Prefetch(const TUint aId, const Brx& aFilename);
+	
+	// ids of the most recently used playlists, most recent first
+	void Recent(std::vector<TUint>& aIds, const TUint aMax) const;
+	
 private:
+	std::list< std::pair<PlaylistData*, ICacheListener*> >::iterator Find(const TUint aId);
+	void Evict();
 	
-	Mutex iMutex;
+private:
+	mutable Mutex iMutex;
+	IFileStore& iStore;
 	
 	std::list< std::pair<PlaylistData*, ICacheListener*> > iList;
 };	
@@ -189,14 +270,24 @@ private:
 
 class Playlist : public IPlaylistHeader, public IPlaylistData, public ICacheListener
 {
+public:
+	// id, token, image id, track count, bytes and the two length-prefixed strings
+	static const TUint kMaxIndexBytes = 22 + PlaylistHeader::kMaxNameBytes + PlaylistHeader::kMaxDescriptionBytes;
+	
 public:
 	Playlist(Cache* aCache, const TUint aId, const Brx& aFilename, const Brx& aName, const Brx& aDescription, const TUint aImageId);
+	Playlist(Cache* aCache, const TUint aId, const Brx& aFilename, const Brx& aName, const Brx& aDescription, const TUint aImageId, const TUint aToken, const TUint aTrackCount, const TUint aBytes);
 	Playlist(Cache* aCache, const TUint aId, const Brx& aFilename, IReader& aReader);
 	
+	void Load(IReader& aReader);
+	
 	const TUint Id() const;
 	bool IsId(const TUint aId) const;
 	
 	const TUint Token() const;
+	const TUint TrackCount() const;
+	const TUint Bytes() const;
+	void SetBytes(const TUint aBytes);
 	
 	virtual const Brx& Filename() const;
 	virtual void Name(Bwx& aName) const;
@@ -214,7 +305,18 @@ public:
 	virtual void Delete(const TUint aId);
 	virtual void DeleteAll();
 	
-	void ToXml(IWriter& aWriter);
+	void InsertList(const TUint aAfterId, const std::vector<Brn>& aMetadata, std::vector<TUint>& aNewIds);
+	TUint DeleteList(const Brx& aIdArray, std::vector<TUint>& aMissing);
+	void MoveList(const std::vector<TUint>& aTrackIds, const TUint aAfterId);
+	TUint ReadRange(const TUint aStart, const TUint aCount, Bwx& aBatch);
+	TUint ReadBatch(const Brx& aIdArray, Bwx& aBatch);
+	TUint ReadEntries(const Brx& aIdArray, Bwx& aEntries);
+	
+	void ToXml(WriterVector& aWriter);
+	void HeaderToXml(IWriter& aWriter) const;
+	void ToIndex(IWriter& aWriter) const;
+	
+	void Prefetch();
 	
 	virtual void RemovedFromCache();
 	
@@ -223,16 +325,115 @@ private:
 	
 	const TUint iId;
 	TUint iToken;
+	TUint iTrackCount;
+	TUint iBytes;
 	
 	Cache* iCache;
 	PlaylistHeader iHeader;
 	PlaylistData* iData;
 };
 
+
+// Collects the tracks of a playlist being imported
+class PlaylistImport : public IImportHandler
+{
+public:
+	PlaylistImport(PlaylistData& aData);
+	
+	const Brx& Title() const;
+	TUint Skipped() const;
+	
+	virtual void ImportTitle(const Brx& aTitle);
+	virtual void ImportTrack(const Brx& aMetadata);
+	
+private:
+	PlaylistData& iData;
+	Bws<PlaylistHeader::kMaxNameBytes> iTitle;
+	TUint iSkipped;
+};
+
+
+// Collects the items of a DIDL-Lite document, each as a document of its own
+class TrackListImport : public IImportHandler
+{
+public:
+	TrackListImport(TUint aBytes);
+	
+	// valid while the import lives
+	void Tracks(std::vector<Brn>& aTracks) const;
+	
+	virtual void ImportTitle(const Brx& aTitle);
+	virtual void ImportTrack(const Brx& aMetadata);
+	
+private:
+	WriterMemory iData;
+	std::vector<TUint> iOffsets;
+};
+
+
+class IPlaylistLoaderObserver
+{
+public:
+	virtual void PlaylistLoadFailed(Playlist& aPlaylist) = 0;
+	virtual void PlaylistsLoaded() = 0;
+};
+
+
+// Fills in playlists known only from the toc by parsing their files on a
+// bounded pool of worker threads.  Callers can wait for a single playlist
+// while the rest continue to load.  Playlists whose files can't be read are
+// handed to the observer, which owns them, before their waiters are released.
+
+class PlaylistLoader
+{
+public:
+	static const TUint kMaxThreads = 16;
+	
+private:
+	class Job
+	{
+	public:
+		Job(Playlist& aPlaylist);
+		
+		const TUint iId;
+		Playlist& iPlaylist;
+		Semaphore iLoaded;
+	};
+	
+public:
+	PlaylistLoader(IFileStore& aStore, IPlaylistLoaderObserver& aObserver, const TUint aThreads);
+	~PlaylistLoader();
+	
+	void Add(Playlist& aPlaylist);
+	void Start();
+	
+	void Wait(const TUint aId);
+	void Wait();
+	
+private:
+	void Run();
+	void Load(Job& aJob);
+	TBool LoadHeader(Playlist& aPlaylist, const Brx& aFilename);
+	void Finished();
+	
+private:
+	IFileStore& iStore;
+	IPlaylistLoaderObserver& iObserver;
+	TUint iThreads;
+	
+	Mutex iMutex;
+	Semaphore iFinished;
+	std::vector<Job*> iJobs;
+	std::vector<ThreadFunctor*> iWorkers;
+	TUint iNext;
+	TUint iRunning;
+	TBool iQuit;
+};
+
 	
 	
 
-class PlaylistManager : public INameable, public IPlaylistManagerListener
+class PlaylistManager : public INameable, public IPlaylistManagerListener, private IPlaylistLoaderObserver
 {	
 public:
 	static const TUint kMaxNameBytes = 100;
@@ -240,13 +441,45 @@ public:
 	static const TUint kMaxMimeTypeBytes = 100;
 	static const TUint kMaxMetadataBytes = 1024;
 	static const TUint kMaxPlaylists = 500;
+	static const TUint kMaxRecent = 32;
+	static const TUint kExportBatchBytes = 64 * 1024;
+	static const TUint kReadBatchBytes = 64 * 1024;
+	static const TUint kMaxChanges = 256;
+	static const TUint kChangeBytes = 12;
+	static const TUint kMaxChangeBytes = kMaxChanges * 2 * kChangeBytes;
+	
+	enum EChange
+	{
+		eChangeInserted = 1,
+		eChangeDeleted = 2,
+		eChangeMoved = 3,
+		eChangeToken = 4
+	};
+	
+private:
+	class Change
+	{
+	public:
+		Change(const TUint aToken, const EChange aKind, const TUint aId, const TUint aValue);
+		
+		TUint iToken;
+		EChange iKind;
+		TUint iId;
+		TUint iValue;
+	};
 	
 public:
-    PlaylistManager(OpenHome::Net::DvDevice& aDevice, const TIpAddress& aAdapter, const Brx& aName, const Brx& aImage, const Brx& aMimeType);
+    PlaylistManager(OpenHome::Net::DvDevice& aDevice, IFileStore& aStore, const TIpAddress& aAdapter, const Brx& aName, const Brx& aImage, const Brx& aMimeType, const TUint aLoaderThreads, const TBool aProgressive);
 	virtual ~PlaylistManager();
 	
 	void SetListener(IPlaylistManagerListener& aListener);
 	
+	// load the most recently used playlists into the cache in the background
+	void Prewarm(const TUint aCount);
+	
+	// bytes the collector has given back to the store since startup
+	TUint64 ReclaimedBytes() const;
+	
 	virtual void MetadataChanged();
 	virtual void PlaylistsChanged();
 	virtual void PlaylistChanged();
@@ -261,12 +494,24 @@ public:
 	const TUint Token() const;
 	const TBool TokenChanged(const TUint aToken) const;
 	
+	// Writes the playlist inserts, deletes and moves made since aToken, in
+	// the order they were made, then the current token of every playlist
+	// inserted or changed meanwhile.  Each entry is a big endian kind, id and
+	// value: the playlist it now follows, 0 for the start, when inserted or
+	// moved, or its token.  Returns false, writing nothing, if aToken is
+	// older than the last kMaxChanges changes or came from an earlier run;
+	// IdArray and TokenArray must then be read in full.
+	TBool ChangesSince(const TUint aToken, Bwx& aChanges, TUint& aNewToken) const;
+	
 	void ImagesXml(IWriter& aWriter) const;
 	void Metadata(Bwx& aMetadata) const;
 	void IdArray(Bwx& aIdArray) const;
 	void TokenArray(Bwx& aTokenArray) const;
 	void PlaylistReadList(std::vector<TUint>& aIdList, IWriter& aWriter) const;
 	void PlaylistRead(const TUint aId, Bwx& aName, Bwx& aDescription, TUint& aImageId) const;
+	// Changes are made in memory and heard by listeners even when the store
+	// can't save them, and the call then throws PlaylistStoreError.  This
+	// holds for every change to a playlist or its tracks below.
 	void PlaylistSetName(const TUint aId, const Brx& aName);
 	void PlaylistSetDescription(const TUint aId, const Brx& aDescription);
 	void PlaylistSetImageId(const TUint aId, TUint& aImageId);
@@ -279,17 +524,99 @@ public:
 	bool PlaylistExists(const TUint aId) const;
 	void Read(const TUint aId, const TUint aTrackId, Bwx& aMetadata);
 	void ReadList(const TUint aId, std::vector<TUint>& aIdList, IWriter& aWriter);
+	
+	// Takes the ids as a big endian array, as IdArray gives them.  Entries
+	// are copied straight from track storage into a batch with the manager
+	// locked, and each batch goes to aWriter in one write with it free.
+	// Metadata goes out as it is, DIDL-Lite embedded in the TrackList.
+	// Throws PlaylistError if the array isn't whole ids or names more than a
+	// playlist can hold.
+	void ReadList(const TUint aId, const Brx& aIdArray, IWriter& aWriter);
+	
+	// Writes the same TrackList as ReadList for up to aCount tracks from
+	// position aStart, fewer if the playlist ends first.  Tracks are copied a
+	// batch at a time with the manager locked, then written with it free.
+	void ReadRange(const TUint aId, const TUint aStart, const TUint aCount, IWriter& aWriter);
+	
 	const TUint Insert(const TUint aId, const TUint aAfterId, const Brx& aMetadata);
+	
+	// Adds the tracks in order after aAfterId with one save and one change
+	// for listeners, appending their ids to aNewIds.  Throws PlaylistFull,
+	// adding nothing, if they won't all fit.
+	void InsertList(const TUint aId, const TUint aAfterId, const std::vector<Brn>& aMetadata, std::vector<TUint>& aNewIds);
+	
 	void Delete(const TUint aId, const TUint aTrackId);
+	
+	// Removes the tracks named in the big endian aIdArray with one save and
+	// one change for listeners.  Ids not in the playlist are appended to
+	// aMissing and don't stop the rest.
+	void DeleteList(const TUint aId, const Brx& aIdArray, std::vector<TUint>& aMissing);
+	
 	void DeleteAll(const TUint aId);
+	
+	// Moves a track to follow aAfterTrackId, 0 for the start, keeping its id.
+	void Move(const TUint aId, const TUint aTrackId, const TUint aAfterTrackId);
+	
+	// Moves the tracks in the big endian aIdArray, in that order, to follow
+	// aAfterTrackId with one save and one change for listeners.  Throws
+	// PlaylistError, moving nothing, if the list can't be applied whole.
+	void MoveList(const TUint aId, const Brx& aIdArray, const TUint aAfterTrackId);
+	
+	// Adds a playlist at the end of the list for each M3U, XSPF or DIDL-Lite
+	// file, its tracks parsed straight into track storage.  Each playlist is
+	// written once and listeners hear a single change when all are in.
+	// Returns the number of tracks imported.
+	TUint Import(const std::vector<const TChar*>& aFilenames);
+	
+	// Streams a playlist to aWriter, a batch of tracks at a time with the
+	// manager locked only while the batch is copied out, so memory use is the
+	// same for any length of playlist.  Tracks deleted meanwhile are left out.
+	void Export(const TUint aId, PlaylistExporter::EFormat aFormat, IWriter& aWriter);
+	
+	// every playlist, each to its own file in aStore named by its id;
+	// returns the number written
+	TUint Export(IFileStore& aStore, PlaylistExporter::EFormat aFormat);
+	
+	// Writes a tar archive of the toc and every playlist as they were when
+	// the call began.  Changes made meanwhile go ahead: a playlist about to
+	// change is copied first if the archive hasn't reached it yet.
+	void Snapshot(IWriter& aWriter);
 
 private:
 	void WriteToc() const;
+	void WriteToc(IFileWriter& aFile) const;
 	void WritePlaylist(Playlist& aPlaylist) const;
+	void WriteHeader(const Playlist& aPlaylist) const;
+	void WriteIndex();
+	
+	TUint ReadIndex(Bwh& aIndex, TUint& aOffset, TUint& aToken);
+	Playlist* IndexedPlaylist(const Brx& aIndex, TUint& aOffset, const TUint aId, const Brx& aFilename);
+	void Recent(std::vector<TUint>& aIds) const;
+	
+	void PrewarmRun();
+	
+	void CollectorRun();
+	void Collect();
+	
+	WriterMemory* Capture(Playlist& aPlaylist) const;
+	void Preserve(Playlist& aPlaylist);
+	void EndSnapshot();
+	
+	void WaitLoaded(const TUint aId) const;
+	
+	// false if the store couldn't make what was written durable
+	TBool Sync();
+	
+	// moves the token on, called with the manager locked
+	void RecordChange(const EChange aKind, const TUint aId, const TUint aValue);
+	
+	virtual void PlaylistLoadFailed(Playlist& aPlaylist);
+	virtual void PlaylistsLoaded();
 	
 	mutable Mutex iMutex;
 	
 	OpenHome::Net::DvDevice& iDevice;
+	IFileStore& iStore;
 	IPlaylistManagerListener* iListener;
 	
 	IdGenerator iIdGenerator;
@@ -302,6 +629,36 @@ private:
 	
 	std::list<Playlist*> iPlaylists;
 	TUint iToken;
+	
+	// one change for every token since iChangesFrom
+	std::deque<Change> iChanges;
+	TUint iChangesFrom;
+	TUint iIndexToken;
+	
+	PlaylistLoader* iLoader;
+	TBool iLoading;
+	TBool iIndexStale;
+	TBool iTocStale;
+	TBool iTocComplete;
+	TBool iLoadFailed;
+	std::vector<TUint> iUnreadable; // ids of playlists that failed to load
+	TUint iStartTime;
+	
+	std::vector<TUint> iRecent;
+	ThreadFunctor* iPrewarmThread;
+	TUint iPrewarmCount;
+	TBool iPrewarmQuit;
+	
+	// removes files the toc no longer lists, after deletes and once at startup
+	ThreadFunctor* iCollectorThread;
+	Semaphore iCollect;
+	TBool iCollectorQuit;
+	TUint64 iReclaimedBytes;
+	
+	Mutex iSnapshotMutex;
+	TBool iSnapshotting;
+	std::vector<TUint> iSnapshotPending;
+	std::list< std::pair<TUint, WriterMemory*> > iSnapshotCopies;
 };
 	
 
@@ -341,8 +698,8 @@ namespace Net {
 	class ProviderPlaylistManager : public DvProviderAvOpenhomeOrgPlaylistManager1, public OpenHome::Media::IPlaylistManagerListener, public INonCopyable
 	{
 	public:
-		ProviderPlaylistManager(DvDevice& aDevice, OpenHome::Media::PlaylistManager& aPlaylistManager, const TUint aMaxPlaylistCount, const TUint aMaxTrackCount);
-		~ProviderPlaylistManager() {}
+		ProviderPlaylistManager(DvDevice& aDevice, OpenHome::Media::PlaylistManager& aPlaylistManager, const TUint aMaxPlaylistCount, const TUint aMaxTrackCount, const TUint aLatencyMs);
+		~ProviderPlaylistManager();
 		
 		virtual void MetadataChanged();
 		virtual void PlaylistsChanged();
@@ -370,10 +727,42 @@ namespace Net {
 		virtual void DeleteId(IDvInvocation& aResponse, TUint aId, TUint aTrackId);
 		virtual void DeleteAll(IDvInvocation& aResponse, TUint aTrackId);
 		
+		void Schedule(TBool aMetadata, TBool aIdArray, TBool aTokenArray);
+		void Publish(TBool aMetadata, TBool aIdArray, TBool aTokenArray);
+		void PublisherRun();
+		
 		void UpdateMetadata();
 		void UpdateIdArray();
 		void UpdateTokenArray();
-		void UpdateArrays();
+		
+		OpenHome::Media::PlaylistManager& iPlaylistManager;
+		
+		const TUint iLatencyMs;
+		Mutex iPublishMutex;
+		Semaphore iPublish;
+		TBool iMetadataDirty;
+		TBool iIdArrayDirty;
+		TBool iTokenArrayDirty;
+		TBool iPublisherQuit;
+		ThreadFunctor* iPublisherThread;
+	};
+	
+	// The actions av.openhome.org:PlaylistManager:1 has no room for, on a
+	// service of their own.  Changes made here reach control points through
+	// the properties of ProviderPlaylistManager, so there are none here.
+	class ProviderPlaylistManagerExtension : public DvProviderAvOpenhomeOrgPlaylistManagerExtension1, public INonCopyable
+	{
+	public:
+		ProviderPlaylistManagerExtension(DvDevice& aDevice, OpenHome::Media::PlaylistManager& aPlaylistManager);
+		
+	private:
+		virtual void InsertList(IDvInvocation& aResponse, TUint aId, TUint aAfterTrackId, const Brx& aMetadataList, IDvInvocationResponseBinary& aNewIdArray);
+		virtual void DeleteList(IDvInvocation& aResponse, TUint aId, const Brx& aIdArray, IDvInvocationResponseBinary& aMissingIdArray);
+		virtual void Move(IDvInvocation& aResponse, TUint aId, TUint aTrackId, TUint aAfterTrackId);
+		virtual void MoveList(IDvInvocation& aResponse, TUint aId, const Brx& aIdArray, TUint aAfterTrackId);
+		virtual void ReadRange(IDvInvocation& aResponse, TUint aId, TUint aStart, TUint aCount, IDvInvocationResponseString& aTrackList);
+		virtual void ReadListArray(IDvInvocation& aResponse, TUint aId, const Brx& aIdArray, IDvInvocationResponseString& aTrackList);
+		virtual void ChangesSince(IDvInvocation& aResponse, TUint aToken, IDvInvocationResponseBool& aValid, IDvInvocationResponseUint& aNewToken, IDvInvocationResponseBinary& aChanges);
 		
 		OpenHome::Media::PlaylistManager& iPlaylistManager;
 	};
@@ -0,0 +1,650 @@
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Ascii.h>
+#include <OpenHome/Private/Converter.h>
+#include <OpenHome/Private/OptionParser.h>
+#include <OpenHome/Net/Core/DvDevice.h>
+#include <OpenHome/Net/Core/OhNet.h>
+#include <OpenHome/Private/OsWrapper.h>
+#include <OpenHome/Private/Thread.h>
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "PlaylistManager.h"
+#include "PagedStore.h"
+#include "MemoryStore.h"
+#include "XmlTokenizer.h"
+
+// Measures the figures quoted for the playlist loader, the escaper, the file
+// stores, snapshots, import and the durability modes.  Files are written to
+// the root directory, which must start out empty, and removed afterwards.
+
+using namespace OpenHome;
+using namespace OpenHome::Net;
+using namespace OpenHome::TestFramework;
+using namespace OpenHome::Media;
+
+#ifdef _WIN32
+#define CDECL __cdecl
+#else
+#define CDECL
+#endif
+
+// a DIDL-Lite item as control points send them, dense in characters that need escaping
+static const Brn kTrack("<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\"><item id=\"1\" parentID=\"0\" restricted=\"1\"><dc:title>Rock &amp; Roll 'Live'</dc:title><upnp:artist>Artist</upnp:artist><res protocolInfo=\"http-get:*:audio/x-flac:*\" size=\"12345\">http://192.168.1.2:9000/music/1/download.flac?a=1&amp;b=2</res><upnp:albumArtURI>http://192.168.1.2:9000/art/1.jpg</upnp:albumArtURI><upnp:class>object.item.audioItem.musicTrack</upnp:class></item></DIDL-Lite>");
+
+static const TUint kLoadRepeats = 100;
+static const TUint kEscapeRepeats = 20000;
+static const TUint kStoreFiles = 200;
+static const TUint kStoreFileBytes = 64 * 1024;
+static const TUint kSnapshotPlaylists = 50;
+static const TUint kSnapshotTracks = 500;
+static const TUint kSnapshotInserts = 300;
+static const TUint kImportFiles = 100;
+static const TUint kImportRepeats = 5;
+
+class BenchListener : public IPlaylistManagerListener
+{
+public:
+	virtual void MetadataChanged() {}
+	virtual void PlaylistsChanged() {}
+	virtual void PlaylistChanged() {}
+};
+
+// counts what it is given and throws it away
+class WriterNull : public IWriter
+{
+public:
+	WriterNull() : iBytes(0) {}
+
+	virtual void Write(TByte /*aValue*/) { ++iBytes; }
+	virtual void Write(const Brx& aBuffer) { iBytes += aBuffer.Bytes(); }
+	virtual void WriteFlush() {}
+
+	TUint64 iBytes;
+};
+
+// a consumer as slow as a client at the other end of a network
+class WriterSlow : public IWriter
+{
+public:
+	WriterSlow() : iBytes(0), iPending(0) {}
+
+	virtual void Write(TByte /*aValue*/) { ++iBytes; }
+	virtual void Write(const Brx& aBuffer)
+	{
+		iBytes += aBuffer.Bytes();
+		iPending += aBuffer.Bytes();
+		if(iPending > 256 * 1024)
+		{
+			iPending = 0;
+			Thread::Sleep(2);
+		}
+	}
+	virtual void WriteFlush() {}
+
+	TUint64 iBytes;
+
+private:
+	TUint iPending;
+};
+
+static double MegabytesPerSecond(const TUint64 aBytes, const TUint aMs)
+{
+	return (aBytes / 1000000.0) / ((aMs == 0 ? 1 : aMs) / 1000.0);
+}
+
+static TUint PerSecond(const TUint aCount, const TUint aMs)
+{
+	return (TUint)((TUint64)aCount * 1000 / (aMs == 0 ? 1 : aMs));
+}
+
+static void Percentiles(const TChar* aName, std::vector<TUint>& aLatencies)
+{
+	std::sort(aLatencies.begin(), aLatencies.end());
+	printf("  %s: %u inserts, p50 %u ms, p99 %u ms, max %u ms\n", aName, (TUint)aLatencies.size(), aLatencies[aLatencies.size() / 2], aLatencies[aLatencies.size() * 99 / 100], aLatencies.back());
+}
+
+static void Path(const Brx& aRoot, const Brx& aName, Bwx& aPath)
+{
+	aPath.Replace(aRoot);
+	aPath.Append('/');
+	aPath.Append(aName);
+}
+
+static void Clear(IFileStore& aStore)
+{
+	std::vector<IFileStore::Record> records;
+	aStore.Records(records);
+	for(std::vector<IFileStore::Record>::const_iterator i = records.begin(); i != records.end(); ++i)
+	{
+		aStore.Remove(i->iName);
+	}
+	aStore.Sync();
+}
+
+// The loader as it was before XmlTokenizer: ReadUntil over an Srs, with each
+// track's metadata copied out and unescaped in place.
+static TUint LoadReadUntil(IReaderSource& aFile, std::vector<Track*>& aTracks)
+{
+	Srs<Track::kMaxMetadataBytes> reader(aFile);
+	TUint id = 0;
+
+	try
+	{
+		for(;;)
+		{
+			reader.ReadUntil('<');
+			if(reader.ReadUntil('>') == Brn("/ImageId"))
+			{
+				break;
+			}
+		}
+
+		for(;;)
+		{
+			reader.ReadUntil('<');
+			if(reader.ReadUntil('>') != Brn("Track"))
+			{
+				break;
+			}
+			reader.ReadUntil('<');
+			if(reader.ReadUntil('>') == Brn("Metadata"))
+			{
+				Brn escaped = reader.ReadUntil('<');
+				Bws<Track::kMaxMetadataBytes * 2> metadata;
+				metadata.Replace(escaped);
+				Converter::FromXmlEscaped(metadata);
+				aTracks.push_back(new Track(++id, metadata));
+				reader.ReadUntil('>');
+				reader.ReadUntil('>');
+			}
+		}
+	}
+	catch(ReaderFileError)
+	{
+	}
+
+	return id;
+}
+
+// Playlist files, read through the old loader and XmlTokenizer, MB/s.
+static void BenchLoad()
+{
+	MemoryStore store(NULL);
+
+	IFileWriter* file = store.OpenWriter(Brn("1.txt"));
+	file->Write(Brn("<Playlist>\n  <Name>Bench</Name>\n  <Description></Description>\n  <ImageId>0</ImageId>\n"));
+	for(TUint i = 0; i < PlaylistData::kMaxTracks; ++i)
+	{
+		file->Write(Brn("  <Track>\n    <Metadata>"));
+		Converter::ToXmlEscaped(*file, kTrack);
+		file->Write(Brn("</Metadata>\n  </Track>\n"));
+	}
+	file->Write(Brn("</Playlist>\n"));
+	file->Close();
+	delete file;
+	store.Sync();
+
+	std::vector<IFileStore::Record> records;
+	store.Records(records);
+	TUint64 bytes = (TUint64)records[0].iBytes * kLoadRepeats;
+
+	TUint start = Os::TimeInMs();
+	for(TUint i = 0; i < kLoadRepeats; ++i)
+	{
+		IReaderSource* reader = store.OpenReader(Brn("1.txt"));
+		std::vector<Track*> tracks;
+		LoadReadUntil(*reader, tracks);
+		for(std::vector<Track*>::iterator j = tracks.begin(); j != tracks.end(); ++j)
+		{
+			delete *j;
+		}
+		delete reader;
+	}
+	TUint old = Os::TimeInMs() - start;
+
+	start = Os::TimeInMs();
+	for(TUint i = 0; i < kLoadRepeats; ++i)
+	{
+		PlaylistData data(store, 1, Brn("1.txt"));
+	}
+	TUint tokenizer = Os::TimeInMs() - start;
+
+	printf("load: %u tracks, %u bytes a file\n", PlaylistData::kMaxTracks, records[0].iBytes);
+	printf("  ReadUntil %.0f MB/s, XmlTokenizer %.0f MB/s\n", MegabytesPerSecond(bytes, old), MegabytesPerSecond(bytes, tokenizer));
+}
+
+// DIDL-Lite dense in specials, escaped by Converter and XmlEscaper, MB/s.
+static void BenchEscape()
+{
+	WriterNull converter;
+	WriterNull escaper;
+
+	TUint start = Os::TimeInMs();
+	for(TUint i = 0; i < kEscapeRepeats; ++i)
+	{
+		Converter::ToXmlEscaped(converter, kTrack);
+	}
+	TUint old = Os::TimeInMs() - start;
+
+	start = Os::TimeInMs();
+	for(TUint i = 0; i < kEscapeRepeats; ++i)
+	{
+		XmlEscaper::Write(escaper, kTrack);
+	}
+	TUint vectored = Os::TimeInMs() - start;
+
+	TUint64 bytes = (TUint64)kTrack.Bytes() * kEscapeRepeats;
+	printf("escape: %u bytes of DIDL-Lite, %u bytes escaped\n", kTrack.Bytes(), (TUint)(escaper.iBytes / kEscapeRepeats));
+	printf("  Converter::ToXmlEscaped %.0f MB/s, XmlEscaper %.0f MB/s\n", MegabytesPerSecond(bytes, old), MegabytesPerSecond(bytes, vectored));
+}
+
+// Flush: files written and synced.  Load: read back with the page cache
+// dropped for each file first where the platform allows it.
+static void BenchStore(const Brx& aRoot, const TBool aUring)
+{
+	Brhz root(aRoot);
+	FileStoreDirectory store(root.CString(), aUring, Durability(Durability::eCommit, 0));
+
+	Bwh data(kStoreFileBytes);
+	for(TUint i = 0; i < kStoreFileBytes; ++i)
+	{
+		data.Append((TByte)('a' + i % 26));
+	}
+
+	TUint start = Os::TimeInMs();
+	for(TUint i = 0; i < kStoreFiles; ++i)
+	{
+		Bws<Ascii::kMaxUintStringBytes + 5> name("Bench");
+		Ascii::AppendDec(name, i);
+		IFileWriter* file = store.OpenWriter(name);
+		file->Write(data);
+		file->Close();
+		delete file;
+	}
+	store.Sync();
+	TUint flush = Os::TimeInMs() - start;
+
+#ifdef __linux__
+	for(TUint i = 0; i < kStoreFiles; ++i)
+	{
+		Bws<Ascii::kMaxUintStringBytes + 5> name("Bench");
+		Ascii::AppendDec(name, i);
+		Bws<FileStoreDirectory::kMaxFilenameBytes> path;
+		Path(aRoot, name, path);
+		int fd = open(path.PtrZ(), O_RDONLY);
+		if(fd >= 0)
+		{
+			posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+			close(fd);
+		}
+	}
+#endif
+
+	TUint64 bytes = 0;
+	start = Os::TimeInMs();
+	for(TUint i = 0; i < kStoreFiles; ++i)
+	{
+		Bws<Ascii::kMaxUintStringBytes + 5> name("Bench");
+		Ascii::AppendDec(name, i);
+		IReaderSource* reader = store.OpenReader(name);
+		Bws<4096> buffer;
+		try
+		{
+			for(;;)
+			{
+				reader->Read(buffer);
+				bytes += buffer.Bytes();
+			}
+		}
+		catch(ReaderFileError)
+		{
+		}
+		delete reader;
+	}
+	TUint load = Os::TimeInMs() - start;
+
+	Clear(store);
+
+	printf("  %s: flush %.0f MB/s, load %.0f MB/s\n", aUring ? "io_uring" : "stdio", MegabytesPerSecond((TUint64)kStoreFiles * kStoreFileBytes, flush), MegabytesPerSecond(bytes, load));
+}
+
+class BenchSnapshot
+{
+public:
+	BenchSnapshot(PlaylistManager& aManager)
+		: iManager(aManager)
+		, iMutex("BSnp")
+		, iDone(false)
+		, iMs(0)
+		, iBytes(0)
+	{
+	}
+
+	void Run()
+	{
+		WriterSlow writer;
+		TUint start = Os::TimeInMs();
+		iManager.Snapshot(writer);
+
+		iMutex.Wait();
+		iMs = Os::TimeInMs() - start;
+		iBytes = writer.iBytes;
+		iDone = true;
+		iMutex.Signal();
+	}
+
+	TBool Done()
+	{
+		iMutex.Wait();
+		TBool done = iDone;
+		iMutex.Signal();
+		return done;
+	}
+
+	PlaylistManager& iManager;
+	Mutex iMutex;
+	TBool iDone;
+	TUint iMs;
+	TUint64 iBytes;
+};
+
+static void TimedInsert(PlaylistManager& aManager, const Brx& aIds, const TUint aIndex, std::vector<TUint>& aLatencies)
+{
+	TUint id = BigEndianConverter::BigEndianToUint32(aIds, (aIndex % (aIds.Bytes() / 4)) * 4);
+	TUint start = Os::TimeInMs();
+	aManager.Insert(id, 0, kTrack);
+	aLatencies.push_back(Os::TimeInMs() - start);
+}
+
+// Insert latency with and without a snapshot streaming to a slow client.
+static void BenchSnapshots(DvDevice& aDevice, const Brx& aRoot)
+{
+	Brhz root(aRoot);
+	FileStoreDirectory store(root.CString(), false, Durability(Durability::eNone, 0));
+	BenchListener listener;
+	PlaylistManager* manager = new PlaylistManager(aDevice, store, 0, Brn("Bench"), Brx::Empty(), Brx::Empty(), 4, false);
+	manager->SetListener(listener);
+
+	for(TUint i = 0; i < kSnapshotPlaylists; ++i)
+	{
+		TUint id = manager->PlaylistInsert(0, Brn("Bench"), Brx::Empty(), 0);
+		std::vector<Brn> tracks(kSnapshotTracks, kTrack);
+		std::vector<TUint> ids;
+		manager->InsertList(id, 0, tracks, ids);
+	}
+
+	Bws<PlaylistManager::kMaxPlaylists * 4> ids;
+	manager->IdArray(ids);
+
+	printf("snapshot: %u playlists of %u tracks\n", kSnapshotPlaylists, kSnapshotTracks);
+
+	std::vector<TUint> alone;
+	for(TUint i = 0; i < kSnapshotInserts; ++i)
+	{
+		TimedInsert(*manager, ids, i, alone);
+	}
+	Percentiles("no snapshot", alone);
+
+	BenchSnapshot snapshot(*manager);
+	ThreadFunctor* thread = new ThreadFunctor("BSnp", MakeFunctor(snapshot, &BenchSnapshot::Run));
+	thread->Start();
+
+	std::vector<TUint> during;
+	for(TUint i = 0; !snapshot.Done(); ++i)
+	{
+		TimedInsert(*manager, ids, i, during);
+	}
+	delete thread;
+
+	Percentiles("during snapshot", during);
+	printf("  snapshot of %llu bytes took %u ms\n", (unsigned long long)snapshot.iBytes, snapshot.iMs);
+
+	delete manager;
+	Clear(store);
+}
+
+// M3U files of a full playlist each, imported into memory, tracks/s.
+static void BenchImport(DvDevice& aDevice, const Brx& aRoot)
+{
+	std::vector<Brhz*> paths;
+	std::vector<const TChar*> filenames;
+
+	for(TUint i = 0; i < kImportFiles; ++i)
+	{
+		Bws<Ascii::kMaxUintStringBytes + 9> name("Bench");
+		Ascii::AppendDec(name, i);
+		name.Append(".m3u");
+		Bws<FileStoreDirectory::kMaxFilenameBytes> path;
+		Path(aRoot, name, path);
+
+		WriterFile file(path.PtrZ());
+		file.Write(Brn("#EXTM3U\n"));
+		for(TUint j = 0; j < PlaylistData::kMaxTracks; ++j)
+		{
+			Bws<Ascii::kMaxUintStringBytes> number;
+			Ascii::AppendDec(number, j);
+			file.Write(Brn("#EXTINF:215,Artist - Title "));
+			file.Write(number);
+			file.Write(Brn("\nhttp://192.168.1.2:9000/music/"));
+			file.Write(number);
+			file.Write(Brn("/download.flac\n"));
+		}
+		file.Close();
+
+		paths.push_back(new Brhz(path));
+		filenames.push_back(paths.back()->CString());
+	}
+
+	// A fresh manager each time.  The first run is the one a migration sees,
+	// with every page of the heap new to the process; the median of the rest
+	// shows what is left once the allocator has memory to hand back.
+	std::vector<TUint> rates;
+	TUint tracks = 0;
+	for(TUint i = 0; i < kImportRepeats; ++i)
+	{
+		MemoryStore store(NULL);
+		BenchListener listener;
+		PlaylistManager* manager = new PlaylistManager(aDevice, store, 0, Brn("Bench"), Brx::Empty(), Brx::Empty(), 4, false);
+		manager->SetListener(listener);
+
+		TUint start = Os::TimeInMs();
+		tracks = manager->Import(filenames);
+		TUint ms = Os::TimeInMs() - start;
+		rates.push_back(PerSecond(tracks, ms));
+
+		delete manager;
+	}
+
+	TUint first = rates.front();
+	std::sort(rates.begin() + 1, rates.end());
+	printf("import: %u tracks from %u M3U files, %u tracks/s first, median %u tracks/s over the next %u runs\n", tracks, kImportFiles, first, rates[1 + (rates.size() - 1) / 2], kImportRepeats - 1);
+
+	for(std::vector<Brhz*>::iterator i = paths.begin(); i != paths.end(); ++i)
+	{
+		remove((*i)->CString());
+		delete *i;
+	}
+}
+
+class BenchInserter
+{
+public:
+	BenchInserter(PlaylistManager& aManager, const TUint aId, const TUint aActions, Semaphore& aDone)
+		: iManager(aManager)
+		, iId(aId)
+		, iActions(aActions)
+		, iDone(aDone)
+	{
+	}
+
+	void Run()
+	{
+		for(TUint i = 0; i < iActions; ++i)
+		{
+			iManager.Insert(iId, 0, kTrack);
+		}
+		iDone.Signal();
+	}
+
+private:
+	PlaylistManager& iManager;
+	TUint iId;
+	TUint iActions;
+	Semaphore& iDone;
+};
+
+static void BenchDurability(DvDevice& aDevice, IFileStore& aStore, const TChar* aKind, const Durability& aDurability, const TUint aThreads, const TUint aActions)
+{
+	BenchListener listener;
+	PlaylistManager* manager = new PlaylistManager(aDevice, aStore, 0, Brn("Bench"), Brx::Empty(), Brx::Empty(), 4, false);
+	manager->SetListener(listener);
+
+	Semaphore done("BDur", 0);
+	std::vector<BenchInserter*> inserters;
+	std::vector<ThreadFunctor*> threads;
+	for(TUint i = 0; i < aThreads; ++i)
+	{
+		TUint id = manager->PlaylistInsert(0, Brn("Bench"), Brx::Empty(), 0);
+		inserters.push_back(new BenchInserter(*manager, id, aActions, done));
+		threads.push_back(new ThreadFunctor("BIns", MakeFunctor(*inserters.back(), &BenchInserter::Run)));
+	}
+
+	TUint start = Os::TimeInMs();
+	for(TUint i = 0; i < aThreads; ++i)
+	{
+		threads[i]->Start();
+	}
+	for(TUint i = 0; i < aThreads; ++i)
+	{
+		done.Wait();
+	}
+	TUint ms = Os::TimeInMs() - start;
+
+	for(TUint i = 0; i < aThreads; ++i)
+	{
+		delete threads[i];
+		delete inserters[i];
+	}
+	delete manager;
+	Clear(aStore);
+
+	printf("  %-6s %-9s %u threads: %u actions/s\n", aKind, Durability::Name(aDurability.iMode), aThreads, PerSecond(aThreads * aActions, ms));
+}
+
+// Inserts a second from 1 and 4 threads, for each store and durability mode.
+static void BenchDurability(DvDevice& aDevice, const Brx& aRoot, const TUint aActions)
+{
+	Brhz root(aRoot);
+	Bws<FileStoreDirectory::kMaxFilenameBytes> paged;
+	Path(aRoot, Brn("Bench.db"), paged);
+
+	Durability::EMode modes[] = { Durability::eNone, Durability::eInterval, Durability::eCommit };
+	TUint threads[] = { 1, 4 };
+
+	printf("durability: %u inserts a thread\n", aActions);
+
+	for(TUint i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i)
+	{
+		for(TUint j = 0; j < sizeof(threads) / sizeof(threads[0]); ++j)
+		{
+			Durability durability(modes[i], 1000);
+
+			FileStoreDirectory* directory = new FileStoreDirectory(root.CString(), false, durability);
+			BenchDurability(aDevice, *directory, "files", durability, threads[j], aActions);
+			delete directory;
+
+			PagedStore* store = new PagedStore(paged.PtrZ(), durability);
+			BenchDurability(aDevice, *store, "paged", durability, threads[j], aActions);
+			delete store;
+			remove(paged.PtrZ());
+		}
+	}
+}
+
+int CDECL main(int aArgc, char* aArgv[])
+{
+	OptionParser parser;
+
+	OptionString optionRoot("-r", "--root", Brn(""), "[directory] an empty directory for the files the benchmarks write");
+	parser.AddOption(&optionRoot);
+
+	OptionString optionBench("-b", "--bench", Brn("all"), "[name] all, load, escape, store, snapshot, import or durability");
+	parser.AddOption(&optionBench);
+
+	OptionUint optionActions("-n", "--actions", 200, "[count] inserts each thread makes for the durability matrix");
+	parser.AddOption(&optionActions);
+
+	if(!parser.Parse(aArgc, aArgv))
+	{
+		return (1);
+	}
+
+	const Brx& root = optionRoot.Value();
+	const Brx& bench = optionBench.Value();
+	TBool all = (bench == Brn("all"));
+
+	if(root.Bytes() == 0)
+	{
+		printf("No root directory given\n");
+		return (1);
+	}
+
+	{
+		Brhz directory(root);
+		FileStoreDirectory store(directory.CString(), false, Durability(Durability::eNone, 0));
+		std::vector<IFileStore::Record> records;
+		store.Records(records);
+		if(records.size() > 0)
+		{
+			printf("%s is not empty\n", directory.CString());
+			return (1);
+		}
+	}
+
+	InitialisationParams* initParams = InitialisationParams::Create();
+	UpnpLibrary::Initialise(initParams);
+	UpnpLibrary::StartDv();
+
+	DvDeviceStandard* device = new DvDeviceStandard(Brn("PlaylistManagerBench"));
+
+	if(all || bench == Brn("load"))
+	{
+		BenchLoad();
+	}
+	if(all || bench == Brn("escape"))
+	{
+		BenchEscape();
+	}
+	if(all || bench == Brn("store"))
+	{
+		printf("store: %u files of %u bytes\n", kStoreFiles, kStoreFileBytes);
+		BenchStore(root, false);
+		BenchStore(root, true);
+	}
+	if(all || bench == Brn("snapshot"))
+	{
+		BenchSnapshots(*device, root);
+	}
+	if(all || bench == Brn("import"))
+	{
+		BenchImport(*device, root);
+	}
+	if(all || bench == Brn("durability"))
+	{
+		BenchDurability(*device, root, optionActions.Value());
+	}
+
+	delete device;
+
+	UpnpLibrary::Close();
+
+	return (0);
+}
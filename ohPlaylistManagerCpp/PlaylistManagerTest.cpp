@@ -0,0 +1,614 @@
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Ascii.h>
+#include <OpenHome/Private/TestFramework.h>
+#include <OpenHome/Net/Core/DvDevice.h>
+#include <OpenHome/Net/Core/OhNet.h>
+
+#include <stdio.h>
+#include <vector>
+
+#include "PlaylistManager.h"
+#include "MemoryStore.h"
+#include "Import.h"
+
+// Tests for what the actions of ProviderPlaylistManagerExtension ask of the
+// playlist manager.  Each suite starts from an empty store held in memory.
+
+using namespace OpenHome;
+using namespace OpenHome::Net;
+using namespace OpenHome::TestFramework;
+using namespace OpenHome::Media;
+
+#ifdef _WIN32
+#define CDECL __cdecl
+#else
+#define CDECL
+#endif
+
+static const Brn kTrack("<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\" xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\"><item id=\"1\" parentID=\"0\" restricted=\"1\"><dc:title>Track</dc:title><res protocolInfo=\"http-get:*:audio/x-flac:*\">http://192.168.1.2:9000/music/1.flac</res><upnp:class>object.item.audioItem.musicTrack</upnp:class></item></DIDL-Lite>");
+
+class ListenerCount : public IPlaylistManagerListener
+{
+public:
+	ListenerCount();
+
+	virtual void MetadataChanged();
+	virtual void PlaylistsChanged();
+	virtual void PlaylistChanged();
+
+	TUint iPlaylistChanges;
+};
+
+ListenerCount::ListenerCount()
+	: iPlaylistChanges(0)
+{
+}
+
+void ListenerCount::MetadataChanged()
+{
+}
+
+void ListenerCount::PlaylistsChanged()
+{
+}
+
+void ListenerCount::PlaylistChanged()
+{
+	iPlaylistChanges++;
+}
+
+static void Ids(const Brx& aIdArray, std::vector<TUint>& aIds)
+{
+	for(TUint offset = 0; offset < aIdArray.Bytes(); offset += 4)
+	{
+		aIds.push_back(BigEndianConverter::BigEndianToUint32(aIdArray, offset));
+	}
+}
+
+static void AppendId(Bwx& aIdArray, const TUint aId)
+{
+	WriterBuffer writer(aIdArray);
+	WriterBinary binary(writer);
+	binary.WriteUint32Be(aId);
+}
+
+// the ids of the entries in a TrackList, in order
+static void TrackListIds(const Brx& aTrackList, std::vector<TUint>& aIds)
+{
+	const Brn open("<Id>");
+	const Brn close("</Id>");
+	TUint i = 0;
+	while(i + open.Bytes() <= aTrackList.Bytes())
+	{
+		if(Brn(aTrackList.Ptr() + i, open.Bytes()) != open)
+		{
+			i++;
+			continue;
+		}
+		i += open.Bytes();
+		TUint end = i;
+		while(end + close.Bytes() <= aTrackList.Bytes() && Brn(aTrackList.Ptr() + end, close.Bytes()) != close)
+		{
+			end++;
+		}
+		aIds.push_back(Ascii::Uint(Brn(aTrackList.Ptr() + i, end - i)));
+		i = end;
+	}
+}
+
+// InsertList
+
+class SuiteInsertList : public Suite
+{
+public:
+	SuiteInsertList(DvDevice& aDevice);
+
+	virtual void Test();
+
+private:
+	DvDevice& iDevice;
+};
+
+SuiteInsertList::SuiteInsertList(DvDevice& aDevice)
+	: Suite("InsertList")
+	, iDevice(aDevice)
+{
+}
+
+void SuiteInsertList::Test()
+{
+	MemoryStore store(NULL);
+	ListenerCount listener;
+	PlaylistManager* manager = new PlaylistManager(iDevice, store, 0, Brn("Test"), Brx::Empty(), Brx::Empty(), 1, false);
+	manager->SetListener(listener);
+
+	TUint id = manager->PlaylistInsert(0, Brn("Test"), Brx::Empty(), 0);
+	TUint first = manager->Insert(id, 0, kTrack);
+	TUint last = manager->Insert(id, first, kTrack);
+
+	// the metadata list is parsed as the action parses it
+	Bwh document(4 * kTrack.Bytes());
+	document.Append("<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\" xmlns:dc=\"http://purl.org/dc/elements/1.1/\">");
+	for(TUint i = 0; i < 3; i++)
+	{
+		document.Append("<item id=\"");
+		Ascii::AppendDec(document, i);
+		document.Append("\"><dc:title>Track</dc:title></item>");
+	}
+	document.Append("</DIDL-Lite>");
+	ReaderMemory reader(document.Bytes());
+	reader.Data().Replace(document);
+	TrackListImport import(document.Bytes());
+	PlaylistImporter::Parse(PlaylistImporter::eDidlLite, reader, import);
+	std::vector<Brn> tracks;
+	import.Tracks(tracks);
+	TEST(tracks.size() == 3);
+
+	// every id comes back, in order, after the track asked for
+	TUint changes = listener.iPlaylistChanges;
+	std::vector<TUint> newIds;
+	manager->InsertList(id, first, tracks, newIds);
+	TEST(newIds.size() == 3);
+	TEST(listener.iPlaylistChanges == changes + 1);
+
+	Bws<PlaylistData::kMaxTracks * 4> idArray;
+	manager->IdArray(id, idArray);
+	std::vector<TUint> ids;
+	Ids(idArray, ids);
+	TEST(ids.size() == 5);
+	TEST(ids[0] == first);
+	TEST(ids[1] == newIds[0]);
+	TEST(ids[2] == newIds[1]);
+	TEST(ids[3] == newIds[2]);
+	TEST(ids[4] == last);
+
+	// nothing is added when they don't all fit
+	std::vector<Brn> tooMany(PlaylistData::kMaxTracks - 4, kTrack);
+	newIds.clear();
+	TBool full = false;
+	try
+	{
+		manager->InsertList(id, 0, tooMany, newIds);
+	}
+	catch(PlaylistFull)
+	{
+		full = true;
+	}
+	TEST(full);
+	TEST(newIds.size() == 0);
+	manager->IdArray(id, idArray);
+	TEST(idArray.Bytes() == 5 * 4);
+
+	TBool unknown = false;
+	try
+	{
+		manager->InsertList(id, 12345, tracks, newIds);
+	}
+	catch(PlaylistError)
+	{
+		unknown = true;
+	}
+	TEST(unknown);
+
+	delete manager;
+}
+
+// DeleteList
+
+class SuiteDeleteList : public Suite
+{
+public:
+	SuiteDeleteList(DvDevice& aDevice);
+
+	virtual void Test();
+
+private:
+	DvDevice& iDevice;
+};
+
+SuiteDeleteList::SuiteDeleteList(DvDevice& aDevice)
+	: Suite("DeleteList")
+	, iDevice(aDevice)
+{
+}
+
+void SuiteDeleteList::Test()
+{
+	MemoryStore store(NULL);
+	ListenerCount listener;
+	PlaylistManager* manager = new PlaylistManager(iDevice, store, 0, Brn("Test"), Brx::Empty(), Brx::Empty(), 1, false);
+	manager->SetListener(listener);
+
+	TUint id = manager->PlaylistInsert(0, Brn("Test"), Brx::Empty(), 0);
+	std::vector<TUint> tracks;
+	TUint afterId = 0;
+	for(TUint i = 0; i < 5; i++)
+	{
+		afterId = manager->Insert(id, afterId, kTrack);
+		tracks.push_back(afterId);
+	}
+
+	// ids that aren't there come back once each and don't stop the rest
+	Bws<16 * 4> idArray;
+	AppendId(idArray, tracks[1]);
+	AppendId(idArray, tracks[3]);
+	AppendId(idArray, 9999);
+	AppendId(idArray, tracks[1]);
+	TUint changes = listener.iPlaylistChanges;
+	std::vector<TUint> missing;
+	manager->DeleteList(id, idArray, missing);
+	TEST(missing.size() == 1);
+	TEST(missing[0] == 9999);
+	TEST(listener.iPlaylistChanges == changes + 1);
+
+	Bws<PlaylistData::kMaxTracks * 4> remaining;
+	manager->IdArray(id, remaining);
+	std::vector<TUint> ids;
+	Ids(remaining, ids);
+	TEST(ids.size() == 3);
+	TEST(ids[0] == tracks[0]);
+	TEST(ids[1] == tracks[2]);
+	TEST(ids[2] == tracks[4]);
+
+	// a list already gone changes nothing
+	missing.clear();
+	manager->DeleteList(id, idArray, missing);
+	TEST(missing.size() == 3);
+	TEST(listener.iPlaylistChanges == changes + 1);
+
+	TBool unknown = false;
+	try
+	{
+		manager->DeleteList(id + 1, idArray, missing);
+	}
+	catch(PlaylistManagerError)
+	{
+		unknown = true;
+	}
+	TEST(unknown);
+
+	delete manager;
+}
+
+// Move and MoveList
+
+class SuiteMove : public Suite
+{
+public:
+	SuiteMove(DvDevice& aDevice);
+
+	virtual void Test();
+
+private:
+	DvDevice& iDevice;
+};
+
+SuiteMove::SuiteMove(DvDevice& aDevice)
+	: Suite("Move and MoveList")
+	, iDevice(aDevice)
+{
+}
+
+void SuiteMove::Test()
+{
+	MemoryStore store(NULL);
+	ListenerCount listener;
+	PlaylistManager* manager = new PlaylistManager(iDevice, store, 0, Brn("Test"), Brx::Empty(), Brx::Empty(), 1, false);
+	manager->SetListener(listener);
+
+	TUint id = manager->PlaylistInsert(0, Brn("Test"), Brx::Empty(), 0);
+	std::vector<TUint> tracks;
+	TUint afterId = 0;
+	for(TUint i = 0; i < 5; i++)
+	{
+		afterId = manager->Insert(id, afterId, kTrack);
+		tracks.push_back(afterId);
+	}
+
+	// a moved track keeps its id
+	TUint changes = listener.iPlaylistChanges;
+	manager->Move(id, tracks[4], 0);
+	TEST(listener.iPlaylistChanges == changes + 1);
+
+	Bws<PlaylistData::kMaxTracks * 4> idArray;
+	manager->IdArray(id, idArray);
+	std::vector<TUint> ids;
+	Ids(idArray, ids);
+	TEST(ids.size() == 5);
+	TEST(ids[0] == tracks[4]);
+	TEST(ids[1] == tracks[0]);
+	TEST(ids[4] == tracks[3]);
+
+	// the list goes in the order given, after the track asked for
+	Bws<16 * 4> moves;
+	AppendId(moves, tracks[0]);
+	AppendId(moves, tracks[4]);
+	manager->MoveList(id, moves, tracks[2]);
+	TEST(listener.iPlaylistChanges == changes + 2);
+
+	manager->IdArray(id, idArray);
+	ids.clear();
+	Ids(idArray, ids);
+	TEST(ids.size() == 5);
+	TEST(ids[0] == tracks[1]);
+	TEST(ids[1] == tracks[2]);
+	TEST(ids[2] == tracks[0]);
+	TEST(ids[3] == tracks[4]);
+	TEST(ids[4] == tracks[3]);
+
+	// nothing moves if one of them isn't there
+	AppendId(moves, 9999);
+	TBool missing = false;
+	try
+	{
+		manager->MoveList(id, moves, 0);
+	}
+	catch(PlaylistError)
+	{
+		missing = true;
+	}
+	TEST(missing);
+	Bws<PlaylistData::kMaxTracks * 4> unmoved;
+	manager->IdArray(id, unmoved);
+	TEST(unmoved == idArray);
+	TEST(listener.iPlaylistChanges == changes + 2);
+
+	TBool unknown = false;
+	try
+	{
+		manager->Move(id + 1, tracks[0], 0);
+	}
+	catch(PlaylistManagerError)
+	{
+		unknown = true;
+	}
+	TEST(unknown);
+
+	delete manager;
+}
+
+// ReadRange
+
+class SuiteReadRange : public Suite
+{
+public:
+	SuiteReadRange(DvDevice& aDevice);
+
+	virtual void Test();
+
+private:
+	DvDevice& iDevice;
+};
+
+SuiteReadRange::SuiteReadRange(DvDevice& aDevice)
+	: Suite("ReadRange")
+	, iDevice(aDevice)
+{
+}
+
+void SuiteReadRange::Test()
+{
+	MemoryStore store(NULL);
+	PlaylistManager* manager = new PlaylistManager(iDevice, store, 0, Brn("Test"), Brx::Empty(), Brx::Empty(), 1, false);
+
+	TUint id = manager->PlaylistInsert(0, Brn("Test"), Brx::Empty(), 0);
+	std::vector<TUint> tracks;
+	TUint afterId = 0;
+	for(TUint i = 0; i < 10; i++)
+	{
+		afterId = manager->Insert(id, afterId, kTrack);
+		tracks.push_back(afterId);
+	}
+
+	// the tracks at those positions, metadata and all
+	WriterMemory window(1024);
+	manager->ReadRange(id, 3, 4, window);
+	std::vector<TUint> ids;
+	TrackListIds(window.Data(), ids);
+	TEST(ids.size() == 4);
+	TEST(ids[0] == tracks[3]);
+	TEST(ids[3] == tracks[6]);
+	Bwh first(kTrack.Bytes() + 64);
+	first.Append("<TrackList><Entry><Id>");
+	Ascii::AppendDec(first, tracks[3]);
+	first.Append("</Id><Metadata>");
+	first.Append(kTrack);
+	first.Append("</Metadata></Entry>");
+	TEST(window.Data().Bytes() > first.Bytes() && window.Data().Split(0, first.Bytes()) == first);
+
+	// fewer when the playlist ends first, none past its end
+	WriterMemory tail(1024);
+	manager->ReadRange(id, 8, 5, tail);
+	ids.clear();
+	TrackListIds(tail.Data(), ids);
+	TEST(ids.size() == 2);
+	TEST(ids[1] == tracks[9]);
+
+	WriterMemory past(1024);
+	manager->ReadRange(id, 10, 5, past);
+	TEST(past.Data() == Brn("<TrackList></TrackList>"));
+
+	TBool unknown = false;
+	try
+	{
+		WriterMemory missing(1024);
+		manager->ReadRange(id + 1, 0, 1, missing);
+	}
+	catch(PlaylistManagerError)
+	{
+		unknown = true;
+	}
+	TEST(unknown);
+
+	delete manager;
+}
+
+// ReadList from an id array
+
+class SuiteReadListArray : public Suite
+{
+public:
+	SuiteReadListArray(DvDevice& aDevice);
+
+	virtual void Test();
+
+private:
+	DvDevice& iDevice;
+};
+
+SuiteReadListArray::SuiteReadListArray(DvDevice& aDevice)
+	: Suite("ReadList from an id array")
+	, iDevice(aDevice)
+{
+}
+
+void SuiteReadListArray::Test()
+{
+	MemoryStore store(NULL);
+	PlaylistManager* manager = new PlaylistManager(iDevice, store, 0, Brn("Test"), Brx::Empty(), Brx::Empty(), 1, false);
+
+	TUint id = manager->PlaylistInsert(0, Brn("Test"), Brx::Empty(), 0);
+	std::vector<TUint> tracks;
+	TUint afterId = 0;
+	for(TUint i = 0; i < 5; i++)
+	{
+		afterId = manager->Insert(id, afterId, kTrack);
+		tracks.push_back(afterId);
+	}
+
+	// the tracks asked for in the order asked, the same list as from the id vector
+	Bws<16 * 4> idArray;
+	AppendId(idArray, tracks[4]);
+	AppendId(idArray, 9999);
+	AppendId(idArray, tracks[1]);
+	WriterMemory trackList(1024);
+	manager->ReadList(id, idArray, trackList);
+	std::vector<TUint> ids;
+	TrackListIds(trackList.Data(), ids);
+	TEST(ids.size() == 2);
+	TEST(ids[0] == tracks[4]);
+	TEST(ids[1] == tracks[1]);
+
+	std::vector<TUint> idList;
+	Ids(idArray, idList);
+	WriterMemory fromList(1024);
+	manager->ReadList(id, idList, fromList);
+	TEST(fromList.Data() == trackList.Data());
+
+	// an array that isn't whole ids
+	TBool invalid = false;
+	try
+	{
+		WriterMemory partial(1024);
+		manager->ReadList(id, idArray.Split(0, 6), partial);
+	}
+	catch(PlaylistError)
+	{
+		invalid = true;
+	}
+	TEST(invalid);
+
+	TBool unknown = false;
+	try
+	{
+		WriterMemory missing(1024);
+		manager->ReadList(id + 1, idArray, missing);
+	}
+	catch(PlaylistManagerError)
+	{
+		unknown = true;
+	}
+	TEST(unknown);
+
+	delete manager;
+}
+
+// ChangesSince
+
+class SuiteChangesSince : public Suite
+{
+public:
+	SuiteChangesSince(DvDevice& aDevice);
+
+	virtual void Test();
+
+private:
+	DvDevice& iDevice;
+};
+
+SuiteChangesSince::SuiteChangesSince(DvDevice& aDevice)
+	: Suite("ChangesSince")
+	, iDevice(aDevice)
+{
+}
+
+void SuiteChangesSince::Test()
+{
+	MemoryStore store(NULL);
+	PlaylistManager* manager = new PlaylistManager(iDevice, store, 0, Brn("Test"), Brx::Empty(), Brx::Empty(), 1, false);
+
+	TUint token = manager->Token();
+	TUint a = manager->PlaylistInsert(0, Brn("A"), Brx::Empty(), 0);
+	TUint b = manager->PlaylistInsert(a, Brn("B"), Brx::Empty(), 0);
+	manager->Insert(a, 0, kTrack);
+	manager->PlaylistMove(b, 0);
+	manager->PlaylistDelete(a);
+
+	// the changes in order, then the token of each playlist still there
+	Bwh changes(PlaylistManager::kMaxChangeBytes);
+	TUint newToken = 0;
+	TEST(manager->ChangesSince(token, changes, newToken));
+	TEST(newToken == manager->Token());
+	std::vector<TUint> values;
+	Ids(changes, values);
+	TEST(values.size() == 5 * 3);
+	if(values.size() == 5 * 3)
+	{
+		TEST(values[0] == PlaylistManager::eChangeInserted && values[1] == a && values[2] == 0);
+		TEST(values[3] == PlaylistManager::eChangeInserted && values[4] == b && values[5] == a);
+		TEST(values[6] == PlaylistManager::eChangeMoved && values[7] == b && values[8] == 0);
+		TEST(values[9] == PlaylistManager::eChangeDeleted && values[10] == a);
+		TEST(values[12] == PlaylistManager::eChangeToken && values[13] == b);
+	}
+
+	// nothing since the newest token, and no answer for one not given out yet
+	changes.SetBytes(0);
+	TEST(manager->ChangesSince(newToken, changes, newToken));
+	TEST(changes.Bytes() == 0);
+	TEST(!manager->ChangesSince(newToken + 1, changes, newToken));
+
+	// a token older than the changes kept must read the arrays again
+	for(TUint i = 0; i <= PlaylistManager::kMaxChanges; i++)
+	{
+		manager->PlaylistSetName(b, (i % 2 == 0) ? Brn("C") : Brn("D"));
+	}
+	changes.SetBytes(0);
+	TEST(!manager->ChangesSince(token, changes, newToken));
+	TEST(changes.Bytes() == 0);
+
+	delete manager;
+}
+
+int CDECL main(int /*aArgc*/, char* /*aArgv*/[])
+{
+	InitialisationParams* initParams = InitialisationParams::Create();
+	UpnpLibrary::Initialise(initParams);
+	UpnpLibrary::StartDv();
+
+	DvDeviceStandard* device = new DvDeviceStandard(Brn("PlaylistManagerTest"));
+
+	Runner runner("PlaylistManager");
+	runner.Add(new SuiteInsertList(*device));
+	runner.Add(new SuiteDeleteList(*device));
+	runner.Add(new SuiteMove(*device));
+	runner.Add(new SuiteReadRange(*device));
+	runner.Add(new SuiteReadListArray(*device));
+	runner.Add(new SuiteChangesSince(*device));
+	runner.Run();
+
+	delete device;
+
+	UpnpLibrary::Close();
+
+	return (0);
+}
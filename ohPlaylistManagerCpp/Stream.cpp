@@ -1,8 +1,320 @@
+#include <OpenHome/Private/Ascii.h>
+#include <OpenHome/Private/Debug.h>
+#include <OpenHome/Private/OsWrapper.h>
+
 #include "Stream.h"
+#include "Uring.h"
+
+#include <time.h>
+#include <sys/stat.h>
 
+#ifdef _WIN32
+# include <io.h>
+# include <Windows.h>
+#else
+# include <dirent.h>
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/uio.h>
+#endif
+
+using namespace std;
 using namespace OpenHome;
 using namespace OpenHome::Media;
 
+static TBool SyncFile(FILE* aFile)
+{
+#ifdef _WIN32
+	return _commit(_fileno(aFile)) == 0;
+#else
+	return fsync(fileno(aFile)) == 0;
+#endif
+}
+
+static TBool SyncFileSystem(FILE* aFile)
+{
+#ifdef __linux__
+	return syncfs(fileno(aFile)) == 0;
+#else
+	(void)aFile;
+	return false;
+#endif
+}
+
+static TBool SyncDirectory(const TChar* aDirectory)
+{
+#ifdef _WIN32
+	(void)aDirectory;
+	return true; // MoveFileEx with MOVEFILE_WRITE_THROUGH already flushed the rename
+#else
+	int fd = open(aDirectory, O_RDONLY);
+	if(fd < 0)
+	{
+		return false;
+	}
+	TBool synced = (fsync(fd) == 0);
+	close(fd);
+	return synced;
+#endif
+}
+
+static TBool ReplaceFile(const TChar* aFrom, const TChar* aTo)
+{
+#ifdef _WIN32
+	return MoveFileExA(aFrom, aTo, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(aFrom, aTo) == 0;
+#endif
+}
+
+// A regular file found by ListDirectory, with its modification time in seconds since 1970
+class DirectoryFile
+{
+public:
+	DirectoryFile(const Brx& aName, TUint aBytes, TUint aModified)
+		: iName(aName)
+		, iBytes(aBytes)
+		, iModified(aModified)
+	{
+	}
+	
+	Bws<IFileStore::kMaxNameBytes + 16> iName;
+	TUint iBytes;
+	TUint iModified;
+};
+
+// named as FileStoreDirectory::OpenWriter names its temporaries
+static TBool IsTemporary(const Brx& aName)
+{
+	return aName.Bytes() > 4 && Brn(aName.Ptr() + aName.Bytes() - 4, 4) == Brn(".tmp");
+}
+
+// The regular files directly in aDirectory, leaving out any whose names are
+// too long to be a record or one of its temporaries
+static void ListDirectory(const TChar* aDirectory, vector<DirectoryFile>& aFiles)
+{
+#ifdef _WIN32
+	Bws<IFileStore::kMaxFilenameBytes> pattern(aDirectory);
+	pattern.Append("/*");
+	
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA(pattern.PtrZ(), &data);
+	if(find == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+	
+	do
+	{
+		Brn name(data.cFileName);
+		if((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0 || name.Bytes() > IFileStore::kMaxNameBytes + 16)
+		{
+			continue;
+		}
+		
+		// 100ns intervals since 1601
+		ULARGE_INTEGER modified;
+		modified.LowPart = data.ftLastWriteTime.dwLowDateTime;
+		modified.HighPart = data.ftLastWriteTime.dwHighDateTime;
+		aFiles.push_back(DirectoryFile(name, data.nFileSizeLow, (TUint)((modified.QuadPart - 116444736000000000ULL) / 10000000)));
+	}
+	while(FindNextFileA(find, &data));
+	
+	FindClose(find);
+#else
+	DIR* directory = opendir(aDirectory);
+	if(directory == NULL)
+	{
+		return;
+	}
+	
+	for(struct dirent* entry = readdir(directory); entry != NULL; entry = readdir(directory))
+	{
+		Brn name(entry->d_name);
+		if(name.Bytes() > IFileStore::kMaxNameBytes + 16)
+		{
+			continue;
+		}
+		
+		Bws<IFileStore::kMaxFilenameBytes> path(aDirectory);
+		path.Append('/');
+		path.Append(name);
+		
+		struct stat status;
+		if(stat(path.PtrZ(), &status) != 0 || !S_ISREG(status.st_mode))
+		{
+			continue;
+		}
+		
+		aFiles.push_back(DirectoryFile(name, (TUint)status.st_size, (TUint)status.st_mtime));
+	}
+	
+	closedir(directory);
+#endif
+}
+
+// Appends the fragments to a stdio file, bypassing its buffer with writev
+// where the platform has it
+static TBool WriteFragments(FILE* aFile, const vector<Brn>& aFragments)
+{
+#ifdef _WIN32
+	for(vector<Brn>::const_iterator i = aFragments.begin(); i != aFragments.end(); ++i)
+	{
+		if(fwrite(i->Ptr(), 1, i->Bytes(), aFile) != i->Bytes())
+		{
+			return false;
+		}
+	}
+	return true;
+#else
+	if(fflush(aFile) != 0)
+	{
+		return false;
+	}
+	
+	int fd = fileno(aFile);
+	struct iovec vectors[WriterVector::kMaxFragments];
+	TUint next = 0;
+	
+	while(next < aFragments.size())
+	{
+		TUint count = 0;
+		for(; count < WriterVector::kMaxFragments && next < aFragments.size(); ++count, ++next)
+		{
+			vectors[count].iov_base = (void*)aFragments[next].Ptr();
+			vectors[count].iov_len = aFragments[next].Bytes();
+		}
+		
+		// writev may stop short, so resume from the first fragment it didn't finish
+		TUint first = 0;
+		while(first < count)
+		{
+			ssize_t written = writev(fd, vectors + first, count - first);
+			if(written < 0)
+			{
+				if(errno == EINTR)
+				{
+					continue;
+				}
+				return false;
+			}
+			
+			for(; first < count && (size_t)written >= vectors[first].iov_len; ++first)
+			{
+				written -= vectors[first].iov_len;
+			}
+			if(first < count)
+			{
+				vectors[first].iov_base = (TByte*)vectors[first].iov_base + written;
+				vectors[first].iov_len -= written;
+			}
+		}
+	}
+	
+	return true;
+#endif
+}
+
+TUint BigEndianConverter::BigEndianToUint32(const Brx& aValue, TUint aStartIndex)
+{
+	return (aValue[aStartIndex] << 24) | (aValue[aStartIndex + 1] << 16) | (aValue[aStartIndex + 2] << 8) | aValue[aStartIndex + 3];
+}
+
+
+
+IFileStore::Record::Record(const Brx& aName, TUint aBytes)
+	: iName(aName)
+	, iBytes(aBytes)
+{
+}
+
+
+
+WriterVector::WriterVector(IFileWriter& aFile)
+	: iFile(aFile)
+	, iBytes(0)
+	, iGathers(0)
+{
+	iFragments.reserve(kMaxFragments);
+}
+
+void WriterVector::WriteReference(const Brx& aBuffer)
+{
+	if(aBuffer.Bytes() < kMinReferenceBytes)
+	{
+		Write(aBuffer);
+		return;
+	}
+	
+	if(iFragments.size() == kMaxFragments)
+	{
+		WriteFlush();
+	}
+	
+	iFragments.push_back(Brn(aBuffer));
+	iBytes += aBuffer.Bytes();
+}
+
+TUint WriterVector::Bytes() const
+{
+	return iBytes;
+}
+
+TUint WriterVector::Gathers() const
+{
+	return iGathers;
+}
+
+void WriterVector::Write(TByte aValue)
+{
+	Write(Brn(&aValue, 1));
+}
+
+void WriterVector::Write(const Brx& aBuffer)
+{
+	if(aBuffer.Bytes() > iBuffer.MaxBytes() - iBuffer.Bytes() || iFragments.size() == kMaxFragments)
+	{
+		WriteFlush();
+		
+		if(aBuffer.Bytes() > iBuffer.MaxBytes())
+		{
+			iFile.Write(aBuffer);
+			iBytes += aBuffer.Bytes();
+			return;
+		}
+	}
+	
+	const TByte* ptr = iBuffer.Ptr() + iBuffer.Bytes();
+	iBuffer.Append(aBuffer);
+	iBytes += aBuffer.Bytes();
+	
+	// extend the last fragment if it ends where this one starts
+	if(!iFragments.empty() && iFragments.back().Ptr() + iFragments.back().Bytes() == ptr)
+	{
+		Brn& last = iFragments.back();
+		last.Set(last.Ptr(), last.Bytes() + aBuffer.Bytes());
+	}
+	else
+	{
+		iFragments.push_back(Brn(ptr, aBuffer.Bytes()));
+	}
+}
+
+void WriterVector::WriteFlush()
+{
+	if(!iFragments.empty())
+	{
+		iFile.WriteGather(iFragments);
+		++iGathers;
+		
+		iFragments.clear();
+		iBuffer.SetBytes(0);
+	}
+}
+
+
+
 ReaderFile::ReaderFile(const TChar* aFilename)
 {
 	iFile = fopen(aFilename, "rt");
@@ -57,6 +369,85 @@ void ReaderFile::ReadInterrupt()
 {
 }
 	
+ReaderMemory::ReaderMemory(TUint aBytes)
+	: iData(aBytes)
+	, iOffset(0)
+{
+}
+
+Bwx& ReaderMemory::Data()
+{
+	return iData;
+}
+
+void ReaderMemory::Read(Bwx& aBuffer)
+{
+	TUint bytes = iData.Bytes() - iOffset;
+	if(bytes > aBuffer.MaxBytes())
+	{
+		bytes = aBuffer.MaxBytes();
+	}
+	
+	aBuffer.Replace(iData.Ptr() + iOffset, bytes);
+	iOffset += bytes;
+	
+	if(bytes < 1)
+	{
+		THROW(ReaderFileError);
+	}
+}
+
+void ReaderMemory::ReadFlush()
+{
+}
+
+void ReaderMemory::ReadInterrupt()
+{
+}
+	
+WriterMemory::WriterMemory(TUint aBytes)
+	: iData(aBytes)
+{
+}
+
+const Brx& WriterMemory::Data() const
+{
+	return iData;
+}
+
+void WriterMemory::Close()
+{
+}
+
+void WriterMemory::Write(TByte aValue)
+{
+	Write(Brn(&aValue, 1));
+}
+
+void WriterMemory::Write(const Brx& aBuffer)
+{
+	TUint required = iData.Bytes() + aBuffer.Bytes();
+	if(required > iData.MaxBytes())
+	{
+		TUint grow = iData.MaxBytes() * 2;
+		iData.Grow(grow > required ? grow : required);
+	}
+	
+	iData.Append(aBuffer);
+}
+
+void WriterMemory::WriteFlush()
+{
+}
+
+void WriterMemory::WriteGather(const vector<Brn>& aFragments)
+{
+	for(vector<Brn>::const_iterator i = aFragments.begin(); i != aFragments.end(); ++i)
+	{
+		Write(*i);
+	}
+}
+	
 WriterFile::WriterFile(const TChar* aFilename)
 {
 	iFile = fopen(aFilename, "wt");
@@ -88,7 +479,7 @@ void WriterFile::Write(TByte aValue)
 		THROW(WriterFileError);
 	}
 	
-	fwrite(&aValue, 1, 1, iFile);
+	putc(aValue, iFile);
 }
 
 void WriterFile::Write(const Brx& aBuffer)
@@ -109,4 +500,655 @@ void WriterFile::WriteFlush()
 	}
 	
 	fflush(iFile);
-}
\ No newline at end of file
+}
+
+void WriterFile::WriteGather(const vector<Brn>& aFragments)
+{
+	if(iFile == NULL || !WriteFragments(iFile, aFragments))
+	{
+		THROW(WriterFileError);
+	}
+}
+
+
+Durability::Durability(EMode aMode, TUint aIntervalMs)
+	: iMode(aMode)
+	, iIntervalMs(aIntervalMs)
+{
+}
+
+TBool Durability::Parse(const Brx& aName, EMode& aMode)
+{
+	if(aName == Brn("none"))
+	{
+		aMode = eNone;
+	}
+	else if(aName == Brn("interval"))
+	{
+		aMode = eInterval;
+	}
+	else if(aName == Brn("commit"))
+	{
+		aMode = eCommit;
+	}
+	else
+	{
+		return false;
+	}
+	
+	return true;
+}
+
+const TChar* Durability::Name(EMode aMode)
+{
+	switch(aMode)
+	{
+	case eNone:
+		return "none";
+	case eInterval:
+		return "interval";
+	default:
+		return "commit";
+	}
+}
+
+
+
+GroupCommit::GroupCommit(IGroupCommitHandler& aHandler, const Durability& aDurability)
+	: iHandler(aHandler)
+	, iDurability(aDurability)
+	, iIntervalThread(NULL)
+	, iIntervalQuit("GrpI", 0)
+	, iMutex("GrpC")
+	, iCommitted("GrpC", 0)
+	, iCommitting(false)
+	, iWaiting(0)
+	, iStaged(0)
+	, iDurable(0)
+	, iFailed(false)
+	, iFailedGroup(0)
+	, iStartMs(Os::TimeInMs())
+	, iGroups(0)
+	, iFsyncs(0)
+	, iSyncs(0)
+	, iLatencyTotalMs(0)
+	, iLatencyMaxMs(0)
+{
+	// Semaphore::Wait() takes a zero timeout as forever
+	if(iDurability.iMode == Durability::eInterval && iDurability.iIntervalMs == 0)
+	{
+		iDurability.iMode = Durability::eCommit;
+	}
+	
+	if(iDurability.iMode == Durability::eInterval)
+	{
+		// nothing is staged until the owner is constructed, so an early tick finds no work
+		iIntervalThread = new ThreadFunctor("GrpI", MakeFunctor(*this, &GroupCommit::IntervalRun));
+		iIntervalThread->Start();
+	}
+}
+
+GroupCommit::~GroupCommit()
+{
+	Close();
+}
+
+void GroupCommit::Staged()
+{
+	iMutex.Wait();
+	++iStaged;
+	iMutex.Signal();
+}
+
+void GroupCommit::Sync()
+{
+	if(iDurability.iMode != Durability::eInterval && !Commit())
+	{
+		THROW(WriterFileError);
+	}
+}
+
+TBool GroupCommit::Commit()
+{
+	TUint start = Os::TimeInMs();
+	
+	iMutex.Wait();
+	
+	const TUint target = iStaged;
+	if(target == iDurable)
+	{
+		iMutex.Signal();
+		return true;
+	}
+	
+	while((TInt)(iDurable - target) < 0)
+	{
+		if(iCommitting)
+		{
+			++iWaiting;
+			iMutex.Signal();
+			iCommitted.Wait();
+			iMutex.Wait();
+			continue;
+		}
+		
+		iCommitting = true;
+		const TUint group = iStaged;
+		iMutex.Signal();
+		
+		TUint fsyncs = 0;
+		TBool committed = iHandler.CommitGroup(iDurability.iMode != Durability::eNone, fsyncs);
+		
+		iMutex.Wait();
+		iCommitting = false;
+		iDurable = group;
+		++iGroups;
+		iFsyncs += fsyncs;
+		
+		// only the newest failure is kept: groups run one at a time, so a
+		// caller whose group failed sees it or a later one, never an earlier
+		if(!committed)
+		{
+			iFailed = true;
+			iFailedGroup = group;
+		}
+		
+		for(; iWaiting > 0; --iWaiting)
+		{
+			iCommitted.Signal();
+		}
+	}
+	
+	TUint latency = Os::TimeInMs() - start;
+	++iSyncs;
+	iLatencyTotalMs += latency;
+	if(latency > iLatencyMaxMs)
+	{
+		iLatencyMaxMs = latency;
+	}
+	
+	// groups that failed before this caller staged anything end short of its target
+	TBool committed = !iFailed || (TInt)(iFailedGroup - target) < 0;
+	
+	iMutex.Signal();
+	
+	return committed;
+}
+
+void GroupCommit::Close()
+{
+	if(iIntervalThread != NULL)
+	{
+		iIntervalQuit.Signal();
+		delete iIntervalThread;
+		iIntervalThread = NULL;
+	}
+	
+	Commit();
+}
+
+void GroupCommit::IntervalRun()
+{
+	for(;;)
+	{
+		try
+		{
+			iIntervalQuit.Wait(iDurability.iIntervalMs);
+			break;
+		}
+		catch(Timeout)
+		{
+			Commit();
+		}
+	}
+}
+
+void GroupCommit::Print() const
+{
+	iMutex.Wait();
+	
+	TUint elapsedMs = Os::TimeInMs() - iStartMs;
+	TUint seconds = (elapsedMs < 1000) ? 1 : elapsedMs / 1000;
+	
+	if(iDurability.iMode == Durability::eInterval)
+	{
+		Log::Print("Durability: interval, every %u ms\n", iDurability.iIntervalMs);
+	}
+	else
+	{
+		Log::Print("Durability: %s\n", Durability::Name(iDurability.iMode));
+	}
+	
+	Log::Print("Commits: %u staged, %u groups, %u fsyncs (%u per second)\n", iStaged, iGroups, iFsyncs, iFsyncs / seconds);
+	Log::Print("Commit latency: %u ms average, %u ms max\n", (iSyncs == 0) ? 0 : iLatencyTotalMs / iSyncs, iLatencyMaxMs);
+	
+	iMutex.Signal();
+}
+
+
+
+WriterFileAtomic::WriterFileAtomic(FileStoreDirectory& aStore, Uring* aUring, const Brx& aTemporary, const Brx& aFilename)
+	: iStore(aStore)
+	, iWrite(NULL)
+	, iTemporary(aTemporary)
+	, iFilename(aFilename)
+{
+	iFile = fopen(iTemporary.PtrZ(), "wb");
+	
+	if(iFile == NULL)
+	{
+		THROW(WriterFileError);
+	}
+	
+	if(aUring != NULL)
+	{
+		iWrite = new UringWrite(*aUring, fileno(iFile));
+	}
+}
+
+WriterFileAtomic::~WriterFileAtomic()
+{
+	// an unclosed writer leaves the target untouched
+	if(iFile != NULL)
+	{
+		delete iWrite;
+		fclose(iFile);
+		remove(iTemporary.PtrZ());
+	}
+}
+
+void WriterFileAtomic::Close()
+{
+	if(iFile == NULL)
+	{
+		THROW(WriterFileError);
+	}
+	
+	if(iWrite != NULL)
+	{
+		iWrite->Submit();
+	}
+	else if(fflush(iFile) != 0)
+	{
+		THROW(WriterFileError);
+	}
+	
+	FILE* file = iFile;
+	iFile = NULL;
+	iStore.Stage(file, iWrite, iTemporary, iFilename);
+}
+
+void WriterFileAtomic::Write(TByte aValue)
+{
+	Write(Brn(&aValue, 1));
+}
+
+void WriterFileAtomic::Write(const Brx& aBuffer)
+{
+	if(iFile == NULL)
+	{
+		THROW(WriterFileError);
+	}
+	
+	if(iWrite != NULL)
+	{
+		Bwh& data = iWrite->Data();
+		
+		if(data.Bytes() + aBuffer.Bytes() > data.MaxBytes())
+		{
+			TUint bytes = data.MaxBytes() * 2;
+			if(bytes < data.Bytes() + aBuffer.Bytes())
+			{
+				bytes = data.Bytes() + aBuffer.Bytes();
+			}
+			data.Grow(bytes);
+		}
+		
+		data.Append(aBuffer);
+	}
+	else if(fwrite(aBuffer.Ptr(), 1, aBuffer.Bytes(), iFile) != aBuffer.Bytes())
+	{
+		THROW(WriterFileError);
+	}
+}
+
+void WriterFileAtomic::WriteFlush()
+{
+	if(iFile == NULL)
+	{
+		THROW(WriterFileError);
+	}
+	
+	if(iWrite == NULL)
+	{
+		fflush(iFile);
+	}
+}
+
+void WriterFileAtomic::WriteGather(const vector<Brn>& aFragments)
+{
+	if(iFile == NULL)
+	{
+		THROW(WriterFileError);
+	}
+	
+	// the ring write is submitted from one buffer on Close()
+	if(iWrite != NULL)
+	{
+		for(vector<Brn>::const_iterator i = aFragments.begin(); i != aFragments.end(); ++i)
+		{
+			Write(*i);
+		}
+	}
+	else if(!WriteFragments(iFile, aFragments))
+	{
+		THROW(WriterFileError);
+	}
+}
+
+
+
+FileStoreDirectory::Staged::Staged(FILE* aFile, UringWrite* aWrite, const Brx& aTemporary, const Brx& aFilename)
+	: iFile(aFile)
+	, iWrite(aWrite)
+	, iTemporary(aTemporary)
+	, iFilename(aFilename)
+{
+}
+
+FileStoreDirectory::FileStoreDirectory(const TChar* aRoot, TBool aUring, const Durability& aDurability)
+	: iRoot(aRoot)
+	, iUring(NULL)
+	, iMutex("FStr")
+	, iNextTemporary(0)
+	, iOpenTime((TUint)time(NULL))
+	, iRemovedBytes(0)
+	, iGroupCommit(*this, aDurability)
+{
+	if(aUring)
+	{
+		iUring = Uring::Create();
+		
+		if(iUring == NULL)
+		{
+			Log::Print("io_uring is not available, using stdio\n");
+		}
+	}
+}
+
+FileStoreDirectory::~FileStoreDirectory()
+{
+	iGroupCommit.Close();
+	delete iUring;
+}
+
+IReaderSource* FileStoreDirectory::OpenReader(const Brx& aName)
+{
+	Bws<kMaxFilenameBytes> filename;
+	Path(aName, filename);
+	
+	// a staged replacement is what the caller expects to read
+	if(IsStaged(filename))
+	{
+		iGroupCommit.Commit();
+	}
+	
+	if(iUring != NULL)
+	{
+		return new ReaderFileUring(*iUring, filename.PtrZ());
+	}
+	
+	return new ReaderFile(filename.PtrZ());
+}
+
+IFileWriter* FileStoreDirectory::OpenWriter(const Brx& aName)
+{
+	Bws<kMaxFilenameBytes> filename;
+	Path(aName, filename);
+	
+	// every writer gets its own temporary so saves of the same file can be staged back to back
+	Bws<kMaxFilenameBytes> temporary(filename);
+	temporary.Append('.');
+	
+	iMutex.Wait();
+	Ascii::AppendDec(temporary, iNextTemporary++);
+	iMutex.Signal();
+	
+	temporary.Append(".tmp");
+	
+	return new WriterFileAtomic(*this, iUring, temporary, filename);
+}
+
+void FileStoreDirectory::Sync()
+{
+	iGroupCommit.Sync();
+}
+
+void FileStoreDirectory::Records(std::vector<Record>& aRecords)
+{
+	vector<DirectoryFile> files;
+	ListDirectory(iRoot.PtrZ(), files);
+	
+	for(vector<DirectoryFile>::const_iterator i = files.begin(); i != files.end(); ++i)
+	{
+		if(i->iName.Bytes() <= kMaxNameBytes && !IsTemporary(i->iName))
+		{
+			aRecords.push_back(Record(i->iName, i->iBytes));
+		}
+	}
+}
+
+void FileStoreDirectory::Remove(const Brx& aName)
+{
+	Bws<kMaxFilenameBytes> filename;
+	Path(aName, filename);
+	
+	// staged like a save, so a save closed earlier can't bring the file back
+	Stage(NULL, NULL, Brx::Empty(), filename);
+}
+
+// Temporaries older than the store were left by a run that stopped before
+// it could commit them.  Anything newer may belong to a writer still open.
+TUint FileStoreDirectory::Compact()
+{
+	vector<DirectoryFile> files;
+	ListDirectory(iRoot.PtrZ(), files);
+	
+	iMutex.Wait();
+	TUint bytes = iRemovedBytes;
+	iRemovedBytes = 0;
+	iMutex.Signal();
+	
+	for(vector<DirectoryFile>::const_iterator i = files.begin(); i != files.end(); ++i)
+	{
+		if(!IsTemporary(i->iName) || i->iModified >= iOpenTime)
+		{
+			continue;
+		}
+		
+		Bws<kMaxFilenameBytes> filename;
+		Path(i->iName, filename);
+		
+		if(remove(filename.PtrZ()) == 0)
+		{
+			bytes += i->iBytes;
+		}
+	}
+	
+	return bytes;
+}
+
+void FileStoreDirectory::PrintStats() const
+{
+	iGroupCommit.Print();
+	
+	if(iUring != NULL)
+	{
+		iUring->PrintStats();
+	}
+}
+
+void FileStoreDirectory::Stage(FILE* aFile, UringWrite* aWrite, const Brx& aTemporary, const Brx& aFilename)
+{
+	iMutex.Wait();
+	iStaged.push_back(Staged(aFile, aWrite, aTemporary, aFilename));
+	iMutex.Signal();
+	
+	iGroupCommit.Staged();
+}
+
+TBool FileStoreDirectory::CommitGroup(TBool aSync, TUint& aFsyncs)
+{
+	list<Staged> staged;
+	
+	iMutex.Wait();
+	staged.swap(iStaged);
+	iMutex.Signal();
+	
+	TBool committed = true;
+	list<Staged>::iterator i;
+	
+	// writes submitted to the ring have to land before they can be synced
+	for(i = staged.begin(); i != staged.end(); )
+	{
+		if(i->iWrite == NULL || i->iWrite->Wait())
+		{
+			++i;
+			continue;
+		}
+		
+		// keep the previous version rather than replace it with a partial file
+		Log::Print("Failed to write %s\n", i->iFilename.PtrZ());
+		Discard(*i);
+		i = staged.erase(i);
+		committed = false;
+	}
+	
+	if(staged.empty())
+	{
+		return committed;
+	}
+	
+	if(aSync)
+	{
+		// removals have nothing to sync
+		FILE* first = NULL;
+		TUint files = 0;
+		for(i = staged.begin(); i != staged.end(); ++i)
+		{
+			if(i->iFile != NULL)
+			{
+				first = (first == NULL) ? i->iFile : first;
+				++files;
+			}
+		}
+		
+		// one syncfs covers the whole group where the platform offers it
+		if(files > 1 && SyncFileSystem(first))
+		{
+			++aFsyncs;
+		}
+		else
+		{
+			for(i = staged.begin(); i != staged.end(); )
+			{
+				if(i->iFile == NULL)
+				{
+					++i;
+					continue;
+				}
+				
+				++aFsyncs;
+				if(SyncFile(i->iFile))
+				{
+					++i;
+					continue;
+				}
+				
+				// the data may not be on the medium, so it mustn't replace what is
+				Log::Print("Failed to sync %s\n", i->iFilename.PtrZ());
+				Discard(*i);
+				i = staged.erase(i);
+				committed = false;
+			}
+		}
+	}
+	
+	// renames and removals are applied in staging order so the newest change to a file wins
+	for(i = staged.begin(); i != staged.end(); ++i)
+	{
+		if(i->iFile == NULL)
+		{
+			RemoveFile(i->iFilename);
+			continue;
+		}
+		
+		delete i->iWrite;
+		fclose(i->iFile);
+		
+		if(!ReplaceFile(i->iTemporary.PtrZ(), i->iFilename.PtrZ()))
+		{
+			Log::Print("Failed to replace %s\n", i->iFilename.PtrZ());
+			remove(i->iTemporary.PtrZ());
+			committed = false;
+		}
+	}
+	
+	if(aSync)
+	{
+		++aFsyncs;
+		if(!SyncDirectory(iRoot.PtrZ()))
+		{
+			// the renames are in place but may not survive a crash
+			Log::Print("Failed to sync %s\n", iRoot.PtrZ());
+			committed = false;
+		}
+	}
+	
+	return committed;
+}
+
+void FileStoreDirectory::Discard(Staged& aStaged)
+{
+	delete aStaged.iWrite;
+	fclose(aStaged.iFile);
+	remove(aStaged.iTemporary.PtrZ());
+}
+
+void FileStoreDirectory::RemoveFile(const Bws<kMaxFilenameBytes>& aFilename)
+{
+	struct stat status;
+	if(stat(aFilename.PtrZ(), &status) != 0 || remove(aFilename.PtrZ()) != 0)
+	{
+		return;
+	}
+	
+	iMutex.Wait();
+	iRemovedBytes += (TUint)status.st_size;
+	iMutex.Signal();
+}
+
+void FileStoreDirectory::Path(const Brx& aName, Bwx& aPath) const
+{
+	aPath.Replace(iRoot);
+	aPath.Append('/');
+	aPath.Append(aName);
+}
+
+TBool FileStoreDirectory::IsStaged(const Brx& aFilename)
+{
+	TBool staged = false;
+	
+	iMutex.Wait();
+	for(list<Staged>::const_iterator i = iStaged.begin(); i != iStaged.end(); ++i)
+	{
+		if(i->iFilename == aFilename)
+		{
+			staged = true;
+			break;
+		}
+	}
+	iMutex.Signal();
+	
+	return staged;
+}
@@ -3,7 +3,11 @@
 
 #include <stdio.h>
 
+#include <list>
+#include <vector>
+
 #include <OpenHome/Private/Stream.h>
+#include <OpenHome/Private/Thread.h>
 #include <OpenHome/Buffer.h>
 
 EXCEPTION(ReaderFileError);
@@ -12,6 +16,181 @@ EXCEPTION(WriterFileError);
 namespace OpenHome {
 namespace Media {
 
+class BigEndianConverter
+{
+public:
+	static TUint BigEndianToUint32(const Brx& aValue, TUint aStartIndex);
+};
+
+class IFileWriter : public IWriter
+{
+public:
+	virtual ~IFileWriter() {}
+	
+	// publishes the written data in order with other writers; it becomes durable on the next IFileStore::Sync()
+	virtual void Close() = 0;
+	
+	// writes the fragments in order, as one operation where the platform allows it
+	virtual void WriteGather(const std::vector<Brn>& aFragments) = 0;
+};
+
+// Gathers output as a list of fragments and hands them to the file in one
+// vectored write.  Write() copies into a buffer, so small pieces coalesce;
+// WriteReference() records only where the bytes are, so they must stay
+// valid until the next WriteFlush().  Short references are copied anyway,
+// since the kernel handles a long iovec list worse than a memcpy.
+class WriterVector : public IWriter
+{
+public:
+	static const TUint kMaxFragments = 1024; // IOV_MAX on Linux
+	static const TUint kBufferBytes = 64 * 1024;
+	static const TUint kMinReferenceBytes = 256;
+	
+public:
+	WriterVector(IFileWriter& aFile);
+	
+	void WriteReference(const Brx& aBuffer);
+	
+	TUint Bytes() const;
+	TUint Gathers() const;
+	
+	virtual void Write(TByte aValue);
+	virtual void Write(const Brx& aBuffer);
+	virtual void WriteFlush();
+	
+private:
+	IFileWriter& iFile;
+	Bws<kBufferBytes> iBuffer;
+	std::vector<Brn> iFragments;
+	TUint iBytes;
+	TUint iGathers;
+};
+
+class IFileStore
+{
+public:
+	static const TUint kMaxNameBytes = 32;
+	static const TUint kMaxFilenameBytes = 256;
+	
+	class Record
+	{
+	public:
+		Record(const Brx& aName, TUint aBytes);
+		
+		Bws<kMaxNameBytes> iName;
+		TUint iBytes;
+	};
+	
+public:
+	virtual ~IFileStore() {}
+	
+	// returned objects are owned by the caller
+	virtual IReaderSource* OpenReader(const Brx& aName) = 0;
+	virtual IFileWriter* OpenWriter(const Brx& aName) = 0;
+	
+	// blocks until every writer closed before the call is published, and
+	// durable as far as the store's Durability asks
+	virtual void Sync() = 0;
+	
+	// every record in the store with its size
+	virtual void Records(std::vector<Record>& aRecords) = 0;
+	
+	// drops a record, in order with the writers closed before it; durable on the next Sync()
+	virtual void Remove(const Brx& aName) = 0;
+	
+	// Gives space the store no longer needs back to the medium and returns
+	// how many bytes have gone back since the last call, removed records
+	// included.  Best called just after a Sync().
+	virtual TUint Compact() = 0;
+	
+	virtual void PrintStats() const = 0;
+};
+
+// How far a store goes to make a commit durable.  eCommit syncs before
+// Sync() returns; eInterval syncs in the background every iIntervalMs, so a
+// crash can lose that much; eNone never syncs and leaves writing back to the
+// operating system, for media such as tmpfs where a sync buys nothing.
+class Durability
+{
+public:
+	enum EMode
+	{
+		eNone,
+		eInterval,
+		eCommit
+	};
+	
+public:
+	Durability(EMode aMode, TUint aIntervalMs);
+	
+	// none, interval or commit
+	static TBool Parse(const Brx& aName, EMode& aMode);
+	static const TChar* Name(EMode aMode);
+	
+	EMode iMode;
+	TUint iIntervalMs;
+};
+
+class IGroupCommitHandler
+{
+public:
+	virtual ~IGroupCommitHandler() {}
+	
+	// publishes everything staged so far, durably if aSync, adding the fsyncs
+	// issued to aFsyncs; returns false if any of it didn't make it, and must not throw
+	virtual TBool CommitGroup(TBool aSync, TUint& aFsyncs) = 0;
+};
+
+// Lets concurrent callers of Sync() share a single flush.  The first caller
+// to find work outstanding commits everything staged so far; callers arriving
+// while it runs wait and are covered by it or by the next group.  With
+// Durability::eInterval a thread of its own does the committing and Sync()
+// returns straight away.  When a group fails, Sync() throws WriterFileError
+// for every caller whose changes were in it.
+class GroupCommit
+{
+public:
+	GroupCommit(IGroupCommitHandler& aHandler, const Durability& aDurability);
+	~GroupCommit();
+	
+	void Staged();
+	void Sync();
+	
+	// commits everything staged so far whatever the durability; false if
+	// the group holding the caller's changes failed
+	TBool Commit();
+	
+	// stops the interval thread and commits what is left; the handler must still be whole
+	void Close();
+	
+	void Print() const;
+	
+private:
+	void IntervalRun();
+	
+private:
+	IGroupCommitHandler& iHandler;
+	Durability iDurability;
+	ThreadFunctor* iIntervalThread;
+	Semaphore iIntervalQuit;
+	
+	mutable Mutex iMutex;
+	Semaphore iCommitted;
+	TBool iCommitting;
+	TUint iWaiting;
+	TUint iStaged;
+	TUint iDurable;
+	TBool iFailed;
+	TUint iFailedGroup; // the newest group that failed
+	
+	TUint iStartMs;
+	TUint iGroups;
+	TUint iFsyncs;
+	TUint iSyncs;
+	TUint iLatencyTotalMs;
+	TUint iLatencyMaxMs;
+};
+
 class ReaderFile : public IReaderSource
 {
 public:
@@ -28,7 +207,43 @@ private:
 	FILE* iFile;
 };
 
-class WriterFile : public IWriter
+// Reads from a buffer it owns, filled through Data() beforehand
+class ReaderMemory : public IReaderSource
+{
+public:
+	ReaderMemory(TUint aBytes);
+	
+	Bwx& Data();
+	
+	virtual void Read(Bwx& aBuffer);
+	virtual void ReadFlush();
+	virtual void ReadInterrupt();
+	
+private:
+	Bwh iData;
+	TUint iOffset;
+};
+
+// Collects everything written in a buffer it owns, grown as needed
+class WriterMemory : public IFileWriter
+{
+public:
+	WriterMemory(TUint aBytes);
+	
+	const Brx& Data() const;
+	
+	virtual void Close();
+	
+	virtual void Write(TByte aValue);
+	virtual void Write(const Brx& aBuffer);
+	virtual void WriteFlush();
+	virtual void WriteGather(const std::vector<Brn>& aFragments);
+	
+private:
+	Bwh iData;
+};
+
+class WriterFile : public IFileWriter
 {
 public:
 	WriterFile(const TChar* aFilename);
@@ -39,11 +254,96 @@ public:
 	virtual void Write(TByte aValue);
 	virtual void Write(const Brx& aBuffer);
 	virtual void WriteFlush();
+	virtual void WriteGather(const std::vector<Brn>& aFragments);
 	
 private:
 	FILE* iFile;
 };
 
+class FileStoreDirectory;
+class Uring;
+class UringWrite;
+
+// Writes to a temporary file which replaces the target only once it is durable.
+// With a Uring the contents are buffered and submitted as one asynchronous
+// write when the writer is closed; the group commit waits for it.
+class WriterFileAtomic : public IFileWriter
+{
+public:
+	WriterFileAtomic(FileStoreDirectory& aStore, Uring* aUring, const Brx& aTemporary, const Brx& aFilename);
+	virtual ~WriterFileAtomic();
+	
+	virtual void Close();
+	
+	virtual void Write(TByte aValue);
+	virtual void Write(const Brx& aBuffer);
+	virtual void WriteFlush();
+	virtual void WriteGather(const std::vector<Brn>& aFragments);
+	
+private:
+	FileStoreDirectory& iStore;
+	FILE* iFile;
+	UringWrite* iWrite;
+	Bws<IFileStore::kMaxFilenameBytes> iTemporary;
+	Bws<IFileStore::kMaxFilenameBytes> iFilename;
+};
+
+// One file per name in the directory aRoot.  aUring asks for io_uring
+// reads and writes, falling back to stdio where the kernel doesn't offer it.
+class FileStoreDirectory : public IFileStore, private IGroupCommitHandler
+{
+public:
+	// room is left for the name and the suffix of its temporary
+	static const TUint kMaxRootBytes = kMaxFilenameBytes - kMaxNameBytes - 32;
+	
+public:
+	FileStoreDirectory(const TChar* aRoot, TBool aUring, const Durability& aDurability);
+	virtual ~FileStoreDirectory();
+	
+	virtual IReaderSource* OpenReader(const Brx& aName);
+	virtual IFileWriter* OpenWriter(const Brx& aName);
+	virtual void Sync();
+	virtual void Records(std::vector<Record>& aRecords);
+	virtual void Remove(const Brx& aName);
+	virtual TUint Compact();
+	virtual void PrintStats() const;
+	
+	// called by WriterFileAtomic::Close
+	void Stage(FILE* aFile, UringWrite* aWrite, const Brx& aTemporary, const Brx& aFilename);
+	
+private:
+	virtual TBool CommitGroup(TBool aSync, TUint& aFsyncs);
+	
+	void Path(const Brx& aName, Bwx& aPath) const;
+	TBool IsStaged(const Brx& aFilename);
+	void RemoveFile(const Bws<kMaxFilenameBytes>& aFilename);
+	
+private:
+	// a removal when iFile is NULL
+	class Staged
+	{
+	public:
+		Staged(FILE* aFile, UringWrite* aWrite, const Brx& aTemporary, const Brx& aFilename);
+		
+		FILE* iFile;
+		UringWrite* iWrite;
+		Bws<kMaxFilenameBytes> iTemporary;
+		Bws<kMaxFilenameBytes> iFilename;
+	};
+	
+	// drops a staged write, leaving the file it would have replaced alone
+	static void Discard(Staged& aStaged);
+	
+	Bws<kMaxRootBytes> iRoot;
+	Uring* iUring;
+	Mutex iMutex;
+	std::list<Staged> iStaged;
+	TUint iNextTemporary;
+	TUint iOpenTime;
+	TUint iRemovedBytes;
+	GroupCommit iGroupCommit;
+};
+
 } // Media
 } // OpenHome
 
@@ -0,0 +1,566 @@
+#include <string.h>
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Functor.h>
+#include <OpenHome/Private/Debug.h>
+
+#include "Uring.h"
+
+#ifdef __linux__
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+#endif
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+UringRequest::UringRequest()
+	: iDone("UrRq", 0)
+	, iResult(0)
+{
+}
+
+TInt UringRequest::Wait()
+{
+	iDone.Wait();
+	return iResult;
+}
+
+#ifdef __linux__
+
+static int UringSetup(TUint aEntries, io_uring_params* aParams)
+{
+	return (int)syscall(__NR_io_uring_setup, aEntries, aParams);
+}
+
+static int UringEnter(int aFd, TUint aSubmit, TUint aWait, TUint aFlags)
+{
+	return (int)syscall(__NR_io_uring_enter, aFd, aSubmit, aWait, aFlags, NULL, 0);
+}
+
+static int UringRegister(int aFd, TUint aOpcode, void* aArg, TUint aArgs)
+{
+	return (int)syscall(__NR_io_uring_register, aFd, aOpcode, aArg, aArgs);
+}
+
+// Kernels from 5.1 to 5.5 have io_uring but not the read and write
+// operations, and fail each one with -EINVAL.  Asking first also covers
+// kernels that have no probe at all, since it came with the operations.
+static TBool UringSupportsReadWrite(int aFd)
+{
+	const TUint kOps = 256;
+	TByte buffer[sizeof(io_uring_probe) + kOps * sizeof(io_uring_probe_op)];
+	memset(buffer, 0, sizeof(buffer));
+	io_uring_probe* probe = (io_uring_probe*)buffer;
+
+	if(UringRegister(aFd, IORING_REGISTER_PROBE, probe, kOps) < 0)
+	{
+		return false;
+	}
+
+	TUint ops[] = { IORING_OP_READ, IORING_OP_WRITE };
+	for(TUint i = 0; i < sizeof(ops) / sizeof(ops[0]); ++i)
+	{
+		if(ops[i] > probe->last_op || ops[i] >= probe->ops_len || (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED) == 0)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static TUint* RingField(void* aRing, TUint aOffset)
+{
+	return (TUint*)((TByte*)aRing + aOffset);
+}
+
+Uring* Uring::Create()
+{
+	io_uring_params params;
+	memset(&params, 0, sizeof(params));
+
+	int fd = UringSetup(kEntries, &params);
+	if(fd < 0)
+	{
+		return NULL;
+	}
+
+	if(!UringSupportsReadWrite(fd))
+	{
+		close(fd);
+		return NULL;
+	}
+
+	Uring* uring = new Uring(fd);
+	if(!uring->Map(params))
+	{
+		delete uring;
+		return NULL;
+	}
+
+	uring->iReaper = new ThreadFunctor("UrRp", MakeFunctor(*uring, &Uring::Reap));
+	uring->iReaper->Start();
+
+	return uring;
+}
+
+Uring::Uring(int aFd)
+	: iFd(aFd)
+	, iSqEntries(0)
+	, iCqEntries(0)
+	, iSqRing(MAP_FAILED)
+	, iSqRingBytes(0)
+	, iCqRing(MAP_FAILED)
+	, iCqRingBytes(0)
+	, iSqes(MAP_FAILED)
+	, iSqesBytes(0)
+	, iMutex("Urng")
+	, iSlots("Urng", 0)
+	, iReaper(NULL)
+	, iSubmitted(0)
+	, iCalls(0)
+{
+}
+
+Uring::~Uring()
+{
+	// a request without a UringRequest tells the reaper to stop
+	if(iReaper != NULL)
+	{
+		Submit(IORING_OP_NOP, -1, NULL, 0, 0, NULL);
+		delete iReaper;
+	}
+
+	if(iSqes != MAP_FAILED)
+	{
+		munmap(iSqes, iSqesBytes);
+	}
+	if(iCqRing != MAP_FAILED && iCqRing != iSqRing)
+	{
+		munmap(iCqRing, iCqRingBytes);
+	}
+	if(iSqRing != MAP_FAILED)
+	{
+		munmap(iSqRing, iSqRingBytes);
+	}
+
+	close(iFd);
+}
+
+TBool Uring::Map(const io_uring_params& aParams)
+{
+	iSqEntries = aParams.sq_entries;
+	iCqEntries = aParams.cq_entries;
+
+	iSqRingBytes = aParams.sq_off.array + aParams.sq_entries * sizeof(TUint);
+	iCqRingBytes = aParams.cq_off.cqes + aParams.cq_entries * sizeof(io_uring_cqe);
+	iSqesBytes = aParams.sq_entries * sizeof(io_uring_sqe);
+
+	// newer kernels share one mapping between the two rings
+	TBool single = (aParams.features & IORING_FEAT_SINGLE_MMAP) != 0;
+	if(single && iCqRingBytes > iSqRingBytes)
+	{
+		iSqRingBytes = iCqRingBytes;
+	}
+
+	iSqRing = mmap(NULL, iSqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, iFd, IORING_OFF_SQ_RING);
+	if(iSqRing == MAP_FAILED)
+	{
+		return false;
+	}
+
+	if(single)
+	{
+		iCqRing = iSqRing;
+	}
+	else
+	{
+		iCqRing = mmap(NULL, iCqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, iFd, IORING_OFF_CQ_RING);
+		if(iCqRing == MAP_FAILED)
+		{
+			return false;
+		}
+	}
+
+	iSqes = mmap(NULL, iSqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, iFd, IORING_OFF_SQES);
+	if(iSqes == MAP_FAILED)
+	{
+		return false;
+	}
+
+	iSqTail = RingField(iSqRing, aParams.sq_off.tail);
+	iSqMask = RingField(iSqRing, aParams.sq_off.ring_mask);
+	iSqArray = RingField(iSqRing, aParams.sq_off.array);
+	iCqHead = RingField(iCqRing, aParams.cq_off.head);
+	iCqTail = RingField(iCqRing, aParams.cq_off.tail);
+	iCqMask = RingField(iCqRing, aParams.cq_off.ring_mask);
+	iCqes = (TByte*)iCqRing + aParams.cq_off.cqes;
+
+	// one slot per completion entry, so the completion ring can never overflow
+	for(TUint i = 0; i < iCqEntries; ++i)
+	{
+		iSlots.Signal();
+	}
+
+	return true;
+}
+
+void Uring::Read(int aFd, void* aBuffer, TUint aBytes, TUint64 aOffset, UringRequest& aRequest)
+{
+	Submit(IORING_OP_READ, aFd, aBuffer, aBytes, aOffset, &aRequest);
+}
+
+void Uring::Write(int aFd, const void* aBuffer, TUint aBytes, TUint64 aOffset, UringRequest& aRequest)
+{
+	Submit(IORING_OP_WRITE, aFd, aBuffer, aBytes, aOffset, &aRequest);
+}
+
+void Uring::PrintStats() const
+{
+	iMutex.Wait();
+	Log::Print("io_uring: %u operations, %u system calls\n", iSubmitted, iCalls);
+	iMutex.Signal();
+}
+
+void Uring::Submit(TByte aOpcode, int aFd, const void* aBuffer, TUint aBytes, TUint64 aOffset, UringRequest* aRequest)
+{
+	iSlots.Wait();
+	iMutex.Wait();
+
+	// each entry is submitted as soon as it's prepared, so the kernel has
+	// always consumed the ring before the next one is written
+	TUint tail = *iSqTail;
+	TUint index = tail & *iSqMask;
+
+	io_uring_sqe* sqe = (io_uring_sqe*)iSqes + index;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = aOpcode;
+	sqe->fd = aFd;
+	sqe->off = aOffset;
+	sqe->addr = (TUint64)(size_t)aBuffer;
+	sqe->len = aBytes;
+	sqe->user_data = (TUint64)(size_t)aRequest;
+
+	iSqArray[index] = index;
+	__atomic_store_n(iSqTail, tail + 1, __ATOMIC_RELEASE);
+
+	for(;;)
+	{
+		int result = UringEnter(iFd, 1, 0, 0);
+		++iCalls;
+
+		if(result == 1)
+		{
+			++iSubmitted;
+			break;
+		}
+
+		if(result < 0 && (errno == EINTR || errno == EAGAIN))
+		{
+			continue;
+		}
+
+		// the kernel refused it: take it back off the ring and fail it here
+		__atomic_store_n(iSqTail, tail, __ATOMIC_RELEASE);
+		Complete(aRequest, (result < 0) ? -errno : -EIO);
+		iSlots.Signal();
+		break;
+	}
+
+	iMutex.Signal();
+}
+
+void Uring::Complete(UringRequest* aRequest, TInt aResult)
+{
+	if(aRequest != NULL)
+	{
+		aRequest->iResult = aResult;
+		aRequest->iDone.Signal();
+	}
+}
+
+void Uring::Reap()
+{
+	for(;;)
+	{
+		TUint head = *iCqHead;
+		TUint tail = __atomic_load_n(iCqTail, __ATOMIC_ACQUIRE);
+
+		if(head == tail)
+		{
+			UringEnter(iFd, 0, 1, IORING_ENTER_GETEVENTS);
+			continue;
+		}
+
+		TBool quit = false;
+
+		for(; head != tail; ++head)
+		{
+			io_uring_cqe* cqe = (io_uring_cqe*)iCqes + (head & *iCqMask);
+			UringRequest* request = (UringRequest*)(size_t)cqe->user_data;
+
+			if(request == NULL)
+			{
+				quit = true;
+			}
+
+			Complete(request, cqe->res);
+			iSlots.Signal();
+		}
+
+		__atomic_store_n(iCqHead, head, __ATOMIC_RELEASE);
+
+		if(quit)
+		{
+			return;
+		}
+	}
+}
+
+
+
+UringWrite::UringWrite(Uring& aUring, int aFd)
+	: iUring(aUring)
+	, iFd(aFd)
+	, iData(ReaderFileUring::kChunkBytes)
+{
+}
+
+Bwh& UringWrite::Data()
+{
+	return iData;
+}
+
+void UringWrite::Submit()
+{
+	iUring.Write(iFd, iData.Ptr(), iData.Bytes(), 0, iWrite);
+}
+
+TBool UringWrite::Wait()
+{
+	TInt written = iWrite.Wait();
+	TUint offset = (written > 0) ? written : 0;
+
+	while(offset < iData.Bytes())
+	{
+		ssize_t bytes = pwrite(iFd, iData.Ptr() + offset, iData.Bytes() - offset, offset);
+
+		if(bytes < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(bytes <= 0)
+		{
+			return false;
+		}
+
+		offset += bytes;
+	}
+
+	return true;
+}
+
+
+
+ReaderFileUring::ReaderFileUring(Uring& aUring, const TChar* aFilename)
+	: iUring(aUring)
+	, iOffset(0)
+	, iEnd(false)
+	, iNext(0)
+	, iConsumed(0)
+{
+	iFd = open(aFilename, O_RDONLY);
+
+	if(iFd < 0)
+	{
+		THROW(ReaderFileError);
+	}
+
+	for(TUint i = 0; i < kDepth; ++i)
+	{
+		iChunk[i].Grow(kChunkBytes);
+		iQueued[i] = false;
+		Queue(i);
+	}
+}
+
+ReaderFileUring::~ReaderFileUring()
+{
+	// the kernel may still be writing into the chunks
+	for(TUint i = 0; i < kDepth; ++i)
+	{
+		if(iQueued[i])
+		{
+			iRequest[i].Wait();
+		}
+	}
+
+	close(iFd);
+}
+
+void ReaderFileUring::Read(Bwx& aBuffer)
+{
+	Bwh& chunk = iChunk[iNext];
+
+	if(iQueued[iNext])
+	{
+		TInt result = iRequest[iNext].Wait();
+		iQueued[iNext] = false;
+
+		chunk.SetBytes(Finish(iNext, result));
+		iConsumed = 0;
+
+		if(chunk.Bytes() < kChunkBytes)
+		{
+			iEnd = true;
+		}
+	}
+
+	if(chunk.Bytes() == 0)
+	{
+		THROW(ReaderFileError);
+	}
+
+	TUint bytes = chunk.Bytes() - iConsumed;
+	if(bytes > aBuffer.MaxBytes())
+	{
+		bytes = aBuffer.MaxBytes();
+	}
+
+	aBuffer.Replace(Brn(chunk.Ptr() + iConsumed, bytes));
+	iConsumed += bytes;
+
+	if(iConsumed == chunk.Bytes())
+	{
+		Queue(iNext);
+		iNext = (iNext + 1) % kDepth;
+		iConsumed = 0;
+	}
+}
+
+void ReaderFileUring::ReadFlush()
+{
+}
+
+void ReaderFileUring::ReadInterrupt()
+{
+}
+
+void ReaderFileUring::Queue(TUint aSlot)
+{
+	if(iEnd)
+	{
+		iChunk[aSlot].SetBytes(0);
+		return;
+	}
+
+	iUring.Read(iFd, iChunk[aSlot].Ptr(), kChunkBytes, iOffset, iRequest[aSlot]);
+	iQueued[aSlot] = true;
+	iChunkOffset[aSlot] = iOffset;
+	iOffset += kChunkBytes;
+}
+
+// A chunk the ring fell short on, whether it failed or read less, is
+// finished with pread, so only the end of the file ends the chunk early.
+// A read that fails there too is logged before the stream is ended.
+TUint ReaderFileUring::Finish(TUint aSlot, TInt aResult)
+{
+	TUint bytes = (aResult > 0) ? aResult : 0;
+
+	while(bytes < kChunkBytes)
+	{
+		ssize_t result = pread(iFd, (void*)(iChunk[aSlot].Ptr() + bytes), kChunkBytes - bytes, iChunkOffset[aSlot] + bytes);
+
+		if(result < 0 && errno == EINTR)
+		{
+			continue;
+		}
+		if(result < 0)
+		{
+			Log::Print("io_uring: read failed at %llu, error %d\n", (unsigned long long)(iChunkOffset[aSlot] + bytes), errno);
+			iEnd = true;
+			THROW(ReaderFileError);
+		}
+		if(result == 0)
+		{
+			break;
+		}
+
+		bytes += result;
+	}
+
+	return bytes;
+}
+
+#else // __linux__
+
+Uring* Uring::Create()
+{
+	return NULL;
+}
+
+Uring::~Uring()
+{
+}
+
+void Uring::Read(int /*aFd*/, void* /*aBuffer*/, TUint /*aBytes*/, TUint64 /*aOffset*/, UringRequest& /*aRequest*/)
+{
+}
+
+void Uring::Write(int /*aFd*/, const void* /*aBuffer*/, TUint /*aBytes*/, TUint64 /*aOffset*/, UringRequest& /*aRequest*/)
+{
+}
+
+void Uring::PrintStats() const
+{
+}
+
+UringWrite::UringWrite(Uring& aUring, int aFd)
+	: iUring(aUring)
+	, iFd(aFd)
+{
+}
+
+Bwh& UringWrite::Data()
+{
+	return iData;
+}
+
+void UringWrite::Submit()
+{
+}
+
+TBool UringWrite::Wait()
+{
+	return false;
+}
+
+ReaderFileUring::ReaderFileUring(Uring& aUring, const TChar* /*aFilename*/)
+	: iUring(aUring)
+{
+	THROW(ReaderFileError);
+}
+
+ReaderFileUring::~ReaderFileUring()
+{
+}
+
+void ReaderFileUring::Read(Bwx& /*aBuffer*/)
+{
+	THROW(ReaderFileError);
+}
+
+void ReaderFileUring::ReadFlush()
+{
+}
+
+void ReaderFileUring::ReadInterrupt()
+{
+}
+
+#endif // __linux__
@@ -0,0 +1,143 @@
+#ifndef HEADER_PLAYLISTMANAGER_URING
+#define HEADER_PLAYLISTMANAGER_URING
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Thread.h>
+
+#include "Stream.h"
+
+struct io_uring_params;
+
+namespace OpenHome {
+namespace Media {
+
+class Uring;
+
+// One asynchronous operation.  Submitting it through a Uring returns at
+// once; Wait() blocks until the kernel has completed it.
+class UringRequest
+{
+	friend class Uring;
+
+public:
+	UringRequest();
+
+	// the result of the operation: bytes transferred, or a negative errno
+	TInt Wait();
+
+private:
+	Semaphore iDone;
+	TInt iResult;
+};
+
+// Asynchronous file I/O on Linux io_uring, driven through the raw system
+// calls so there's no library dependency.  Any thread may submit; a single
+// thread reaps completions and wakes the matching requests.  Create()
+// returns NULL where io_uring isn't available, and callers fall back to stdio.
+class Uring
+{
+public:
+	static const TUint kEntries = 64;
+
+public:
+	static Uring* Create();
+	~Uring();
+
+	void Read(int aFd, void* aBuffer, TUint aBytes, TUint64 aOffset, UringRequest& aRequest);
+	void Write(int aFd, const void* aBuffer, TUint aBytes, TUint64 aOffset, UringRequest& aRequest);
+
+	void PrintStats() const;
+
+private:
+	Uring(int aFd);
+	TBool Map(const io_uring_params& aParams);
+	void Submit(TByte aOpcode, int aFd, const void* aBuffer, TUint aBytes, TUint64 aOffset, UringRequest* aRequest);
+	void Complete(UringRequest* aRequest, TInt aResult);
+	void Reap();
+
+private:
+	int iFd;
+	TUint iSqEntries;
+	TUint iCqEntries;
+
+	void* iSqRing;
+	TUint iSqRingBytes;
+	void* iCqRing;
+	TUint iCqRingBytes;
+	void* iSqes;
+	TUint iSqesBytes;
+
+	TUint* iSqTail;
+	TUint* iSqMask;
+	TUint* iSqArray;
+	TUint* iCqHead;
+	TUint* iCqTail;
+	TUint* iCqMask;
+	void* iCqes;
+
+	mutable Mutex iMutex;
+	Semaphore iSlots;
+	ThreadFunctor* iReaper;
+
+	TUint iSubmitted;
+	TUint iCalls;
+};
+
+// A whole file written in one operation.  Writers fill Data(), Submit()
+// starts the write and Wait() returns once it has reached the file, finishing
+// synchronously if the ring fell short.  Making it durable is left to the
+// caller so a group of files can share one sync.
+class UringWrite
+{
+public:
+	UringWrite(Uring& aUring, int aFd);
+
+	Bwh& Data();
+	void Submit();
+	TBool Wait();
+
+private:
+	Uring& iUring;
+	int iFd;
+	Bwh iData;
+	UringRequest iWrite;
+};
+
+// Reads a file sequentially with several chunks in flight, so the next
+// chunk is usually already in memory when the parser asks for it.
+class ReaderFileUring : public IReaderSource
+{
+public:
+	static const TUint kChunkBytes = 64 * 1024;
+	static const TUint kDepth = 4;
+
+public:
+	ReaderFileUring(Uring& aUring, const TChar* aFilename);
+	virtual ~ReaderFileUring();
+
+	virtual void Read(Bwx& aBuffer);
+	virtual void ReadFlush();
+	virtual void ReadInterrupt();
+
+private:
+	void Queue(TUint aSlot);
+	TUint Finish(TUint aSlot, TInt aResult);
+
+private:
+	Uring& iUring;
+	int iFd;
+	TUint64 iOffset;
+	TBool iEnd;
+
+	Bwh iChunk[kDepth];
+	TUint64 iChunkOffset[kDepth];
+	UringRequest iRequest[kDepth];
+	TBool iQueued[kDepth];
+	TUint iNext;
+	TUint iConsumed;
+};
+
+} // Media
+} // OpenHome
+
+#endif
@@ -0,0 +1,517 @@
+#include <string.h>
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Ascii.h>
+
+#include "XmlTokenizer.h"
+#include "Stream.h"
+
+#if defined(__AVX2__)
+# include <immintrin.h>
+# define XMLTOKENIZER_AVX2
+# define XMLTOKENIZER_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# include <emmintrin.h>
+# define XMLTOKENIZER_SSE2
+#endif
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+using namespace OpenHome;
+using namespace OpenHome::Media;
+
+// longest entity we recognise, "&#x10FFFF;" without the ampersand
+static const TUint kMaxEntityBytes = 9;
+
+#ifdef XMLTOKENIZER_SSE2
+static TUint LowestBit(TUint aMask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, aMask);
+	return index;
+#else
+	return __builtin_ctz(aMask);
+#endif
+}
+#endif
+
+static TBool AppendUtf8(Bwx& aText, TUint aCodePoint)
+{
+	TByte utf8[4];
+	TUint bytes;
+
+	if(aCodePoint < 0x80)
+	{
+		utf8[0] = (TByte)aCodePoint;
+		bytes = 1;
+	}
+	else if(aCodePoint < 0x800)
+	{
+		utf8[0] = (TByte)(0xc0 | (aCodePoint >> 6));
+		utf8[1] = (TByte)(0x80 | (aCodePoint & 0x3f));
+		bytes = 2;
+	}
+	else if(aCodePoint < 0x10000)
+	{
+		utf8[0] = (TByte)(0xe0 | (aCodePoint >> 12));
+		utf8[1] = (TByte)(0x80 | ((aCodePoint >> 6) & 0x3f));
+		utf8[2] = (TByte)(0x80 | (aCodePoint & 0x3f));
+		bytes = 3;
+	}
+	else
+	{
+		utf8[0] = (TByte)(0xf0 | (aCodePoint >> 18));
+		utf8[1] = (TByte)(0x80 | ((aCodePoint >> 12) & 0x3f));
+		utf8[2] = (TByte)(0x80 | ((aCodePoint >> 6) & 0x3f));
+		utf8[3] = (TByte)(0x80 | (aCodePoint & 0x3f));
+		bytes = 4;
+	}
+
+	if(aText.Bytes() + bytes > aText.MaxBytes())
+	{
+		return false;
+	}
+
+	aText.Append(Brn(utf8, bytes));
+	return true;
+}
+
+XmlTokenizer::XmlTokenizer(IReaderSource& aSource)
+	: iSource(aSource)
+	, iBuffer(kBufferBytes)
+	, iOffset(0)
+	, iEnd(false)
+{
+}
+
+Brn XmlTokenizer::NextTag()
+{
+	// discard everything up to the opening bracket
+	for(;;)
+	{
+		const TByte* start = iBuffer.Ptr() + iOffset;
+		const TByte* end = iBuffer.Ptr() + iBuffer.Bytes();
+		const TByte* open = Find(start, end, '<', '<');
+
+		if(open != end)
+		{
+			iOffset = open - iBuffer.Ptr() + 1;
+			break;
+		}
+
+		iOffset = iBuffer.Bytes();
+		if(!Fill(iOffset))
+		{
+			THROW(ReaderFileError);
+		}
+	}
+
+	for(;;)
+	{
+		const TByte* start = iBuffer.Ptr() + iOffset;
+		const TByte* end = iBuffer.Ptr() + iBuffer.Bytes();
+		const TByte* close = Find(start, end, '>', '>');
+
+		if(close != end)
+		{
+			iOffset = close - iBuffer.Ptr() + 1;
+			return Brn(start, close - start);
+		}
+
+		// keep the partial tag and read more
+		if(!Fill(iOffset))
+		{
+			THROW(ReaderFileError);
+		}
+	}
+}
+
+void XmlTokenizer::ReadText(Bwx& aText)
+{
+	aText.SetBytes(0);
+	TBool overflow = false;
+
+	for(;;)
+	{
+		const TByte* ptr = iBuffer.Ptr();
+		const TByte* start = ptr + iOffset;
+		const TByte* end = ptr + iBuffer.Bytes();
+		const TByte* stop = Find(start, end, '<', '&');
+
+		TUint bytes = stop - start;
+		if(!overflow)
+		{
+			if(aText.Bytes() + bytes > aText.MaxBytes())
+			{
+				overflow = true;
+			}
+			else
+			{
+				aText.Append(Brn(start, bytes));
+			}
+		}
+		iOffset += bytes;
+
+		if(stop == end)
+		{
+			if(!Fill(iOffset))
+			{
+				THROW(ReaderFileError);
+			}
+			continue;
+		}
+
+		if(*stop == '<')
+		{
+			break;
+		}
+
+		const TByte* limit = (end - stop > (TInt)kMaxEntityBytes + 1) ? stop + kMaxEntityBytes + 1 : end;
+
+		// entities are short, so look for the terminator a byte at a time
+		const TByte* semicolon = stop + 1;
+		while(semicolon != limit && *semicolon != ';')
+		{
+			if(*semicolon == '&' || *semicolon == '<')
+			{
+				semicolon = stop;
+				break;
+			}
+			++semicolon;
+		}
+
+		if(semicolon == limit || semicolon == stop)
+		{
+			if(semicolon == limit && limit == end && !iEnd)
+			{
+				// the entity may straddle the end of the buffer
+				Fill(iOffset);
+				continue;
+			}
+
+			// a bare ampersand, keep it as it is
+			if(!overflow && !aText.TryAppend('&'))
+			{
+				overflow = true;
+			}
+			++iOffset;
+			continue;
+		}
+
+		if(!overflow && !Unescape(Brn(stop + 1, semicolon - stop - 1), aText))
+		{
+			overflow = true;
+		}
+		iOffset = semicolon - ptr + 1;
+	}
+
+	if(overflow)
+	{
+		THROW(XmlTokenizerError);
+	}
+}
+
+const TByte* XmlTokenizer::Find(const TByte* aStart, const TByte* aEnd, TByte aA, TByte aB)
+{
+	const TByte* p = aStart;
+
+#ifdef XMLTOKENIZER_AVX2
+	const __m256i a32 = _mm256_set1_epi8((char)aA);
+	const __m256i b32 = _mm256_set1_epi8((char)aB);
+	for(; aEnd - p >= 32; p += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		TUint mask = (TUint)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, a32), _mm256_cmpeq_epi8(v, b32)));
+		if(mask != 0)
+		{
+			return p + LowestBit(mask);
+		}
+	}
+#endif
+
+#ifdef XMLTOKENIZER_SSE2
+	const __m128i a16 = _mm_set1_epi8((char)aA);
+	const __m128i b16 = _mm_set1_epi8((char)aB);
+	for(; aEnd - p >= 16; p += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		TUint mask = (TUint)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, a16), _mm_cmpeq_epi8(v, b16)));
+		if(mask != 0)
+		{
+			return p + LowestBit(mask);
+		}
+	}
+#endif
+
+	for(; p < aEnd; ++p)
+	{
+		if(*p == aA || *p == aB)
+		{
+			return p;
+		}
+	}
+
+	return aEnd;
+}
+
+TBool XmlTokenizer::Fill(TUint aKeep)
+{
+	if(iEnd)
+	{
+		return false;
+	}
+
+	// move the bytes we still need to the front of the buffer
+	TUint keep = iBuffer.Bytes() - aKeep;
+	if(keep == iBuffer.MaxBytes())
+	{
+		THROW(XmlTokenizerError);
+	}
+	memmove((void*)iBuffer.Ptr(), iBuffer.Ptr() + aKeep, keep);
+	iBuffer.SetBytes(keep);
+	iOffset -= aKeep;
+
+	Bwn free(iBuffer.Ptr() + keep, 0, iBuffer.MaxBytes() - keep);
+
+	try
+	{
+		iSource.Read(free);
+	}
+	catch(ReaderFileError)
+	{
+		iEnd = true;
+		return false;
+	}
+
+	iBuffer.SetBytes(keep + free.Bytes());
+	return true;
+}
+
+TBool XmlTokenizer::Unescape(const Brx& aEntity, Bwx& aText)
+{
+	TByte value = 0;
+
+	if(aEntity == Brn("lt"))
+	{
+		value = '<';
+	}
+	else if(aEntity == Brn("gt"))
+	{
+		value = '>';
+	}
+	else if(aEntity == Brn("amp"))
+	{
+		value = '&';
+	}
+	else if(aEntity == Brn("quot"))
+	{
+		value = '"';
+	}
+	else if(aEntity == Brn("apos"))
+	{
+		value = '\'';
+	}
+	else if(aEntity.Bytes() > 1 && aEntity[0] == '#')
+	{
+		try
+		{
+			TUint codePoint;
+			if(aEntity[1] == 'x' || aEntity[1] == 'X')
+			{
+				codePoint = Ascii::UintHex(aEntity.Split(2));
+			}
+			else
+			{
+				codePoint = Ascii::Uint(aEntity.Split(1));
+			}
+
+			if(codePoint <= 0x10ffff)
+			{
+				return AppendUtf8(aText, codePoint);
+			}
+		}
+		catch(AsciiError)
+		{
+		}
+	}
+
+	if(value != 0)
+	{
+		return aText.TryAppend(value);
+	}
+
+	// not something we understand, keep it as it is
+	if(aText.Bytes() + aEntity.Bytes() + 2 > aText.MaxBytes())
+	{
+		return false;
+	}
+
+	aText.Append('&');
+	aText.Append(aEntity);
+	aText.Append(';');
+	return true;
+}
+
+
+const TByte* XmlEscaper::FindSpecial(const TByte* aStart, const TByte* aEnd)
+{
+	const TByte* p = aStart;
+
+#ifdef XMLTOKENIZER_AVX2
+	const __m256i lt32 = _mm256_set1_epi8('<');
+	const __m256i gt32 = _mm256_set1_epi8('>');
+	const __m256i amp32 = _mm256_set1_epi8('&');
+	const __m256i apos32 = _mm256_set1_epi8('\'');
+	const __m256i quot32 = _mm256_set1_epi8('"');
+	for(; aEnd - p >= 32; p += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i*)p);
+		__m256i match = _mm256_or_si256(_mm256_cmpeq_epi8(v, lt32), _mm256_cmpeq_epi8(v, gt32));
+		match = _mm256_or_si256(match, _mm256_cmpeq_epi8(v, amp32));
+		match = _mm256_or_si256(match, _mm256_or_si256(_mm256_cmpeq_epi8(v, apos32), _mm256_cmpeq_epi8(v, quot32)));
+		TUint mask = (TUint)_mm256_movemask_epi8(match);
+		if(mask != 0)
+		{
+			return p + LowestBit(mask);
+		}
+	}
+#endif
+
+#ifdef XMLTOKENIZER_SSE2
+	const __m128i lt16 = _mm_set1_epi8('<');
+	const __m128i gt16 = _mm_set1_epi8('>');
+	const __m128i amp16 = _mm_set1_epi8('&');
+	const __m128i apos16 = _mm_set1_epi8('\'');
+	const __m128i quot16 = _mm_set1_epi8('"');
+	for(; aEnd - p >= 16; p += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)p);
+		__m128i match = _mm_or_si128(_mm_cmpeq_epi8(v, lt16), _mm_cmpeq_epi8(v, gt16));
+		match = _mm_or_si128(match, _mm_cmpeq_epi8(v, amp16));
+		match = _mm_or_si128(match, _mm_or_si128(_mm_cmpeq_epi8(v, apos16), _mm_cmpeq_epi8(v, quot16)));
+		TUint mask = (TUint)_mm_movemask_epi8(match);
+		if(mask != 0)
+		{
+			return p + LowestBit(mask);
+		}
+	}
+#endif
+
+	for(; p < aEnd; ++p)
+	{
+		switch(*p)
+		{
+		case '<':
+		case '>':
+		case '&':
+		case '\'':
+		case '"':
+			return p;
+		}
+	}
+
+	return aEnd;
+}
+
+void XmlEscaper::Write(IWriter& aWriter, const Brx& aValue)
+{
+	Bws<kChunkBytes> chunk;
+
+	const TByte* p = aValue.Ptr();
+	const TByte* end = p + aValue.Bytes();
+
+	while(p < end)
+	{
+		const TByte* special = FindSpecial(p, end);
+
+		TUint run = special - p;
+		if(chunk.Bytes() + run > chunk.MaxBytes())
+		{
+			if(chunk.Bytes() > 0)
+			{
+				aWriter.Write(chunk);
+				chunk.SetBytes(0);
+			}
+
+			// too long to be worth gathering
+			if(run > chunk.MaxBytes())
+			{
+				aWriter.Write(Brn(p, run));
+				run = 0;
+			}
+		}
+		chunk.Append(Brn(p, run));
+
+		if(special == end)
+		{
+			break;
+		}
+
+		const Brx& entity = Entity(*special);
+
+		if(chunk.Bytes() + entity.Bytes() > chunk.MaxBytes())
+		{
+			aWriter.Write(chunk);
+			chunk.SetBytes(0);
+		}
+		chunk.Append(entity);
+
+		p = special + 1;
+	}
+
+	if(chunk.Bytes() > 0)
+	{
+		aWriter.Write(chunk);
+	}
+}
+
+void XmlEscaper::Write(WriterVector& aWriter, const Brx& aValue)
+{
+	const TByte* p = aValue.Ptr();
+	const TByte* end = p + aValue.Bytes();
+
+	while(p < end)
+	{
+		const TByte* special = FindSpecial(p, end);
+
+		if(special > p)
+		{
+			aWriter.WriteReference(Brn(p, special - p));
+		}
+
+		if(special == end)
+		{
+			break;
+		}
+
+		aWriter.WriteReference(Entity(*special));
+
+		p = special + 1;
+	}
+}
+
+const Brx& XmlEscaper::Entity(TByte aSpecial)
+{
+	static const Brn kLt("&lt;");
+	static const Brn kGt("&gt;");
+	static const Brn kAmp("&amp;");
+	static const Brn kApos("&apos;");
+	static const Brn kQuot("&quot;");
+
+	switch(aSpecial)
+	{
+	case '<':
+		return kLt;
+	case '>':
+		return kGt;
+	case '&':
+		return kAmp;
+	case '\'':
+		return kApos;
+	default:
+		return kQuot;
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef HEADER_PLAYLISTMANAGER_XMLTOKENIZER
+#define HEADER_PLAYLISTMANAGER_XMLTOKENIZER
+
+#include <OpenHome/Buffer.h>
+#include <OpenHome/Private/Stream.h>
+
+EXCEPTION(XmlTokenizerError);
+
+namespace OpenHome {
+namespace Media {
+
+class WriterVector;
+
+// Streaming tokenizer for the playlist file grammar: tags without attributes
+// separated by escaped text.  Delimiters are found a vector at a time where
+// the compiler targets SSE2 or AVX2, and entities are unescaped as the text
+// is copied out, so a track's metadata is written straight into its storage.
+
+class XmlTokenizer
+{
+public:
+	static const TUint kBufferBytes = 64 * 1024;
+
+public:
+	XmlTokenizer(IReaderSource& aSource);
+
+	// Skips to the next tag and returns what lies between its angle brackets.
+	// The result is only valid until the next call.  Throws ReaderFileError at
+	// the end of the input.
+	Brn NextTag();
+
+	// Unescapes the text up to the next tag into aText.  If the text doesn't
+	// fit it is consumed anyway and XmlTokenizerError is thrown.
+	void ReadText(Bwx& aText);
+
+	// First of aA or aB in [aStart, aEnd), or aEnd if neither is present
+	static const TByte* Find(const TByte* aStart, const TByte* aEnd, TByte aA, TByte aB);
+
+private:
+	TBool Fill(TUint aKeep);
+	TBool Unescape(const Brx& aEntity, Bwx& aText);
+
+private:
+	IReaderSource& iSource;
+	Bwh iBuffer;
+	TUint iOffset;
+	TBool iEnd;
+};
+
+// Writes text with the five XML special characters escaped.  Runs of plain
+// text are found a vector at a time and the output is gathered into chunks,
+// so the writer sees a few large writes rather than one per character.
+
+class XmlEscaper
+{
+public:
+	static const TUint kChunkBytes = 1024;
+
+public:
+	static void Write(IWriter& aWriter, const Brx& aValue);
+
+	// Nothing is copied: plain runs of aValue and the entities are passed by
+	// reference, so aValue must stay valid until the writer is flushed
+	static void Write(WriterVector& aWriter, const Brx& aValue);
+
+	// First special character in [aStart, aEnd), or aEnd if there are none
+	static const TByte* FindSpecial(const TByte* aStart, const TByte* aEnd);
+
+private:
+	static const Brx& Entity(TByte aSpecial);
+};
+
+} // Media
+} // OpenHome
+
+#endif
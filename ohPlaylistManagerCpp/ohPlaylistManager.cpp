@@ -2,13 +2,17 @@
 #include <OpenHome/Private/Ascii.h>
 #include <OpenHome/Private/Maths.h>
 #include <OpenHome/Private/OptionParser.h>
+#include <OpenHome/Private/Parser.h>
 #include <OpenHome/Net/Core/DvDevice.h>
 #include <OpenHome/Net/Core/OhNet.h>
 #include <OpenHome/Private/Debug.h>
+#include <OpenHome/Private/OsWrapper.h>
 
 #include <stdio.h>
 
 #include "PlaylistManager.h"
+#include "PagedStore.h"
+#include "MemoryStore.h"
 #include "ResourceManager.h"
 #include "Icon.h"
 
@@ -123,10 +127,67 @@ int CDECL main(int aArgc, char* aArgv[])
 	
 	OptionUint optionAdapter("-a", "--adapter", 0, "[adapter] index of network adapter to use");
     parser.AddOption(&optionAdapter);
+	
+	OptionString optionRoot("-r", "--root", Brn("."), "[directory] where playlist files are kept");
+    parser.AddOption(&optionRoot);
+	
+	OptionString optionStore("-s", "--store", Brn(""), "[file] keep all playlists in a single paged store file");
+    parser.AddOption(&optionStore);
+	
+	OptionBool optionMemory("-m", "--memory", "keep changes in memory only, starting from the playlists in the root directory");
+    parser.AddOption(&optionMemory);
+	
+	OptionUint optionLoaders("-l", "--loaders", 4, "[count] threads used to parse playlist files at startup");
+    parser.AddOption(&optionLoaders);
+	
+	OptionUint optionPrewarm("-w", "--prewarm", 0, "[count] most recently used playlists to load into the cache after startup");
+    parser.AddOption(&optionPrewarm);
+	
+	OptionBool optionProgressive("-p", "--progressive", "publish the device before every playlist file has been read");
+    parser.AddOption(&optionProgressive);
+	
+	OptionBool optionUring("-u", "--uring", "read and write playlist files through io_uring where the kernel supports it");
+    parser.AddOption(&optionUring);
+	
+	OptionString optionDurability("-d", "--durability", Brn("commit"), "[mode] none, interval or commit: when saved playlists are synced to the medium");
+    parser.AddOption(&optionDurability);
+	
+	OptionUint optionInterval("-t", "--interval", 1000, "[ms] how often interval durability syncs");
+    parser.AddOption(&optionInterval);
+	
+	OptionUint optionCoalesce("-c", "--coalesce", 50, "[ms] how long changes are gathered before IdArray and TokenArray are evented, 0 for every change");
+    parser.AddOption(&optionCoalesce);
+	
+	OptionString optionImport("-i", "--import", Brn(""), "[files] comma separated M3U, XSPF or DIDL-Lite files to add as playlists");
+    parser.AddOption(&optionImport);
+	
+	OptionString optionBackup("-b", "--backup", Brn("Backup.tar"), "[file] where b writes a snapshot of every playlist");
+    parser.AddOption(&optionBackup);
+	
+	OptionString optionExport("-e", "--export", Brn("Export"), "[directory] where e writes every playlist as a file of its own");
+    parser.AddOption(&optionExport);
+	
+	OptionString optionFormat("-f", "--format", Brn("m3u"), "[format] m3u, xspf or didl, for files written by e");
+    parser.AddOption(&optionFormat);
 
     if (!parser.Parse(aArgc, aArgv)) {
         return (1);
     }
+	
+	Durability::EMode durabilityMode;
+	if(!Durability::Parse(optionDurability.Value(), durabilityMode))
+	{
+		printf("Unknown durability\n");
+		return (1);
+	}
+	Durability durability(durabilityMode, optionInterval.Value());
+	
+	PlaylistExporter::EFormat format = PlaylistExporter::Format(optionFormat.Value());
+	if(format == PlaylistExporter::eUnknown)
+	{
+		printf("Unknown export format\n");
+		return (1);
+	}
 
     InitialisationParams* initParams = InitialisationParams::Create();
 
@@ -169,13 +230,76 @@ int CDECL main(int aArgc, char* aArgv[])
 
 	// create managers
 	
-	PlaylistManager* playlistManager = new PlaylistManager(*device, adapter, name, icon, Brx::Empty());
-	ProviderPlaylistManager iProvider(*device, *playlistManager, PlaylistManager::kMaxPlaylists, PlaylistData::kMaxTracks);
-	playlistManager->SetListener(iProvider);
+	Brhz root(optionRoot.Value());
+	
+	IFileStore* store;
+	if(optionMemory.Value())
+	{
+		store = new MemoryStore(root.CString());
+	}
+	else if(optionStore.Value().Bytes() > 0)
+	{
+		Brhz storeFilename(optionStore.Value());
+		try
+		{
+			store = new PagedStore(storeFilename.CString(), durability);
+		}
+		catch(PagedStoreError)
+		{
+			printf("Unable to open store %s\n", storeFilename.CString());
+			delete device;
+			UpnpLibrary::Close();
+			return (1);
+		}
+	}
+	else
+	{
+		store = new FileStoreDirectory(root.CString(), optionUring.Value(), durability);
+	}
+	
+	TUint startTime = Os::TimeInMs();
+	PlaylistManager* playlistManager = new PlaylistManager(*device, *store, adapter, name, icon, Brx::Empty(), optionLoaders.Value(), optionProgressive.Value());
+	ProviderPlaylistManager* provider = new ProviderPlaylistManager(*device, *playlistManager, PlaylistManager::kMaxPlaylists, PlaylistData::kMaxTracks, optionCoalesce.Value());
+	ProviderPlaylistManagerExtension* extension = new ProviderPlaylistManagerExtension(*device, *playlistManager);
+	playlistManager->SetListener(*provider);
+	
+	if(optionImport.Value().Bytes() > 0)
+	{
+		std::vector<Brhz*> paths;
+		std::vector<const TChar*> filenames;
+		Parser files(optionImport.Value());
+		for(;;)
+		{
+			Brn file = files.Next(',');
+			if(file.Bytes() == 0)
+			{
+				break;
+			}
+			paths.push_back(new Brhz(file));
+			filenames.push_back(paths.back()->CString());
+		}
+		
+		TUint importTime = Os::TimeInMs();
+		TUint tracks = playlistManager->Import(filenames);
+		Log::Print("Imported %u tracks in %u ms\n", tracks, Os::TimeInMs() - importTime);
+		
+		for(std::vector<Brhz*>::iterator i = paths.begin(); i != paths.end(); ++i)
+		{
+			delete *i;
+		}
+	}
     
     device->SetEnabled();
+	
+	// the first request can be answered from here on
+	Log::Print("Device enabled in %u ms\n", Os::TimeInMs() - startTime);
+	
+	playlistManager->Prewarm(optionPrewarm.Value());
 
-	printf("q = quit\n");
+	printf("q = quit, s = store statistics, b = back up, e = export\n");
+	
+	Brhz backup(optionBackup.Value());
+	Brhz exportRoot(optionExport.Value());
 	
     for (;;) {
     	int key = mygetch();
@@ -183,9 +307,40 @@ int CDECL main(int aArgc, char* aArgv[])
     	if (key == 'q') {
     		break;
 		}
+		if (key == 's') {
+			store->PrintStats();
+			Log::Print("Reclaimed %llu bytes from deleted playlists\n", (unsigned long long)playlistManager->ReclaimedBytes());
+		}
+		if (key == 'b') {
+			try {
+				TUint backupTime = Os::TimeInMs();
+				WriterFile file(backup.CString());
+				playlistManager->Snapshot(file);
+				file.Close();
+				Log::Print("Backed up to %s in %u ms\n", backup.CString(), Os::TimeInMs() - backupTime);
+			}
+			catch (WriterFileError) {
+				Log::Print("Backup to %s failed\n", backup.CString());
+			}
+		}
+		if (key == 'e') {
+			try {
+				TUint exportTime = Os::TimeInMs();
+				FileStoreDirectory directory(exportRoot.CString(), false, Durability(Durability::eCommit, 0));
+				TUint count = playlistManager->Export(directory, format);
+				Log::Print("Exported %u playlists to %s in %u ms\n", count, exportRoot.CString(), Os::TimeInMs() - exportTime);
+			}
+			catch (WriterFileError) {
+				Log::Print("Export to %s failed\n", exportRoot.CString());
+			}
+		}
 	}	
 
+	// the provider's publisher reads from the manager, so it goes first
+	delete extension;
+	delete provider;
 	delete playlistManager;
+	delete store;
     delete device;
 	
 	UpnpLibrary::Close();